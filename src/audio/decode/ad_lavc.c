@@ -38,6 +38,7 @@
 #include "common/msg.h"
 #include "demux/packet.h"
 #include "demux/stheader.h"
+#include "filters/f_decoder_pool.h"
 #include "filters/f_decoder_wrapper.h"
 #include "filters/filter_internal.h"
 #include "options/m_config.h"
@@ -54,6 +55,7 @@ struct priv {
     double next_pts;
     AVRational codec_timebase;
     struct lavc_state state;
+    bstr pool_key;
 
     struct mp_decoder public;
 };
@@ -102,16 +104,35 @@ static bool init(struct mp_filter *da, struct mp_codec_params *codec,
         return false;
     }
 
-    lavc_context = avcodec_alloc_context3(lavc_codec);
-    ctx->avctx = lavc_context;
+    bool downmix = opts->downmix && mpopts->audio_output_channels.num_chmaps == 1;
+
+    ctx->pool_key = mp_decoder_pool_key(ctx, decoder, codec);
+    bstr_xappend_asprintf(ctx, &ctx->pool_key, "%f,%d,%s;", opts->ac3drc,
+        opts->threads, downmix ?
+            mp_chmap_to_str(&mpopts->audio_output_channels.chmaps[0]) : "");
+    for (int n = 0; opts->avopts && opts->avopts[n]; n++)
+        bstr_xappend_asprintf(ctx, &ctx->pool_key, "%s;", opts->avopts[n]);
+
     ctx->avframe = av_frame_alloc();
     ctx->avpkt = av_packet_alloc();
-    MP_HANDLE_OOM(ctx->avctx && ctx->avframe && ctx->avpkt);
+    MP_HANDLE_OOM(ctx->avframe && ctx->avpkt);
+
+    AVBufferRef *dev = NULL;
+    if (mp_decoder_pool_get(da->global, ctx->pool_key, &ctx->avctx, &dev)) {
+        av_buffer_unref(&dev);
+        ctx->avctx->pkt_timebase = ctx->codec_timebase;
+        ctx->next_pts = MP_NOPTS_VALUE;
+        return true;
+    }
+
+    lavc_context = avcodec_alloc_context3(lavc_codec);
+    ctx->avctx = lavc_context;
+    MP_HANDLE_OOM(ctx->avctx);
     lavc_context->codec_type = AVMEDIA_TYPE_AUDIO;
     lavc_context->codec_id = lavc_codec->id;
     lavc_context->pkt_timebase = ctx->codec_timebase;
 
-    if (opts->downmix && mpopts->audio_output_channels.num_chmaps == 1) {
+    if (downmix) {
         const struct mp_chmap *requested_layout =
             &mpopts->audio_output_channels.chmaps[0];
         AVChannelLayout av_layout = { 0 };
@@ -156,6 +177,12 @@ static void ad_lavc_destroy(struct mp_filter *da)
 {
     struct priv *ctx = da->priv;
 
+    if (ctx->avctx && avcodec_is_open(ctx->avctx)) {
+        AVBufferRef *dev = NULL;
+        avcodec_flush_buffers(ctx->avctx);
+        mp_decoder_pool_put(da->global, ctx->pool_key, &ctx->avctx, &dev);
+    }
+
     avcodec_free_context(&ctx->avctx);
     av_frame_free(&ctx->avframe);
     mp_free_av_packet(&ctx->avpkt);
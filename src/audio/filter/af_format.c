@@ -140,4 +140,5 @@ const struct mp_user_filter_entry af_format = {
         },
     },
     .create = af_format_create,
+    .async_safe = true,
 };
@@ -623,4 +623,5 @@ const struct mp_user_filter_entry af_scaletempo = {
         },
     },
     .create = af_scaletempo_create,
+    .async_safe = true,
 };
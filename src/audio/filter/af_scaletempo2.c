@@ -242,4 +242,5 @@ const struct mp_user_filter_entry af_scaletempo2 = {
         }
     },
     .create = af_scaletempo2_create,
+    .async_safe = true,
 };
@@ -121,6 +121,25 @@ static int cmp_entry(const void *p1, const void *p2)
     return strcmp((*e1)->full_name, (*e2)->full_name);
 }
 
+// Rebuild the sorted list of all entries, if it was invalidated.
+// Must be called with stats->lock held.
+static void update_entries(struct stats_base *stats)
+{
+    if (stats->num_entries)
+        return;
+
+    for (struct stats_ctx *ctx = stats->list.head; ctx; ctx = ctx->list.next) {
+        for (int n = 0; n < ctx->num_entries; n++) {
+            MP_TARRAY_APPEND(stats, stats->entries, stats->num_entries,
+                             ctx->entries[n]);
+        }
+    }
+    if (stats->num_entries) {
+        qsort(stats->entries, stats->num_entries, sizeof(stats->entries[0]),
+              cmp_entry);
+    }
+}
+
 void stats_global_query(struct mpv_global *global, struct mpv_node *out)
 {
     struct stats_base *stats = global->stats;
@@ -130,19 +149,7 @@ void stats_global_query(struct mpv_global *global, struct mpv_node *out)
 
     atomic_store(&stats->active, true);
 
-    if (!stats->num_entries) {
-        for (struct stats_ctx *ctx = stats->list.head; ctx; ctx = ctx->list.next)
-        {
-            for (int n = 0; n < ctx->num_entries; n++) {
-                MP_TARRAY_APPEND(stats, stats->entries, stats->num_entries,
-                                 ctx->entries[n]);
-            }
-        }
-        if (stats->num_entries) {
-            qsort(stats->entries, stats->num_entries, sizeof(stats->entries[0]),
-                  cmp_entry);
-        }
-    }
+    update_entries(stats);
 
     node_init(out, MPV_FORMAT_NODE_ARRAY, NULL);
 
@@ -210,6 +217,43 @@ void stats_global_query(struct mpv_global *global, struct mpv_node *out)
     pthread_mutex_unlock(&stats->lock);
 }
 
+void stats_global_query_values(struct mpv_global *global, const char *prefix,
+                               struct mpv_node *out)
+{
+    struct stats_base *stats = global->stats;
+    assert(stats);
+
+    pthread_mutex_lock(&stats->lock);
+
+    atomic_store(&stats->active, true);
+
+    update_entries(stats);
+
+    node_init(out, MPV_FORMAT_NODE_ARRAY, NULL);
+
+    for (int n = 0; n < stats->num_entries; n++) {
+        struct stat_entry *e = stats->entries[n];
+
+        if (strncmp(e->full_name, prefix, strlen(prefix)) != 0)
+            continue;
+
+        switch (e->type) {
+        case VAL_STATIC:
+            add_stat(out, e, NULL, e->val_d, NULL);
+            break;
+        case VAL_STATIC_SIZE: {
+            char *s = format_file_size(e->val_d);
+            add_stat(out, e, NULL, e->val_d, s);
+            talloc_free(s);
+            break;
+        }
+        default: ;
+        }
+    }
+
+    pthread_mutex_unlock(&stats->lock);
+}
+
 static void stats_ctx_destroy(void *p)
 {
     struct stats_ctx *ctx = p;
@@ -7,6 +7,12 @@ struct stats_ctx;
 void stats_global_init(struct mpv_global *global);
 void stats_global_query(struct mpv_global *global, struct mpv_node *out);
 
+// Like stats_global_query(), but return only entries set with stats_value() or
+// stats_size_value() whose name starts with prefix. Does not reset anything,
+// so it can be used independently of stats_global_query().
+void stats_global_query_values(struct mpv_global *global, const char *prefix,
+                               struct mpv_node *out);
+
 // stats_ctx can be free'd with ta_free(), or by using the ta_parent.
 struct stats_ctx *stats_ctx_create(void *ta_parent, struct mpv_global *global,
                                    const char *prefix);
@@ -406,6 +406,7 @@ struct demux_stream {
     double bitrate;
     struct demux_packet *reader_head;   // points at current decoder position
     bool skip_to_keyframe;
+    bool keyframes_only;    // return only keyframe packets to the reader
     bool attached_picture_added;
     bool need_wakeup;       // call wakeup_cb on next reader_head state change
     double force_read_until;// eager=false streams (subs): force read-ahead
@@ -2695,6 +2696,13 @@ static int dequeue_packet(struct demux_stream *ds, double min_pts,
         eof = ds->back_range_count < 0;
     }
 
+    // Skip the queued packets up to the next keyframe. They're dropped without
+    // being copied (or read from the disk cache).
+    if (ds->keyframes_only && !in->back_demuxing) {
+        while (ds->reader_head && !ds->reader_head->keyframe)
+            advance_reader_head(ds);
+    }
+
     ds->need_wakeup = !ds->reader_head;
     if (!ds->reader_head || eof) {
         if (!ds->eager) {
@@ -4050,6 +4058,16 @@ void demux_set_stream_wakeup_cb(struct sh_stream *sh,
     pthread_mutex_unlock(&sh->ds->in->lock);
 }
 
+// If enabled, the reader gets only keyframe packets of this stream (with
+// forward playback). Does not affect what is demuxed and cached. When disabling
+// it, the reader is responsible for skipping to the next keyframe itself.
+void demux_set_stream_keyframes_only(struct sh_stream *sh, bool enable)
+{
+    pthread_mutex_lock(&sh->ds->in->lock);
+    sh->ds->keyframes_only = enable;
+    pthread_mutex_unlock(&sh->ds->in->lock);
+}
+
 int demuxer_add_attachment(demuxer_t *demuxer, char *name, char *type,
                            void *data, size_t data_size)
 {
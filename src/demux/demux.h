@@ -258,6 +258,7 @@ int demux_read_packet_async_until(struct sh_stream *sh, double min_pts,
 bool demux_stream_is_selected(struct sh_stream *stream);
 void demux_set_stream_wakeup_cb(struct sh_stream *sh,
                                 void (*cb)(void *ctx), void *ctx);
+void demux_set_stream_keyframes_only(struct sh_stream *sh, bool enable);
 struct demux_packet *demux_read_any_packet(struct demuxer *demuxer);
 
 struct sh_stream *demux_get_stream(struct demuxer *demuxer, int index);
@@ -15,30 +15,189 @@ struct mp_async_queue {
     struct async_queue *q;
 };
 
+// Frames are stored in a singly linked list of fixed-size chunks, which is used
+// as single-producer/single-consumer FIFO: only the producer filter
+// (process_in()) appends frames, and only the consumer filter (process_out())
+// removes them. The two ends synchronize through the atomic num_written and
+// num_read counters, and the size accounting is atomic as well, so neither end
+// ever waits for the other. The configured size limit is enforced by the
+// producer only (is_full()).
+//
+// Operations that affect both ends (reset, config changes, connecting filters)
+// take in_lock and out_lock (in this order). Each end holds its own lock while
+// it accesses the queue, so these can't run concurrently with it. Normally,
+// each of these locks is used by a single thread only, and is uncontended.
+#define CHUNK_FRAMES 64
+
+struct chunk {
+    // Set by the producer before the first frame in the next chunk is
+    // published, so the consumer can always follow it.
+    struct chunk *next;
+    struct mp_frame frames[CHUNK_FRAMES];
+};
+
 struct async_queue {
     mp_atomic_uint64 refcount;
 
-    pthread_mutex_t lock;
+    pthread_mutex_t in_lock;    // held by the producer while it runs
+    pthread_mutex_t out_lock;   // held by the consumer while it runs
 
-    // -- protected by lock
+    // -- protected by both locks (reading requires either lock)
     struct mp_async_queue_config cfg;
-    bool active; // queue was resumed; consumer may request frames
-    bool reading; // data flow: reading => consumer has requested frames
-    int64_t samples_size; // queue size in the cfg.sample_unit
-    size_t byte_size; // queue size in bytes (using approx. frame sizes)
-    int num_frames;
-    struct mp_frame *frames;
-    int eof_count; // number of MP_FRAME_EOF in frames[], for draining
     struct mp_filter *conn[2]; // filters: in (0), out (1)
+
+    // -- written with both locks held (or by the consumer for reading=true)
+    atomic_bool active; // queue was resumed; consumer may request frames
+    atomic_bool reading; // data flow: reading => consumer has requested frames
+
+    // -- updated by both ends, can be read without lock
+    mp_atomic_int64 samples_size; // queue size in the cfg.sample_unit
+    mp_atomic_int64 byte_size; // queue size in bytes (using approx. frame sizes)
+    mp_atomic_int64 eof_count; // number of MP_FRAME_EOF in the queue, for draining
+    mp_atomic_uint64 num_written; // frames appended; written by producer only
+    mp_atomic_uint64 num_read; // frames removed; written by consumer only
+
+    // -- producer only (in_lock)
+    struct chunk *tail; // chunk containing frame num_written - 1
+    // pts of frames [num_read, num_written), indexed by frame number & pts_mask.
+    // Kept separately, so is_full() never touches chunks owned by the consumer.
+    double *pts;
+    uint64_t pts_mask;
+
+    // -- consumer only (out_lock)
+    struct chunk *head; // chunk containing frame num_read (or num_read - 1 if
+                        // num_read is at a chunk boundary)
+
+    _Atomic(struct chunk *) spare; // chunk freed by consumer, for reuse
 };
 
+static void lock_both(struct async_queue *q)
+{
+    pthread_mutex_lock(&q->in_lock);
+    pthread_mutex_lock(&q->out_lock);
+}
+
+static void unlock_both(struct async_queue *q)
+{
+    pthread_mutex_unlock(&q->out_lock);
+    pthread_mutex_unlock(&q->in_lock);
+}
+
+static struct chunk *alloc_chunk(struct async_queue *q)
+{
+    struct chunk *c = atomic_exchange(&q->spare, NULL);
+    if (!c)
+        c = talloc(NULL, struct chunk);
+    c->next = NULL;
+    return c;
+}
+
+static void free_chunk(struct async_queue *q, struct chunk *c)
+{
+    talloc_free(atomic_exchange(&q->spare, c));
+}
+
+static int get_frames(struct async_queue *q)
+{
+    // Load num_read first, so the result can't be negative.
+    uint64_t r = atomic_load(&q->num_read);
+    return atomic_load(&q->num_written) - r;
+}
+
+static int64_t frame_get_samples(struct async_queue *q, struct mp_frame frame)
+{
+    int64_t res = 1;
+    if (frame.type == MP_FRAME_AUDIO && q->cfg.sample_unit == AQUEUE_UNIT_SAMPLES) {
+        struct mp_aframe *aframe = frame.data;
+        res = mp_aframe_get_size(aframe);
+    }
+    if (mp_frame_is_signaling(frame))
+        return 0;
+    return res;
+}
+
+// Add or remove a frame from the accounted queue size.
+//  dir==1: add, dir==-1: remove
+static void account_frame(struct async_queue *q, struct mp_frame frame,
+                          int dir)
+{
+    assert(dir == 1 || dir == -1);
+
+    int64_t bytes = dir * (int64_t)mp_frame_approx_size(frame);
+    atomic_fetch_add(&q->samples_size, dir * frame_get_samples(q, frame));
+    atomic_fetch_add(&q->byte_size, bytes);
+    if (q->cfg.shared_bytes)
+        atomic_fetch_add(q->cfg.shared_bytes, bytes);
+
+    if (frame.type == MP_FRAME_EOF)
+        atomic_fetch_add(&q->eof_count, dir);
+}
+
+// Producer only.
+static void set_pts(struct async_queue *q, uint64_t index, double pts)
+{
+    uint64_t r = atomic_load(&q->num_read);
+    if (index - r > q->pts_mask) {
+        uint64_t size = q->pts_mask + 1;
+        while (index - r >= size)
+            size *= 2;
+        double *pts_new = talloc_array(q, double, size);
+        for (uint64_t n = r; n < index; n++)
+            pts_new[n & (size - 1)] = q->pts[n & q->pts_mask];
+        talloc_free(q->pts);
+        q->pts = pts_new;
+        q->pts_mask = size - 1;
+    }
+    q->pts[index & q->pts_mask] = pts;
+}
+
+// Producer only.
+static void push_frame(struct async_queue *q, struct mp_frame frame)
+{
+    uint64_t w = atomic_load_explicit(&q->num_written, memory_order_relaxed);
+    if (w > 0 && w % CHUNK_FRAMES == 0) {
+        struct chunk *c = alloc_chunk(q);
+        q->tail->next = c;
+        q->tail = c;
+    }
+    q->tail->frames[w % CHUNK_FRAMES] = frame;
+    set_pts(q, w, mp_frame_get_pts(frame));
+    account_frame(q, frame, 1);
+    // Publishes the frame to the consumer.
+    atomic_store(&q->num_written, w + 1);
+}
+
+// Consumer only. Returns false if the queue is empty.
+static bool pop_frame(struct async_queue *q, struct mp_frame *out)
+{
+    uint64_t r = atomic_load_explicit(&q->num_read, memory_order_relaxed);
+    if (r == atomic_load(&q->num_written))
+        return false;
+    if (r > 0 && r % CHUNK_FRAMES == 0) {
+        struct chunk *c = q->head;
+        q->head = c->next;
+        free_chunk(q, c);
+    }
+    *out = q->head->frames[r % CHUNK_FRAMES];
+    q->head->frames[r % CHUNK_FRAMES] = MP_NO_FRAME;
+    account_frame(q, *out, -1);
+    assert(atomic_load(&q->samples_size) >= 0);
+    atomic_store(&q->num_read, r + 1);
+    return true;
+}
+
 static void reset_queue(struct async_queue *q)
 {
-    pthread_mutex_lock(&q->lock);
+    lock_both(q);
     q->active = q->reading = false;
-    for (int n = 0; n < q->num_frames; n++)
-        mp_frame_unref(&q->frames[n]);
-    q->num_frames = 0;
+    struct mp_frame frame;
+    while (pop_frame(q, &frame))
+        mp_frame_unref(&frame);
+    // All frames were popped, so head==tail, and indexes can start over.
+    assert(q->head == q->tail);
+    q->num_read = q->num_written = 0;
+    if (q->cfg.shared_bytes)
+        atomic_fetch_add(q->cfg.shared_bytes, -atomic_load(&q->byte_size));
     q->eof_count = 0;
     q->samples_size = 0;
     q->byte_size = 0;
@@ -46,7 +205,7 @@ static void reset_queue(struct async_queue *q)
         if (q->conn[n])
             mp_filter_wakeup(q->conn[n]);
     }
-    pthread_mutex_unlock(&q->lock);
+    unlock_both(q);
 }
 
 static void unref_queue(struct async_queue *q)
@@ -57,7 +216,10 @@ static void unref_queue(struct async_queue *q)
     assert(count >= 0);
     if (count == 0) {
         reset_queue(q);
-        pthread_mutex_destroy(&q->lock);
+        talloc_free(q->head);
+        talloc_free(atomic_load(&q->spare));
+        pthread_mutex_destroy(&q->in_lock);
+        pthread_mutex_destroy(&q->out_lock);
         talloc_free(q);
     }
 }
@@ -75,31 +237,30 @@ struct mp_async_queue *mp_async_queue_create(void)
     *r->q = (struct async_queue){
         .refcount = ATOMIC_VAR_INIT(1),
     };
-    pthread_mutex_init(&r->q->lock, NULL);
+    pthread_mutex_init(&r->q->in_lock, NULL);
+    pthread_mutex_init(&r->q->out_lock, NULL);
+    r->q->head = r->q->tail = alloc_chunk(r->q);
+    r->q->pts_mask = 15;
+    r->q->pts = talloc_array(r->q, double, r->q->pts_mask + 1);
     talloc_set_destructor(r, on_free_queue);
     mp_async_queue_set_config(r, (struct mp_async_queue_config){0});
     return r;
 }
 
-static int64_t frame_get_samples(struct async_queue *q, struct mp_frame frame)
-{
-    int64_t res = 1;
-    if (frame.type == MP_FRAME_AUDIO && q->cfg.sample_unit == AQUEUE_UNIT_SAMPLES) {
-        struct mp_aframe *aframe = frame.data;
-        res = mp_aframe_get_size(aframe);
-    }
-    if (mp_frame_is_signaling(frame))
-        return 0;
-    return res;
-}
-
+// Producer only (or with in_lock held).
 static bool is_full(struct async_queue *q)
 {
-    if (q->samples_size >= q->cfg.max_samples || q->byte_size >= q->cfg.max_bytes)
+    if (atomic_load(&q->samples_size) >= q->cfg.max_samples ||
+        atomic_load(&q->byte_size) >= q->cfg.max_bytes)
         return true;
-    if (q->num_frames >= 2 && q->cfg.max_duration > 0) {
-        double pts1 = mp_frame_get_pts(q->frames[q->num_frames - 1]);
-        double pts2 = mp_frame_get_pts(q->frames[0]);
+    uint64_t r = atomic_load(&q->num_read);
+    uint64_t w = atomic_load_explicit(&q->num_written, memory_order_relaxed);
+    if (q->cfg.shared_bytes && w != r &&
+        atomic_load(q->cfg.shared_bytes) >= q->cfg.max_shared_bytes)
+        return true;
+    if (w - r >= 2 && q->cfg.max_duration > 0) {
+        double pts1 = q->pts[r & q->pts_mask];
+        double pts2 = q->pts[(w - 1) & q->pts_mask];
         if (pts1 != MP_NOPTS_VALUE && pts2 != MP_NOPTS_VALUE &&
             pts2 - pts1 >= q->cfg.max_duration)
             return true;
@@ -107,27 +268,20 @@ static bool is_full(struct async_queue *q)
     return false;
 }
 
-// Add or remove a frame from the accounted queue size.
-//  dir==1: add, dir==-1: remove
-static void account_frame(struct async_queue *q, struct mp_frame frame,
-                          int dir)
-{
-    assert(dir == 1 || dir == -1);
-
-    q->samples_size += dir * frame_get_samples(q, frame);
-    q->byte_size += dir * mp_frame_approx_size(frame);
-
-    if (frame.type == MP_FRAME_EOF)
-        q->eof_count += dir;
-}
-
+// Both locks must be held.
 static void recompute_sizes(struct async_queue *q)
 {
+    if (q->cfg.shared_bytes)
+        atomic_fetch_add(q->cfg.shared_bytes, -atomic_load(&q->byte_size));
     q->eof_count = 0;
     q->samples_size = 0;
     q->byte_size = 0;
-    for (int n = 0; n < q->num_frames; n++)
-        account_frame(q, q->frames[n], 1);
+    struct chunk *c = q->head;
+    for (uint64_t n = q->num_read; n < q->num_written; n++) {
+        if (n > 0 && n % CHUNK_FRAMES == 0)
+            c = c->next;
+        account_frame(q, c->frames[n % CHUNK_FRAMES], 1);
+    }
 }
 
 void mp_async_queue_set_config(struct mp_async_queue *queue,
@@ -142,12 +296,23 @@ void mp_async_queue_set_config(struct mp_async_queue *queue,
 
     cfg.max_samples = MPMAX(cfg.max_samples, 1);
 
-    pthread_mutex_lock(&q->lock);
+    lock_both(q);
+    if (q->cfg.shared_bytes != cfg.shared_bytes) {
+        // Move the queue's accounted size to the new counter.
+        int64_t bytes = atomic_load(&q->byte_size);
+        if (q->cfg.shared_bytes)
+            atomic_fetch_add(q->cfg.shared_bytes, -bytes);
+        if (cfg.shared_bytes)
+            atomic_fetch_add(cfg.shared_bytes, bytes);
+    }
     bool recompute = q->cfg.sample_unit != cfg.sample_unit;
     q->cfg = cfg;
     if (recompute)
         recompute_sizes(q);
-    pthread_mutex_unlock(&q->lock);
+    // The new limits might allow writing more.
+    if (q->conn[0])
+        mp_filter_wakeup(q->conn[0]);
+    unlock_both(q);
 }
 
 void mp_async_queue_reset(struct mp_async_queue *queue)
@@ -157,19 +322,15 @@ void mp_async_queue_reset(struct mp_async_queue *queue)
 
 bool mp_async_queue_is_active(struct mp_async_queue *queue)
 {
-    struct async_queue *q = queue->q;
-    pthread_mutex_lock(&q->lock);
-    bool res = q->active;
-    pthread_mutex_unlock(&q->lock);
-    return res;
+    return atomic_load(&queue->q->active);
 }
 
 bool mp_async_queue_is_full(struct mp_async_queue *queue)
 {
     struct async_queue *q = queue->q;
-    pthread_mutex_lock(&q->lock);
+    pthread_mutex_lock(&q->in_lock);
     bool res = is_full(q);
-    pthread_mutex_unlock(&q->lock);
+    pthread_mutex_unlock(&q->in_lock);
     return res;
 }
 
@@ -177,21 +338,21 @@ void mp_async_queue_resume(struct mp_async_queue *queue)
 {
     struct async_queue *q = queue->q;
 
-    pthread_mutex_lock(&q->lock);
+    lock_both(q);
     if (!q->active) {
         q->active = true;
         // Possibly make the consumer request new frames.
         if (q->conn[1])
             mp_filter_wakeup(q->conn[1]);
     }
-    pthread_mutex_unlock(&q->lock);
+    unlock_both(q);
 }
 
 void mp_async_queue_resume_reading(struct mp_async_queue *queue)
 {
     struct async_queue *q = queue->q;
 
-    pthread_mutex_lock(&q->lock);
+    lock_both(q);
     if (!q->active || !q->reading) {
         q->active = true;
         q->reading = true;
@@ -201,25 +362,17 @@ void mp_async_queue_resume_reading(struct mp_async_queue *queue)
                 mp_filter_wakeup(q->conn[n]);
         }
     }
-    pthread_mutex_unlock(&q->lock);
+    unlock_both(q);
 }
 
 int64_t mp_async_queue_get_samples(struct mp_async_queue *queue)
 {
-    struct async_queue *q = queue->q;
-    pthread_mutex_lock(&q->lock);
-    int64_t res = q->samples_size;
-    pthread_mutex_unlock(&q->lock);
-    return res;
+    return atomic_load(&queue->q->samples_size);
 }
 
 int mp_async_queue_get_frames(struct mp_async_queue *queue)
 {
-    struct async_queue *q = queue->q;
-    pthread_mutex_lock(&q->lock);
-    int res = q->num_frames;
-    pthread_mutex_unlock(&q->lock);
-    return res;
+    return get_frames(queue->q);
 }
 
 struct priv {
@@ -232,12 +385,12 @@ static void destroy(struct mp_filter *f)
     struct priv *p = f->priv;
     struct async_queue *q = p->q;
 
-    pthread_mutex_lock(&q->lock);
+    lock_both(q);
     for (int n = 0; n < 2; n++) {
         if (q->conn[n] == f)
             q->conn[n] = NULL;
     }
-    pthread_mutex_unlock(&q->lock);
+    unlock_both(q);
 
     unref_queue(q);
 }
@@ -248,8 +401,8 @@ static void process_in(struct mp_filter *f)
     struct async_queue *q = p->q;
     assert(q->conn[0] == f);
 
-    pthread_mutex_lock(&q->lock);
-    if (!q->reading) {
+    pthread_mutex_lock(&q->in_lock);
+    if (!atomic_load(&q->reading)) {
         // mp_async_queue_reset()/reset_queue() is usually called asynchronously,
         // so we might have requested a frame earlier, and now can't use it.
         // Discard it; the expectation is that this is a benign logical race
@@ -261,8 +414,7 @@ static void process_in(struct mp_filter *f)
         }
     } else if (!is_full(q) && mp_pin_out_request_data(f->ppins[0])) {
         struct mp_frame frame = mp_pin_out_read(f->ppins[0]);
-        account_frame(q, frame, 1);
-        MP_TARRAY_INSERT_AT(q, q->frames, q->num_frames, 0, frame);
+        push_frame(q, frame);
         // Notify reader that we have new frames.
         if (q->conn[1])
             mp_filter_wakeup(q->conn[1]);
@@ -272,9 +424,10 @@ static void process_in(struct mp_filter *f)
         if (p->notify && full)
             mp_filter_wakeup(p->notify);
     }
-    if (p->notify && !q->num_frames)
+    if (p->notify && !get_frames(q))
         mp_filter_wakeup(p->notify);
-    pthread_mutex_unlock(&q->lock);
+    mp_filter_internal_report_queue(f, get_frames(q), q->byte_size);
+    pthread_mutex_unlock(&q->in_lock);
 }
 
 static void process_out(struct mp_filter *f)
@@ -286,22 +439,20 @@ static void process_out(struct mp_filter *f)
     if (!mp_pin_in_needs_data(f->ppins[0]))
         return;
 
-    pthread_mutex_lock(&q->lock);
+    pthread_mutex_lock(&q->out_lock);
     if (q->active && !q->reading) {
         q->reading = true;
         mp_filter_wakeup(q->conn[0]);
     }
-    if (q->active && q->num_frames) {
-        struct mp_frame frame = q->frames[q->num_frames - 1];
-        q->num_frames -= 1;
-        account_frame(q, frame, -1);
-        assert(q->samples_size >= 0);
+    struct mp_frame frame;
+    if (q->active && pop_frame(q, &frame)) {
         mp_pin_in_write(f->ppins[0], frame);
         // Notify writer that we need new frames.
         if (q->conn[0])
             mp_filter_wakeup(q->conn[0]);
     }
-    pthread_mutex_unlock(&q->lock);
+    mp_filter_internal_report_queue(f, get_frames(q), q->byte_size);
+    pthread_mutex_unlock(&q->out_lock);
 }
 
 static void reset(struct mp_filter *f)
@@ -309,12 +460,10 @@ static void reset(struct mp_filter *f)
     struct priv *p = f->priv;
     struct async_queue *q = p->q;
 
-    pthread_mutex_lock(&q->lock);
     // If the queue is in reading state, it is logical that it should request
     // input immediately.
-    if (mp_pin_get_dir(f->pins[0]) == MP_PIN_IN && q->reading)
+    if (mp_pin_get_dir(f->pins[0]) == MP_PIN_IN && atomic_load(&q->reading))
         mp_filter_wakeup(f);
-    pthread_mutex_unlock(&q->lock);
 }
 
 // producer
@@ -365,11 +514,11 @@ struct mp_filter *mp_async_queue_create_filter(struct mp_filter *parent,
     atomic_fetch_add(&q->refcount, 1);
     p->q = q;
 
-    pthread_mutex_lock(&q->lock);
+    lock_both(q);
     int slot = is_in ? 0 : 1;
     assert(!q->conn[slot]); // fails if already connected on this end
     q->conn[slot] = f;
-    pthread_mutex_unlock(&q->lock);
+    unlock_both(q);
 
     return f;
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "osdep/atomic.h"
+
 #include "filter.h"
 
 // A thread safe queue, which buffers a configurable number of frames like a
@@ -120,6 +122,14 @@ struct mp_async_queue_config {
     // at least 2 samples. Behavior is unclear on timestamp resets (even if EOF
     // frames are between them). A value of 0 disables this completely.
     double max_duration;
+
+    // If set, the queue's byte size is also accounted in this counter, which
+    // can be shared by several queues, and the queue is full if the counter
+    // reaches max_shared_bytes. An empty queue always accepts 1 frame, so a
+    // queue whose consumer waits for it can't be blocked by the others. The
+    // counter must be 0 initially, and outlive the queue.
+    mp_atomic_int64 *shared_bytes;
+    int64_t max_shared_bytes;
 };
 
 // Configure the queue size. By default, the queue size is 1 frame.
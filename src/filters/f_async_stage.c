@@ -0,0 +1,289 @@
+#include <pthread.h>
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "misc/thread_pool.h"
+
+#include "f_async_queue.h"
+#include "f_async_stage.h"
+#include "filter_internal.h"
+
+struct priv {
+    struct mp_filter *f;
+    struct mp_thread_pool *pool;
+
+    struct mp_async_queue *q_in, *q_out;
+
+    // Separate filter graph, driven by the worker. Accessed by the thread
+    // owning f only while blocked (see block_stage()).
+    struct mp_filter *root;
+    struct mp_filter *inner;
+    struct mp_stream_info stream_info;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+
+    // --- protected by lock
+    bool scheduled;     // run_stage() was queued or is running
+    bool rerun;         // wakeup received while running or blocked
+    int blocked;        // if >0, the worker is not allowed to run
+    bool failed;        // inner filter failed; reported to f on next process()
+    bool has_is_active; // inner filter supports MP_FILTER_COMMAND_IS_ACTIVE
+    bool is_active;     // last result of MP_FILTER_COMMAND_IS_ACTIVE
+};
+
+static void run_stage(void *ptr);
+
+static void schedule_locked(struct priv *p)
+{
+    if (p->scheduled || p->blocked) {
+        p->rerun = true;
+        return;
+    }
+    p->scheduled = true;
+    p->rerun = false;
+    // Can't fail, the pool always has at least 1 thread.
+    mp_thread_pool_queue(p->pool, run_stage, p);
+}
+
+// Wakeup callback of the inner filter graph. Called from any thread.
+static void wakeup_stage(void *ptr)
+{
+    struct priv *p = ptr;
+
+    pthread_mutex_lock(&p->lock);
+    schedule_locked(p);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void run_stage(void *ptr)
+{
+    struct priv *p = ptr;
+    bool failed = false;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->blocked) {
+        p->rerun = false;
+        pthread_mutex_unlock(&p->lock);
+
+        mp_filter_graph_run(p->root);
+
+        failed |= mp_filter_has_failed(p->inner);
+        struct mp_filter_command cmd = {.type = MP_FILTER_COMMAND_IS_ACTIVE};
+        bool has_is_active = mp_filter_command(p->inner, &cmd);
+
+        pthread_mutex_lock(&p->lock);
+        p->has_is_active = has_is_active;
+        p->is_active = cmd.is_active;
+        p->failed |= failed;
+        if (!p->rerun)
+            break;
+    }
+    p->scheduled = false;
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
+
+    if (failed)
+        mp_filter_wakeup(p->f);
+}
+
+// Stop the worker and prevent it from running again until unblock_stage().
+// While blocked, the inner filter graph can be accessed by the caller.
+static void block_stage(struct priv *p)
+{
+    pthread_mutex_lock(&p->lock);
+    p->blocked++;
+    while (p->scheduled) {
+        mp_filter_graph_interrupt(p->root);
+        pthread_cond_wait(&p->wakeup, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void unblock_stage(struct priv *p)
+{
+    pthread_mutex_lock(&p->lock);
+    assert(p->blocked > 0);
+    p->blocked--;
+    if (!p->blocked && p->rerun)
+        schedule_locked(p);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void stage_process(struct mp_filter *f)
+{
+    struct priv *p = f->priv;
+
+    pthread_mutex_lock(&p->lock);
+    bool failed = p->failed;
+    p->failed = false;
+    pthread_mutex_unlock(&p->lock);
+
+    if (failed)
+        mp_filter_internal_mark_failed(f);
+}
+
+static void stage_reset(struct mp_filter *f)
+{
+    struct priv *p = f->priv;
+
+    mp_async_queue_reset(p->q_in);
+    mp_async_queue_reset(p->q_out);
+
+    block_stage(p);
+    mp_filter_reset(p->root);
+    pthread_mutex_lock(&p->lock);
+    p->failed = false;
+    pthread_mutex_unlock(&p->lock);
+    unblock_stage(p);
+
+    mp_async_queue_resume(p->q_in);
+    // Start filling the output queue without waiting for the first request.
+    mp_async_queue_resume_reading(p->q_out);
+}
+
+static bool stage_command(struct mp_filter *f, struct mp_filter_command *cmd)
+{
+    struct priv *p = f->priv;
+
+    if (cmd->type == MP_FILTER_COMMAND_IS_ACTIVE) {
+        pthread_mutex_lock(&p->lock);
+        bool res = p->has_is_active;
+        cmd->is_active = p->is_active;
+        pthread_mutex_unlock(&p->lock);
+        return res;
+    }
+
+    block_stage(p);
+    bool res = mp_filter_command(p->inner, cmd);
+    unblock_stage(p);
+    wakeup_stage(p);
+    return res;
+}
+
+static void stage_destroy(struct mp_filter *f)
+{
+    struct priv *p = f->priv;
+
+    // Never unblocked again.
+    if (p->root)
+        block_stage(p);
+
+    mp_filter_free_children(f);
+
+    talloc_free(p->root);
+    talloc_free(p->q_in);
+    talloc_free(p->q_out);
+    pthread_cond_destroy(&p->wakeup);
+    pthread_mutex_destroy(&p->lock);
+}
+
+static const struct mp_filter_info async_stage_filter;
+
+void mp_async_stage_set_queue_config(struct mp_filter *f, enum mp_pin_dir dir,
+                                     struct mp_async_queue_config cfg)
+{
+    assert(mp_filter_get_info(f) == &async_stage_filter);
+    struct priv *p = f->priv;
+
+    mp_async_queue_set_config(dir == MP_PIN_IN ? p->q_in : p->q_out, cfg);
+}
+
+struct mp_filter *mp_async_stage_lock(struct mp_filter *f)
+{
+    assert(mp_filter_get_info(f) == &async_stage_filter);
+    struct priv *p = f->priv;
+
+    block_stage(p);
+    return p->inner;
+}
+
+void mp_async_stage_unlock(struct mp_filter *f)
+{
+    struct priv *p = f->priv;
+
+    unblock_stage(p);
+    wakeup_stage(p);
+}
+
+static const struct mp_filter_info async_stage_filter = {
+    .name = "async_stage",
+    .priv_size = sizeof(struct priv),
+    .process = stage_process,
+    .reset = stage_reset,
+    .command = stage_command,
+    .destroy = stage_destroy,
+};
+
+struct mp_filter *mp_async_stage_create(struct mp_filter *parent, int threads,
+    struct mp_filter *(*create)(struct mp_filter *parent, void *ctx),
+    void *ctx)
+{
+    struct mp_filter *f = mp_filter_create(parent, &async_stage_filter);
+    if (!f)
+        return NULL;
+
+    struct priv *p = f->priv;
+    p->f = f;
+    p->is_active = true;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wakeup, NULL);
+
+    mp_filter_add_pin(f, MP_PIN_IN, "in");
+    mp_filter_add_pin(f, MP_PIN_OUT, "out");
+
+    p->pool = mp_filter_graph_get_thread_pool(f, threads);
+    if (!p->pool)
+        goto error;
+
+    p->q_in = mp_async_queue_create();
+    p->q_out = mp_async_queue_create();
+    p->root = mp_filter_create_root(f->global);
+
+    // Only pass down what can be used from another thread.
+    struct mp_stream_info *sinfo = mp_filter_find_stream_info(parent);
+    if (sinfo) {
+        p->root->stream_info = &p->stream_info;
+        p->stream_info = (struct mp_stream_info){
+            .hwdec_devs = sinfo->hwdec_devs,
+            .osd = sinfo->osd,
+            .rotate90 = sinfo->rotate90,
+            .dr_vo = sinfo->dr_vo,
+        };
+    }
+
+    // Created before the wakeup callback is set; it can't run concurrently yet.
+    p->inner = create(p->root, ctx);
+    if (!p->inner)
+        goto error;
+    if (p->inner->num_pins != 2 ||
+        mp_pin_get_dir(p->inner->pins[0]) != MP_PIN_IN ||
+        mp_pin_get_dir(p->inner->pins[1]) != MP_PIN_OUT)
+    {
+        MP_ERR(f, "filter '%s' can't be run asynchronously\n",
+               mp_filter_get_info(p->inner)->name);
+        goto error;
+    }
+
+    struct mp_filter *w_in = mp_async_queue_create_filter(f, MP_PIN_IN, p->q_in);
+    struct mp_filter *r_in =
+        mp_async_queue_create_filter(p->root, MP_PIN_OUT, p->q_in);
+    struct mp_filter *w_out =
+        mp_async_queue_create_filter(p->root, MP_PIN_IN, p->q_out);
+    struct mp_filter *r_out =
+        mp_async_queue_create_filter(f, MP_PIN_OUT, p->q_out);
+
+    mp_pin_connect(w_in->pins[0], f->ppins[0]);
+    mp_pin_connect(p->inner->pins[0], r_in->pins[0]);
+    mp_pin_connect(w_out->pins[0], p->inner->pins[1]);
+    mp_pin_connect(f->ppins[1], r_out->pins[0]);
+
+    mp_filter_graph_set_wakeup_cb(p->root, wakeup_stage, p);
+
+    stage_reset(f);
+
+    return f;
+error:
+    talloc_free(f);
+    return NULL;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "f_async_queue.h"
+#include "filter.h"
+
+// Run a single-input, single-output filter asynchronously: the filter is put
+// into its own filter graph, which is driven by a worker from the parent
+// graph's thread pool (see mp_filter_graph_get_thread_pool()), and connected
+// to the parent graph with a mp_async_queue on each side. This lets stages of
+// a filter chain run concurrently, while each individual filter still only
+// ever runs on one thread at a time.
+//
+// The wrapped filter must not access anything but its pins and its own state
+// (and mp_stream_info fields that are thread-safe), as its process() is called
+// from arbitrary worker threads.
+//
+// The returned filter has an input pin (pins[0]) and an output pin (pins[1]).
+// mp_filter_reset() and mp_filter_command() are forwarded to the wrapped filter,
+// with the worker stopped while doing so. MP_FILTER_COMMAND_IS_ACTIVE is
+// answered from a value cached after each run, so it does not block. Errors of
+// the wrapped filter are propagated to the returned filter.
+//
+//  parent: parent filter
+//  threads: maximum worker threads of the pool, if it does not exist yet
+//  create: called once (synchronously) to create the wrapped filter within
+//          the given parent; returns NULL on failure
+//  ctx: passed to create
+// Returns NULL on failure.
+struct mp_filter *mp_async_stage_create(struct mp_filter *parent, int threads,
+    struct mp_filter *(*create)(struct mp_filter *parent, void *ctx),
+    void *ctx);
+
+// Configure the queue on the input (dir==MP_PIN_IN) or output (MP_PIN_OUT)
+// side. By default, both queues hold 1 frame. The output queue is filled
+// without waiting for read requests, so the wrapped filter always runs ahead
+// by the configured amount.
+void mp_async_stage_set_queue_config(struct mp_filter *f, enum mp_pin_dir dir,
+                                     struct mp_async_queue_config cfg);
+
+// Stop the worker and return the wrapped filter, which can then be accessed
+// by the caller until mp_async_stage_unlock() is called. This may block until
+// the worker's current iteration is done.
+struct mp_filter *mp_async_stage_lock(struct mp_filter *f);
+void mp_async_stage_unlock(struct mp_filter *f);
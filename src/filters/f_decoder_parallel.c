@@ -0,0 +1,339 @@
+#include <limits.h>
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "demux/packet.h"
+#include "demux/stheader.h"
+
+#include "f_async_stage.h"
+#include "f_decoder_wrapper.h"
+#include "filter_internal.h"
+
+// The packet stream is split into segments, each starting with a keyframe, and
+// each segment is decoded by one of several decoder instances, which run on
+// worker threads (see f_async_stage.h). A segment is terminated by sending EOF
+// to its instance, which drains it. The output of the instances is read in
+// segment order, so frame order is preserved.
+//
+// Since each segment is decoded from scratch, frames referencing data from a
+// previous segment (open GOPs, leading B-frames) are decoded incorrectly or
+// dropped. This is meant for intra-only/closed-GOP content.
+
+// Don't split segments shorter than this (avoids flushing a decoder after each
+// packet with intra-only codecs).
+#define MIN_SEGMENT_PACKETS 4
+
+// Input queue size of each instance. Must be large enough to hold a whole
+// segment, or input would block on the instance decoding it.
+#define MAX_QUEUED_PACKETS 1000
+#define MAX_QUEUED_PACKET_BYTES (64 * 1024 * 1024)
+
+struct instance {
+    struct priv *p;
+    struct mp_filter *stage;    // async stage driving dec
+    struct mp_decoder *dec;     // only accessible with mp_async_stage_lock()
+    // Copy of priv.codec, as the decoder updates the codec info in it (also
+    // only accessible with mp_async_stage_lock()).
+    struct mp_codec_params *codec;
+    int64_t segment;            // segment being decoded, or -1 if idle
+};
+
+struct priv {
+    const struct mp_decoder_fns *driver;
+    struct mp_codec_params *codec;
+    const char *decoder;
+
+    // Decoded frames buffered by all instances; limited to max_bytes total.
+    mp_atomic_int64 out_bytes;
+
+    struct instance *insts;
+    int num_insts;
+
+    struct instance *in_inst;   // instance receiving packets, or NULL
+    int in_inst_packets;        // packets sent to in_inst for its segment
+    bool in_inst_eof;           // in_inst needs EOF to end its segment
+    struct mp_frame packet;     // packet read, but not sent yet
+    bool eof;                   // EOF was read; send it once all are drained
+    int64_t next_segment;       // segment number for the next new segment
+    int64_t out_segment;        // segment whose frames are output
+    int64_t info_segment;       // segment whose codec info was copied to codec
+
+    int bframes;                // VDCTRL_GET_BFRAMES on creation, or -1
+
+    struct mp_decoder public;
+};
+
+static struct instance *find_instance(struct priv *p, int64_t segment)
+{
+    for (int n = 0; n < p->num_insts; n++) {
+        if (p->insts[n].segment == segment)
+            return &p->insts[n];
+    }
+    return NULL;
+}
+
+static void process_input(struct mp_filter *f)
+{
+    struct priv *p = f->priv;
+
+    if (p->in_inst_eof) {
+        struct mp_pin *pin = p->in_inst->stage->pins[0];
+        if (!mp_pin_in_needs_data(pin))
+            return;
+        mp_pin_in_write(pin, MP_EOF_FRAME);
+        p->in_inst = NULL;
+        p->in_inst_eof = false;
+    }
+
+    // Don't start new segments until the EOF has been output.
+    if (p->eof)
+        return;
+
+    if (!p->packet.type)
+        p->packet = mp_pin_out_read(f->ppins[0]);
+    if (!p->packet.type)
+        return;
+
+    if (p->packet.type == MP_FRAME_EOF) {
+        mp_frame_unref(&p->packet);
+        p->eof = true;
+        p->in_inst_eof = !!p->in_inst;
+        mp_filter_internal_mark_progress(f);
+        return;
+    }
+
+    if (p->packet.type != MP_FRAME_PACKET) {
+        MP_ERR(f, "unexpected frame type\n");
+        mp_frame_unref(&p->packet);
+        mp_filter_internal_mark_failed(f);
+        return;
+    }
+
+    struct demux_packet *pkt = p->packet.data;
+    if (p->in_inst && pkt->keyframe &&
+        p->in_inst_packets >= MIN_SEGMENT_PACKETS)
+    {
+        p->in_inst_eof = true;
+        mp_filter_internal_mark_progress(f);
+        return;
+    }
+
+    if (!p->in_inst) {
+        // If all are busy, wait until process_output() frees one.
+        p->in_inst = find_instance(p, -1);
+        if (!p->in_inst)
+            return;
+        p->in_inst->segment = p->next_segment++;
+        p->in_inst_packets = 0;
+    }
+
+    struct mp_pin *pin = p->in_inst->stage->pins[0];
+    if (!mp_pin_in_needs_data(pin))
+        return;
+    mp_pin_in_write(pin, p->packet);
+    p->packet = MP_NO_FRAME;
+    p->in_inst_packets += 1;
+    mp_filter_internal_mark_progress(f);
+}
+
+static void process_output(struct mp_filter *f)
+{
+    struct priv *p = f->priv;
+
+    if (!mp_pin_in_needs_data(f->ppins[1]))
+        return;
+
+    struct instance *inst = find_instance(p, p->out_segment);
+    if (!inst) {
+        if (p->eof && !p->in_inst && p->out_segment == p->next_segment) {
+            p->eof = false;
+            mp_pin_in_write(f->ppins[1], MP_EOF_FRAME);
+            mp_filter_internal_mark_progress(f);
+        }
+        return;
+    }
+
+    struct mp_frame frame = mp_pin_out_read(inst->stage->pins[1]);
+    if (!frame.type)
+        return;
+
+    if (frame.type == MP_FRAME_EOF) {
+        inst->segment = -1;
+        p->out_segment += 1;
+        mp_filter_internal_mark_progress(f);
+        return;
+    }
+
+    // Publish what the decoder found out about the codec (e.g. the profile).
+    if (p->info_segment != p->out_segment) {
+        mp_async_stage_lock(inst->stage);
+        p->codec->codec = inst->codec->codec;
+        p->codec->codec_desc = inst->codec->codec_desc;
+        p->codec->codec_profile = inst->codec->codec_profile;
+        mp_async_stage_unlock(inst->stage);
+        p->info_segment = p->out_segment;
+    }
+
+    mp_pin_in_write(f->ppins[1], frame);
+}
+
+static void parallel_process(struct mp_filter *f)
+{
+    process_output(f);
+    process_input(f);
+}
+
+static void parallel_reset(struct mp_filter *f)
+{
+    struct priv *p = f->priv;
+
+    // (The instances were reset by the generic code.)
+    for (int n = 0; n < p->num_insts; n++)
+        p->insts[n].segment = -1;
+    mp_frame_unref(&p->packet);
+    p->in_inst = NULL;
+    p->in_inst_packets = 0;
+    p->in_inst_eof = false;
+    p->eof = false;
+    p->next_segment = p->out_segment = 0;
+    p->info_segment = -1;
+}
+
+static void parallel_destroy(struct mp_filter *f)
+{
+    struct priv *p = f->priv;
+
+    mp_frame_unref(&p->packet);
+    mp_filter_free_children(f);
+}
+
+static int control(struct mp_filter *f, enum dec_ctrl cmd, void *arg)
+{
+    struct priv *p = f->priv;
+
+    switch (cmd) {
+    case VDCTRL_GET_HWDEC:
+        *(char **)arg = NULL;
+        return CONTROL_TRUE;
+    case VDCTRL_GET_BFRAMES:
+        if (p->bframes < 0)
+            break;
+        *(int *)arg = p->bframes;
+        return CONTROL_TRUE;
+    case VDCTRL_SET_FRAMEDROP:
+        // Would have to stop all instances for every packet; just decode all.
+        return CONTROL_TRUE;
+    case VDCTRL_CHECK_FORCED_EOF: {
+        bool forced_eof = false;
+        for (int n = 0; n < p->num_insts; n++) {
+            struct instance *inst = &p->insts[n];
+            bool res = false;
+            mp_async_stage_lock(inst->stage);
+            if (inst->dec->control)
+                inst->dec->control(inst->dec->f, cmd, &res);
+            mp_async_stage_unlock(inst->stage);
+            forced_eof |= res;
+        }
+        *(bool *)arg = forced_eof;
+        return CONTROL_TRUE;
+    }
+    case VDCTRL_FORCE_HWDEC_FALLBACK:
+        return CONTROL_FALSE;
+    }
+    // VDCTRL_REINIT: the decoder wrapper recreates this decoder instead.
+    return CONTROL_UNKNOWN;
+}
+
+static const struct mp_filter_info parallel_decoder_filter = {
+    .name = "parallel_decoder",
+    .priv_size = sizeof(struct priv),
+    .process = parallel_process,
+    .reset = parallel_reset,
+    .destroy = parallel_destroy,
+};
+
+static struct mp_filter *create_instance(struct mp_filter *parent, void *ctx)
+{
+    struct instance *inst = ctx;
+    struct priv *p = inst->p;
+
+    inst->dec = p->driver->create(parent, inst->codec, p->decoder);
+    if (!inst->dec)
+        return NULL;
+
+    if (inst->dec->control) {
+        // With hwdec, the hardware is the bottleneck, and running multiple
+        // instances would only waste resources.
+        char *hwdec = NULL;
+        inst->dec->control(inst->dec->f, VDCTRL_GET_HWDEC, &hwdec);
+        if (hwdec) {
+            MP_VERBOSE(parent, "Not using parallel decoding with hwdec.\n");
+            talloc_free(inst->dec->f);
+            inst->dec = NULL;
+            return NULL;
+        }
+        inst->dec->control(inst->dec->f, VDCTRL_GET_BFRAMES, &p->bframes);
+    }
+
+    return inst->dec->f;
+}
+
+struct mp_decoder *mp_parallel_decoder_create(struct mp_filter *parent,
+                                              const struct mp_decoder_fns *driver,
+                                              struct mp_codec_params *codec,
+                                              const char *decoder, int num,
+                                              int64_t max_bytes)
+{
+    struct mp_filter *f = mp_filter_create(parent, &parallel_decoder_filter);
+    if (!f)
+        return NULL;
+
+    struct priv *p = f->priv;
+    p->public.f = f;
+    p->public.control = control;
+    p->driver = driver;
+    p->codec = codec;
+    p->decoder = talloc_strdup(p, decoder);
+    p->bframes = -1;
+    p->info_segment = -1;
+
+    mp_filter_add_pin(f, MP_PIN_IN, "in");
+    mp_filter_add_pin(f, MP_PIN_OUT, "out");
+
+    p->insts = talloc_zero_array(p, struct instance, num);
+    for (int n = 0; n < num; n++) {
+        struct instance *inst = &p->insts[n];
+        inst->p = p;
+        inst->segment = -1;
+        // (Shallow copy; the decoder only writes the codec info fields, which
+        // point to static strings.)
+        inst->codec = talloc_memdup(p, codec, sizeof(*codec));
+        inst->stage = mp_async_stage_create(f, num, create_instance, inst);
+        if (!inst->stage)
+            goto error;
+        p->num_insts += 1;
+
+        mp_async_stage_set_queue_config(inst->stage, MP_PIN_IN,
+            (struct mp_async_queue_config){
+                .max_bytes = MAX_QUEUED_PACKET_BYTES,
+                .max_samples = MAX_QUEUED_PACKETS,
+            });
+        // Lets instances decode ahead while waiting for their turn to output.
+        // The budget is shared, so a single instance can use all of it if
+        // the others are idle.
+        mp_async_stage_set_queue_config(inst->stage, MP_PIN_OUT,
+            (struct mp_async_queue_config){
+                .max_bytes = max_bytes,
+                .max_samples = INT_MAX,
+                .shared_bytes = &p->out_bytes,
+                .max_shared_bytes = max_bytes,
+            });
+    }
+
+    MP_VERBOSE(f, "Decoding with %d parallel instances.\n", num);
+
+    return &p->public;
+error:
+    talloc_free(f);
+    return NULL;
+}
@@ -0,0 +1,230 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+#include <libavutil/imgutils.h>
+
+#include "common/av_common.h"
+#include "common/common.h"
+#include "common/global.h"
+#include "common/msg.h"
+#include "options/m_config.h"
+#include "options/m_option.h"
+
+#include "f_decoder_pool.h"
+
+// Assumed number of frames a video decoder keeps allocated after a flush
+// (reference frames + frame threads), for the size estimate.
+#define EST_VIDEO_FRAMES 16
+#define EST_AUDIO_SIZE (256 * 1024)
+
+struct decoder_pool_opts {
+    int max_entries;
+    int64_t max_bytes;
+};
+
+#define OPT_BASE_STRUCT struct decoder_pool_opts
+const struct m_sub_options decoder_pool_conf = {
+    .opts = (const struct m_option[]){
+        {"decoder-pool-size", OPT_INT(max_entries), M_RANGE(0, 64)},
+        {"decoder-pool-max-bytes", OPT_BYTE_SIZE(max_bytes),
+            M_RANGE(0, M_MAX_MEM_BYTES)},
+        {0}
+    },
+    .size = sizeof(struct decoder_pool_opts),
+    .defaults = &(const struct decoder_pool_opts){
+        .max_bytes = 128 * 1024 * 1024,
+    },
+};
+
+struct pool_entry {
+    bstr key;
+    AVCodecContext *avctx;
+    AVBufferRef *hwdec_dev;
+    size_t size;
+};
+
+struct mp_decoder_pool {
+    struct mp_log *log;
+
+    pthread_mutex_t lock;
+
+    // --- protected by lock
+    struct m_config_cache *opts_cache;
+    struct pool_entry **entries; // oldest first
+    int num_entries;
+    size_t total_size;
+};
+
+static void free_entry(struct pool_entry *e)
+{
+    avcodec_free_context(&e->avctx);
+    av_buffer_unref(&e->hwdec_dev);
+    talloc_free(e);
+}
+
+static void pool_destroy(void *ptr)
+{
+    struct mp_decoder_pool *pool = ptr;
+
+    for (int n = 0; n < pool->num_entries; n++)
+        free_entry(pool->entries[n]);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+void mp_decoder_pool_global_init(struct mpv_global *global)
+{
+    assert(!global->dec_pool);
+    struct mp_decoder_pool *pool = talloc_zero(global, struct mp_decoder_pool);
+    ta_set_destructor(pool, pool_destroy);
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->log = mp_log_new(pool, global->log, "decoder-pool");
+    pool->opts_cache = m_config_cache_alloc(pool, global, &decoder_pool_conf);
+
+    global->dec_pool = pool;
+}
+
+void mp_decoder_pool_global_uninit(struct mpv_global *global)
+{
+    TA_FREEP(&global->dec_pool);
+}
+
+bstr mp_decoder_pool_key(void *ta_parent, const char *decoder,
+                         const struct mp_codec_params *c)
+{
+    bstr key = {0};
+    bstr_xappend_asprintf(ta_parent, &key, "%s;", decoder);
+
+    AVCodecParameters *avp = mp_codec_params_to_av(c);
+    if (!avp)
+        return key;
+    bstr_xappend_asprintf(ta_parent, &key,
+        "%d,%d,%u,%d,%d,%d,%d,%d,%d,%d,%"PRIu64",%d,%"PRId64",%d,%d,%d;",
+        avp->codec_type, avp->codec_id, avp->codec_tag, avp->format,
+        avp->profile, avp->level, avp->width, avp->height, avp->sample_rate,
+        avp->ch_layout.nb_channels,
+        avp->ch_layout.order == AV_CHANNEL_ORDER_NATIVE ?
+            avp->ch_layout.u.mask : 0,
+        avp->block_align, avp->bit_rate, avp->bits_per_coded_sample,
+        avp->bits_per_raw_sample, avp->extradata_size);
+    bstr_xappend(ta_parent, &key,
+                 (bstr){avp->extradata, avp->extradata_size});
+    avcodec_parameters_free(&avp);
+    return key;
+}
+
+// Rough memory use of an idle context.
+static size_t estimate_size(AVCodecContext *avctx)
+{
+    if (avctx->codec_type != AVMEDIA_TYPE_VIDEO)
+        return EST_AUDIO_SIZE;
+    enum AVPixelFormat fmt = avctx->sw_pix_fmt != AV_PIX_FMT_NONE ?
+                             avctx->sw_pix_fmt : avctx->pix_fmt;
+    if (fmt == AV_PIX_FMT_NONE)
+        fmt = AV_PIX_FMT_YUV420P;
+    int w = MPMAX(avctx->coded_width, avctx->width);
+    int h = MPMAX(avctx->coded_height, avctx->height);
+    int frame_size = av_image_get_buffer_size(fmt, w, h, 1);
+    if (frame_size <= 0)
+        frame_size = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, 1920, 1088, 1);
+    return (size_t)frame_size * (EST_VIDEO_FRAMES + MPMAX(avctx->thread_count, 1));
+}
+
+void mp_decoder_pool_put(struct mpv_global *global, bstr key,
+                         struct AVCodecContext **avctx,
+                         struct AVBufferRef **hwdec_dev)
+{
+    struct mp_decoder_pool *pool = global->dec_pool;
+    struct pool_entry *e = talloc_zero(NULL, struct pool_entry);
+    e->avctx = *avctx;
+    e->hwdec_dev = *hwdec_dev;
+    *avctx = NULL;
+    *hwdec_dev = NULL;
+    if (!pool || !e->avctx) {
+        free_entry(e);
+        return;
+    }
+    e->key = bstrdup(e, key);
+    e->size = estimate_size(e->avctx);
+
+    struct pool_entry **evicted = NULL;
+    int num_evicted = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    m_config_cache_update(pool->opts_cache);
+    struct decoder_pool_opts *opts = pool->opts_cache->opts;
+
+    if (opts->max_entries > 0 && e->size <= opts->max_bytes) {
+        MP_TARRAY_APPEND(pool, pool->entries, pool->num_entries, e);
+        pool->total_size += e->size;
+        MP_VERBOSE(pool, "Keeping %s decoder (~%zu KiB, %d entries).\n",
+                   e->avctx->codec->name, e->size / 1024, pool->num_entries);
+        e = NULL;
+    }
+
+    // Evict least recently added entries until the limits are met.
+    while (pool->num_entries > opts->max_entries ||
+           pool->total_size > opts->max_bytes)
+    {
+        struct pool_entry *old = pool->entries[0];
+        MP_TARRAY_REMOVE_AT(pool->entries, pool->num_entries, 0);
+        pool->total_size -= old->size;
+        MP_TARRAY_APPEND(NULL, evicted, num_evicted, old);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    // Freeing may join decoder threads; don't block other users of the pool.
+    if (e)
+        free_entry(e);
+    for (int n = 0; n < num_evicted; n++)
+        free_entry(evicted[n]);
+    talloc_free(evicted);
+}
+
+bool mp_decoder_pool_get(struct mpv_global *global, bstr key,
+                         struct AVCodecContext **avctx,
+                         struct AVBufferRef **hwdec_dev)
+{
+    struct mp_decoder_pool *pool = global->dec_pool;
+    if (!pool)
+        return false;
+
+    struct pool_entry *e = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    for (int n = pool->num_entries - 1; n >= 0; n--) {
+        if (bstr_equals(pool->entries[n]->key, key)) {
+            e = pool->entries[n];
+            MP_TARRAY_REMOVE_AT(pool->entries, pool->num_entries, n);
+            pool->total_size -= e->size;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!e)
+        return false;
+
+    MP_VERBOSE(pool, "Reusing %s decoder.\n", e->avctx->codec->name);
+    *avctx = e->avctx;
+    *hwdec_dev = e->hwdec_dev;
+    talloc_free(e);
+    return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "misc/bstr.h"
+
+struct AVBufferRef;
+struct AVCodecContext;
+struct mp_codec_params;
+struct mpv_global;
+
+// Pool of idle, opened libavcodec decoder contexts. It is shared by all
+// decoders of a player instance (and survives playlist entries). A decoder
+// that is destroyed can park its context in the pool, and a later decoder with
+// the same key can take it over, instead of opening the codec (and for
+// copying hwdecs, creating the hardware device) from scratch. This is disabled
+// by default (--decoder-pool-size=0). All functions are thread-safe.
+//
+// Contexts must not reference anything owned by the decoder or the VO (for
+// example a VO-provided hwdec device), since they outlive both.
+
+void mp_decoder_pool_global_init(struct mpv_global *global);
+
+// Free all pooled contexts. Must be called before libavcodec is torn down.
+void mp_decoder_pool_global_uninit(struct mpv_global *global);
+
+// Return a key identifying the decoder and the codec parameters that are used
+// to initialize the context. Callers append anything else that affects the
+// initialization (options etc.). Allocated with ta_parent.
+bstr mp_decoder_pool_key(void *ta_parent, const char *decoder,
+                         const struct mp_codec_params *c);
+
+// Give an opened context to the pool. It should have been flushed already.
+// *avctx and *hwdec_dev (the device used by the context, may be NULL) are taken
+// over and set to NULL; if the pool is disabled or full, they are freed.
+void mp_decoder_pool_put(struct mpv_global *global, bstr key,
+                         struct AVCodecContext **avctx,
+                         struct AVBufferRef **hwdec_dev);
+
+// Take a context with the given key from the pool. On success, return true and
+// pass ownership of the context and its device (possibly NULL) to the caller.
+bool mp_decoder_pool_get(struct mpv_global *global, bstr key,
+                         struct AVCodecContext **avctx,
+                         struct AVBufferRef **hwdec_dev);
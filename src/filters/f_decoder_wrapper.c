@@ -23,6 +23,7 @@
 #include <assert.h>
 #include <pthread.h>
 
+#include <libavcodec/avcodec.h>
 #include <libavutil/buffer.h>
 #include <libavutil/common.h>
 #include <libavutil/rational.h>
@@ -36,6 +37,7 @@
 #include "demux/demux.h"
 #include "demux/packet.h"
 
+#include "common/av_common.h"
 #include "common/codecs.h"
 #include "common/global.h"
 #include "common/recorder.h"
@@ -105,6 +107,9 @@ struct dec_wrapper_opts {
     struct dec_queue_opts *adec_queue_opts;
     int64_t video_reverse_size;
     int64_t audio_reverse_size;
+    int64_t video_reverse_cache_size;
+    int parallel_segments;
+    int64_t parallel_max_bytes;
 };
 
 static int decoder_list_help(struct mp_log *log, const m_option_t *opt,
@@ -133,6 +138,11 @@ const struct m_sub_options dec_wrapper_conf = {
             M_RANGE(0, M_MAX_MEM_BYTES)},
         {"audio-reversal-buffer", OPT_BYTE_SIZE(audio_reverse_size),
             M_RANGE(0, M_MAX_MEM_BYTES)} ,
+        {"video-reversal-cache", OPT_BYTE_SIZE(video_reverse_cache_size),
+            M_RANGE(0, M_MAX_MEM_BYTES)},
+        {"vd-parallel-segments", OPT_INT(parallel_segments), M_RANGE(0, 16)},
+        {"vd-parallel-max-bytes", OPT_BYTE_SIZE(parallel_max_bytes),
+            M_RANGE(1, M_MAX_MEM_BYTES)},
         {0}
     },
     .size = sizeof(struct dec_wrapper_opts),
@@ -142,9 +152,21 @@ const struct m_sub_options dec_wrapper_conf = {
         .aspect_method = 2,
         .video_reverse_size = 1 * 1024 * 1024 * 1024,
         .audio_reverse_size = 64 * 1024 * 1024,
+        .parallel_max_bytes = 256 * 1024 * 1024,
     },
 };
 
+// Decoded frames of a range (usually a GOP) during backward playback, keyed by
+// the first packet of the range. Frames are in decoder output order.
+struct gop_cache_entry {
+    int64_t pos;
+    double dts;
+    struct mp_frame *frames;
+    int num_frames;
+    size_t size;
+    uint64_t last_use;
+};
+
 struct priv {
     struct mp_log *log;
     struct sh_stream *header;
@@ -163,6 +185,7 @@ struct priv {
 
     struct mp_codec_params *codec;
     struct mp_decoder *decoder;
+    bool parallel_decoder; // decoder is from mp_parallel_decoder_create()
 
     // Demuxer output.
     struct mp_pin *demux;
@@ -199,11 +222,22 @@ struct priv {
     struct demux_packet *new_segment;
     struct mp_frame packet;
     bool packet_fed, preroll_discard;
+    bool skip_to_keyframe;
 
     size_t reverse_queue_byte_size;
     struct mp_frame *reverse_queue;
     int num_reverse_queue;
     bool reverse_queue_complete;
+    bool reverse_queue_overflow; // frames of the current range were discarded
+
+    struct gop_cache_entry **gop_cache;
+    int num_gop_cache;
+    size_t gop_cache_size;
+    uint64_t gop_cache_use;
+    bool gop_recording;     // current range is added to the cache when done
+    int64_t gop_pos;        // first packet of the current range
+    double gop_dts;
+    bool gop_skipping;      // current range comes from the cache
 
     struct mp_frame decoded_coverart;
     int coverart_returned; // 0: no, 1: coverart frame itself, 2: EOF returned
@@ -216,6 +250,7 @@ struct priv {
 
     // --- Specific access depending on threading stuff.
     struct mp_async_queue *queue; // decoded frame output queue
+    int prime_frames; // >0: queue limit while priming (write with thread_lock)
     struct mp_dispatch_queue *dec_dispatch; // non-NULL if decoding thread used
     bool dec_thread_lock; // debugging (esp. for no-thread case)
     pthread_t dec_thread;
@@ -230,6 +265,8 @@ struct priv {
     bool pts_reset;
     int attempt_framedrops; // try dropping this many frames
     int dropped_frames; // total frames _probably_ dropped
+    bool keyframes_only;
+    double decode_time; // VDCTRL_GET_DECODE_TIME, or -1
 };
 
 static int decoder_list_help(struct mp_log *log, const m_option_t *opt,
@@ -307,6 +344,7 @@ static void reset_decoder(struct priv *p)
     mp_frame_unref(&p->packet);
     p->packet_fed = false;
     p->preroll_discard = false;
+    p->skip_to_keyframe = false;
     talloc_free(p->new_segment);
     p->new_segment = NULL;
     p->start = p->end = MP_NOPTS_VALUE;
@@ -336,10 +374,85 @@ static void decf_reset(struct mp_filter *f)
     p->num_reverse_queue = 0;
     p->reverse_queue_byte_size = 0;
     p->reverse_queue_complete = false;
+    p->reverse_queue_overflow = false;
+
+    p->gop_recording = false;
+    p->gop_skipping = false;
 
     reset_decoder(p);
 }
 
+static void gop_cache_remove(struct priv *p, int index)
+{
+    struct gop_cache_entry *e = p->gop_cache[index];
+    for (int n = 0; n < e->num_frames; n++)
+        mp_frame_unref(&e->frames[n]);
+    p->gop_cache_size -= e->size;
+    talloc_free(e);
+    MP_TARRAY_REMOVE_AT(p->gop_cache, p->num_gop_cache, index);
+}
+
+static void gop_cache_clear(struct priv *p)
+{
+    while (p->num_gop_cache)
+        gop_cache_remove(p, p->num_gop_cache - 1);
+}
+
+static struct gop_cache_entry *gop_cache_find(struct priv *p, int64_t pos,
+                                              double dts)
+{
+    for (int n = 0; n < p->num_gop_cache; n++) {
+        struct gop_cache_entry *e = p->gop_cache[n];
+        if (e->pos == pos && e->dts == dts)
+            return e;
+    }
+    return NULL;
+}
+
+// Add the frames of the range just decoded (all in the reverse queue) to the
+// cache, evicting the least recently used ranges to stay within the limit.
+static void gop_cache_add(struct priv *p)
+{
+    size_t limit = p->opts->video_reverse_cache_size;
+    struct gop_cache_entry *e = talloc_zero(NULL, struct gop_cache_entry);
+    e->pos = p->gop_pos;
+    e->dts = p->gop_dts;
+    for (int n = 0; n < p->num_reverse_queue; n++) {
+        struct mp_frame frame = p->reverse_queue[n];
+        if (frame.type != MP_FRAME_VIDEO)
+            continue;
+        // Keeping hw surfaces would starve the decoder's surface pool.
+        struct mp_image *mpi = frame.data;
+        if (mpi->hwctx)
+            goto discard;
+        e->size += mp_frame_approx_size(frame);
+        MP_TARRAY_APPEND(e, e->frames, e->num_frames, mp_frame_ref(frame));
+    }
+    if (!e->num_frames || e->size > limit)
+        goto discard;
+
+    while (p->num_gop_cache && p->gop_cache_size + e->size > limit) {
+        int oldest = 0;
+        for (int n = 1; n < p->num_gop_cache; n++) {
+            if (p->gop_cache[n]->last_use < p->gop_cache[oldest]->last_use)
+                oldest = n;
+        }
+        gop_cache_remove(p, oldest);
+    }
+
+    e->last_use = ++p->gop_cache_use;
+    p->gop_cache_size += e->size;
+    MP_TARRAY_APPEND(p, p->gop_cache, p->num_gop_cache, e);
+    return;
+
+discard:
+    for (int n = 0; n < e->num_frames; n++)
+        mp_frame_unref(&e->frames[n]);
+    talloc_free(e);
+}
+
+static bool reinit_decoder(struct priv *p);
+
 int mp_decoder_wrapper_control(struct mp_decoder_wrapper *d,
                                enum dec_ctrl cmd, void *arg)
 {
@@ -351,8 +464,13 @@ int mp_decoder_wrapper_control(struct mp_decoder_wrapper *d,
         pthread_mutex_unlock(&p->cache_lock);
     } else {
         thread_lock(p);
-        if (p->decoder && p->decoder->control)
+        if (cmd == VDCTRL_REINIT && p->parallel_decoder) {
+            // Recreate all instances; this also checks again whether parallel
+            // decoding can be used with the new hwdec settings.
+            res = reinit_decoder(p) ? CONTROL_TRUE : CONTROL_ERROR;
+        } else if (p->decoder && p->decoder->control) {
             res = p->decoder->control(p->decoder->f, cmd, arg);
+        }
         update_cached_values(p);
         thread_unlock(p);
     }
@@ -371,6 +489,7 @@ static void decf_destroy(struct mp_filter *f)
     }
 
     decf_reset(f);
+    gop_cache_clear(p);
     mp_frame_unref(&p->decoded_coverart);
 }
 
@@ -388,6 +507,25 @@ struct mp_decoder_list *audio_decoder_list(void)
     return list;
 }
 
+static bool codec_intra_only(struct priv *p)
+{
+    const AVCodecDescriptor *desc =
+        avcodec_descriptor_get(mp_codec_to_av_codec_id(p->codec->codec));
+    return desc && (desc->props & AV_CODEC_PROP_INTRA_ONLY);
+}
+
+// Whether no frame references data from before the preceding keyframe, so
+// that mp_parallel_decoder_create() decodes each segment correctly. Keyframes
+// of other codecs may start open GOPs, which can't be told from the packets.
+static bool segments_independent(struct priv *p)
+{
+    pthread_mutex_lock(&p->cache_lock);
+    bool keyframes_only = p->keyframes_only;
+    pthread_mutex_unlock(&p->cache_lock);
+
+    return keyframes_only || codec_intra_only(p);
+}
+
 static bool reinit_decoder(struct priv *p)
 {
     if (p->decoder)
@@ -395,11 +533,16 @@ static bool reinit_decoder(struct priv *p)
     p->decoder = NULL;
 
     reset_decoder(p);
+    gop_cache_clear(p);
     p->has_broken_packet_pts = -10; // needs 10 packets to reach decision
 
     talloc_free(p->decoder_desc);
     p->decoder_desc = NULL;
 
+    pthread_mutex_lock(&p->cache_lock);
+    bool attached_picture = p->attached_picture;
+    pthread_mutex_unlock(&p->cache_lock);
+
     const struct mp_decoder_fns *driver = NULL;
     struct mp_decoder_list *list = NULL;
     char *user_list = NULL;
@@ -456,11 +599,30 @@ static bool reinit_decoder(struct priv *p)
 
     mp_print_decoders(p->log, MSGL_V, "Codec list:", list);
 
+    bool parallel = driver == &vd_lavc && p->opts->parallel_segments > 1 &&
+                    !attached_picture;
+    if (parallel && !segments_independent(p)) {
+        MP_VERBOSE(p, "Not decoding segments in parallel: codec is not "
+                   "intra-only, and frames could reference other segments.\n");
+        parallel = false;
+    }
+
     for (int n = 0; n < list->num_entries; n++) {
         struct mp_decoder_entry *sel = &list->entries[n];
         MP_VERBOSE(p, "Opening decoder %s\n", sel->decoder);
 
-        p->decoder = driver->create(p->decf, p->codec, sel->decoder);
+        p->decoder = NULL;
+        p->parallel_decoder = false;
+        if (parallel) {
+            p->decoder =
+                mp_parallel_decoder_create(p->decf, driver, p->codec,
+                                           sel->decoder,
+                                           p->opts->parallel_segments,
+                                           p->opts->parallel_max_bytes);
+            p->parallel_decoder = !!p->decoder;
+        }
+        if (!p->decoder)
+            p->decoder = driver->create(p->decf, p->codec, sel->decoder);
         if (p->decoder) {
             pthread_mutex_lock(&p->cache_lock);
             p->decoder_desc =
@@ -510,6 +672,40 @@ void mp_decoder_wrapper_set_frame_drops(struct mp_decoder_wrapper *d, int num)
     pthread_mutex_unlock(&p->cache_lock);
 }
 
+void mp_decoder_wrapper_set_keyframes_only(struct mp_decoder_wrapper *d,
+                                           bool enable)
+{
+    struct priv *p = d->f->priv;
+    if (p->header->type != STREAM_VIDEO)
+        return;
+    pthread_mutex_lock(&p->cache_lock);
+    bool changed = p->keyframes_only != enable;
+    p->keyframes_only = enable;
+    pthread_mutex_unlock(&p->cache_lock);
+    if (changed) {
+        MP_VERBOSE(p, "Keyframes-only decoding %s.\n",
+                   enable ? "enabled" : "disabled");
+        demux_set_stream_keyframes_only(p->header, enable);
+
+        // Codecs with inter frames can be decoded in parallel only in this
+        // mode; switch between the parallel and the normal decoder.
+        thread_lock(p);
+        if (p->decoder && p->opts->parallel_segments > 1 &&
+            p->parallel_decoder != enable && !codec_intra_only(p))
+            reinit_decoder(p);
+        thread_unlock(p);
+    }
+}
+
+double mp_decoder_wrapper_get_decode_time(struct mp_decoder_wrapper *d)
+{
+    struct priv *p = d->f->priv;
+    pthread_mutex_lock(&p->cache_lock);
+    double res = p->decode_time;
+    pthread_mutex_unlock(&p->cache_lock);
+    return res;
+}
+
 int mp_decoder_wrapper_get_frames_dropped(struct mp_decoder_wrapper *d)
 {
     struct priv *p = d->f->priv;
@@ -558,6 +754,8 @@ void mp_decoder_wrapper_set_play_dir(struct mp_decoder_wrapper *d, int dir)
     struct priv *p = d->f->priv;
     thread_lock(p);
     p->play_dir = dir;
+    if (dir > 0)
+        gop_cache_clear(p);
     thread_unlock(p);
 }
 
@@ -815,6 +1013,7 @@ static void process_output_frame(struct priv *p, struct mp_frame frame)
 
         mpi->params = p->fixed_format;
         mpi->nominal_fps = p->fps;
+        mpi->decode_time = mp_time_us();
     } else if (frame.type == MP_FRAME_AUDIO) {
         struct mp_aframe *aframe = frame.data;
 
@@ -841,6 +1040,62 @@ static bool is_new_segment(struct priv *p, struct mp_frame frame)
            (p->play_dir < 0 && pkt->back_restart && p->packet_fed);
 }
 
+// Backward playback: output the cached frames instead of decoding a range that
+// was decoded before, or prepare adding the range to the cache. Returns true if
+// p->packet was consumed or must be retried later.
+// The main user is frame-back-step during backward playback: its hr-seek makes
+// the demuxer return the range containing the current frame again, and that
+// range was decoded completely before its first frame was output. Plain
+// backward playback never returns to a range, so the cache is opt-in
+// (--video-reversal-cache, default 0).
+static bool gop_cache_feed(struct priv *p, struct demux_packet *packet)
+{
+    if (p->gop_skipping) {
+        // Skip up to the next range or BOF.
+        if (packet && !packet->back_restart) {
+            mp_frame_unref(&p->packet);
+            mp_filter_internal_mark_progress(p->decf);
+            return true;
+        }
+        p->gop_skipping = false;
+    }
+
+    if (!packet || !packet->back_restart || p->packet_fed ||
+        p->header->type != STREAM_VIDEO || packet->segmented ||
+        !p->opts->video_reverse_cache_size)
+    {
+        p->gop_recording = false;
+        return false;
+    }
+
+    struct gop_cache_entry *e = gop_cache_find(p, packet->pos, packet->dts);
+    if (!e) {
+        p->gop_recording = true;
+        p->gop_pos = packet->pos;
+        p->gop_dts = packet->dts;
+        return false;
+    }
+
+    // Wait until the frames of the previous range were returned.
+    if (p->num_reverse_queue)
+        return true;
+
+    MP_DBG(p, "Using %d cached frames for range at dts=%f.\n",
+           e->num_frames, e->dts);
+    for (int n = 0; n < e->num_frames; n++) {
+        MP_TARRAY_APPEND(p, p->reverse_queue, p->num_reverse_queue,
+                         mp_frame_ref(e->frames[n]));
+    }
+    p->reverse_queue_complete = true;
+    e->last_use = ++p->gop_cache_use;
+
+    p->gop_recording = false;
+    p->gop_skipping = true;
+    mp_frame_unref(&p->packet);
+    mp_filter_internal_mark_progress(p->decf);
+    return true;
+}
+
 static void feed_packet(struct priv *p)
 {
     if (!p->decoder || !mp_pin_in_needs_data(p->decoder->f->pins[0]))
@@ -875,6 +1130,27 @@ static void feed_packet(struct priv *p)
     struct demux_packet *packet =
         p->packet.type == MP_FRAME_PACKET ? p->packet.data : NULL;
 
+    if (p->play_dir < 0 && gop_cache_feed(p, packet))
+        return;
+
+    // Keyframes-only mode. The demuxer drops most packets already, but not
+    // those read before the mode was enabled. After disabling it, skip up to
+    // the next keyframe, as the packets in between reference missing frames.
+    if (packet && p->play_dir > 0 && p->header->type == STREAM_VIDEO) {
+        pthread_mutex_lock(&p->cache_lock);
+        bool keyframes_only = p->keyframes_only;
+        pthread_mutex_unlock(&p->cache_lock);
+
+        if (keyframes_only || p->skip_to_keyframe) {
+            if (!packet->keyframe) {
+                mp_frame_unref(&p->packet);
+                mp_filter_internal_mark_progress(p->decf);
+                return;
+            }
+            p->skip_to_keyframe = keyframes_only;
+        }
+    }
+
     // For video framedropping, including parts of the hr-seek logic.
     if (p->decoder->control) {
         double start_pts = p->start_pts;
@@ -940,6 +1216,7 @@ static void enqueue_backward_frame(struct priv *p, struct mp_frame frame)
         if (p->reverse_queue_byte_size >= queue_size) {
             MP_ERR(p, "Reversal queue overflow, discarding frame.\n");
             mp_frame_unref(&frame);
+            p->reverse_queue_overflow = true;
             return;
         }
 
@@ -985,7 +1262,13 @@ static void read_frame(struct priv *p)
     if (!frame.type)
         return;
 
+    double decode_time = -1;
+    if (frame.type == MP_FRAME_VIDEO && p->decoder->control)
+        p->decoder->control(p->decoder->f, VDCTRL_GET_DECODE_TIME, &decode_time);
+
     pthread_mutex_lock(&p->cache_lock);
+    if (frame.type == MP_FRAME_VIDEO)
+        p->decode_time = decode_time;
     if (p->attached_picture && frame.type == MP_FRAME_VIDEO)
         p->decoded_coverart = frame;
     if (p->attempt_framedrops) {
@@ -1019,6 +1302,13 @@ static void read_frame(struct priv *p)
         frame = MP_NO_FRAME;
     }
 
+    if (segment_ended && p->play_dir < 0) {
+        if (p->gop_recording && !p->reverse_queue_overflow)
+            gop_cache_add(p);
+        p->gop_recording = false;
+        p->reverse_queue_overflow = false;
+    }
+
     // If there's a new segment, start it as soon as we're drained/finished.
     if (segment_ended && p->new_segment) {
         struct demux_packet *new_segment = p->new_segment;
@@ -1065,6 +1355,11 @@ static void update_queue_config(struct priv *p)
         .max_samples = p->queue_opts->max_samples,
         .max_duration = p->queue_opts->max_duration,
     };
+    if (p->prime_frames) {
+        cfg.sample_unit = AQUEUE_UNIT_FRAME;
+        cfg.max_samples = p->prime_frames;
+        cfg.max_duration = 0;
+    }
     mp_async_queue_set_config(p->queue, cfg);
 }
 
@@ -1100,11 +1395,8 @@ static void *dec_thread(void *ptr)
     return NULL;
 }
 
-static void public_f_reset(struct mp_filter *f)
+static void reset_queue(struct priv *p)
 {
-    struct priv *p = f->priv;
-    assert(p->public.f == f);
-
     if (p->queue) {
         mp_async_queue_reset(p->queue);
         thread_lock(p);
@@ -1116,6 +1408,17 @@ static void public_f_reset(struct mp_filter *f)
     }
 }
 
+static void public_f_reset(struct mp_filter *f)
+{
+    struct priv *p = f->priv;
+    assert(p->public.f == f);
+
+    // A primed decoder belongs to a file that is not playing yet, so resets
+    // (seeks) of the graph it was created in don't concern it.
+    if (!p->prime_frames)
+        reset_queue(p);
+}
+
 static void public_f_destroy(struct mp_filter *f)
 {
     struct priv *p = f->priv;
@@ -1166,8 +1469,9 @@ static void onlock_dec_thread(void *ptr)
     mp_filter_graph_interrupt(p->dec_root_filter);
 }
 
-struct mp_decoder_wrapper *mp_decoder_wrapper_create(struct mp_filter *parent,
-                                                     struct sh_stream *src)
+static struct mp_decoder_wrapper *create_wrapper(struct mp_filter *parent,
+                                                 struct sh_stream *src,
+                                                 int prime_frames)
 {
     struct mp_filter *public_f = mp_filter_create(parent, &decode_wrapper_filter);
     if (!public_f)
@@ -1177,6 +1481,7 @@ struct mp_decoder_wrapper *mp_decoder_wrapper_create(struct mp_filter *parent,
     p->public.f = public_f;
 
     pthread_mutex_init(&p->cache_lock, NULL);
+    p->decode_time = -1;
     p->opt_cache = m_config_cache_alloc(p, public_f->global, &dec_wrapper_conf);
     p->opts = p->opt_cache->opts;
     p->header = src;
@@ -1205,7 +1510,8 @@ struct mp_decoder_wrapper *mp_decoder_wrapper_create(struct mp_filter *parent,
         goto error;
     }
 
-    if (p->queue_opts && p->queue_opts->use_queue) {
+    p->prime_frames = prime_frames;
+    if (p->queue_opts && (p->queue_opts->use_queue || p->prime_frames)) {
         p->queue = mp_async_queue_create();
         p->dec_dispatch = mp_dispatch_create(p);
         p->dec_root_filter = mp_filter_create_root(public_f->global);
@@ -1254,7 +1560,7 @@ struct mp_decoder_wrapper *mp_decoder_wrapper_create(struct mp_filter *parent,
         mp_pin_connect(public_f->ppins[0], p->decf->pins[0]);
     }
 
-    public_f_reset(public_f);
+    reset_queue(p);
 
     return &p->public;
 error:
@@ -1262,6 +1568,40 @@ error:
     return NULL;
 }
 
+struct mp_decoder_wrapper *mp_decoder_wrapper_create(struct mp_filter *parent,
+                                                     struct sh_stream *src)
+{
+    return create_wrapper(parent, src, 0);
+}
+
+struct mp_decoder_wrapper *mp_decoder_wrapper_create_primed(
+    struct mp_filter *parent, struct sh_stream *src, int frames)
+{
+    assert(frames > 0);
+    return create_wrapper(parent, src, frames);
+}
+
+void mp_decoder_wrapper_prime(struct mp_decoder_wrapper *d)
+{
+    struct priv *p = d->f->priv;
+
+    if (p->prime_frames)
+        mp_async_queue_resume_reading(p->queue);
+}
+
+void mp_decoder_wrapper_end_priming(struct mp_decoder_wrapper *d)
+{
+    struct priv *p = d->f->priv;
+
+    if (!p->prime_frames)
+        return;
+
+    thread_lock(p);
+    p->prime_frames = 0;
+    update_queue_config(p);
+    thread_unlock(p);
+}
+
 void lavc_process(struct mp_filter *f, struct lavc_state *state,
                   int (*send)(struct mp_filter *f, struct demux_packet *pkt),
                   int (*receive)(struct mp_filter *f, struct mp_frame *res))
@@ -42,6 +42,21 @@ struct mp_decoder_wrapper {
 struct mp_decoder_wrapper *mp_decoder_wrapper_create(struct mp_filter *parent,
                                                      struct sh_stream *src);
 
+// Like mp_decoder_wrapper_create(), but always decode on a separate thread
+// (as with --vd-queue-enable), and let the queue hold at most the given number
+// of frames. After mp_decoder_wrapper_reinit(), call mp_decoder_wrapper_prime()
+// to decode these frames without anyone reading the output yet.
+struct mp_decoder_wrapper *mp_decoder_wrapper_create_primed(
+    struct mp_filter *parent, struct sh_stream *src, int frames);
+
+// Start filling the queue of a primed decoder. Until priming is ended, the
+// decoder ignores filter resets, since it is not part of the current playback.
+void mp_decoder_wrapper_prime(struct mp_decoder_wrapper *d);
+
+// Switch a primed decoder to normal operation. Queued frames are kept, and
+// are the first frames read from it.
+void mp_decoder_wrapper_end_priming(struct mp_decoder_wrapper *d);
+
 // For informational purposes.
 void mp_decoder_wrapper_get_desc(struct mp_decoder_wrapper *d,
                                  char *buf, size_t buf_size);
@@ -50,6 +65,14 @@ void mp_decoder_wrapper_get_desc(struct mp_decoder_wrapper *d,
 void mp_decoder_wrapper_set_frame_drops(struct mp_decoder_wrapper *d, int num);
 int mp_decoder_wrapper_get_frames_dropped(struct mp_decoder_wrapper *d);
 
+// Average decoding time per frame in seconds, or -1 if unknown.
+double mp_decoder_wrapper_get_decode_time(struct mp_decoder_wrapper *d);
+
+// Decode only keyframes (video only, forward playback), and make the demuxer
+// skip all other packets. Meant for scrubbing and very fast playback.
+void mp_decoder_wrapper_set_keyframes_only(struct mp_decoder_wrapper *d,
+                                           bool enable);
+
 double mp_decoder_wrapper_get_container_fps(struct mp_decoder_wrapper *d);
 
 // Whether to prefer spdif wrapper over real decoders on next reinit.
@@ -78,6 +101,8 @@ enum dec_ctrl {
     // framedrop mode: 0=none, 1=standard, 2=hrseek
     VDCTRL_SET_FRAMEDROP,
     VDCTRL_CHECK_FORCED_EOF,
+    // average time (double, seconds) the decoder spends per decoded frame
+    VDCTRL_GET_DECODE_TIME,
 };
 
 int mp_decoder_wrapper_control(struct mp_decoder_wrapper *d,
@@ -121,6 +146,15 @@ void lavc_process(struct mp_filter *f, struct lavc_state *state,
                   int (*send)(struct mp_filter *f, struct demux_packet *pkt),
                   int (*receive)(struct mp_filter *f, struct mp_frame *res));
 
+// f_decoder_parallel.c: decode segments starting with keyframes concurrently
+// with num instances of the given decoder, buffering at most max_bytes of
+// decoded frames. Fails if the decoder uses hwdec.
+struct mp_decoder *mp_parallel_decoder_create(struct mp_filter *parent,
+                                              const struct mp_decoder_fns *driver,
+                                              struct mp_codec_params *codec,
+                                              const char *decoder, int num,
+                                              int64_t max_bytes);
+
 // vd_omap_dce.c
 struct mp_decoder_list *select_omap_dce_codec(const char *codec, const char *pref);
 
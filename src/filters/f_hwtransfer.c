@@ -2,6 +2,8 @@
 #include <libavutil/hwcontext.h>
 #include <libavutil/mem.h>
 
+#include "options/m_config.h"
+#include "options/options.h"
 #include "video/fmt-conversion.h"
 #include "video/hwdec.h"
 #include "video/mp_image.h"
@@ -433,7 +435,9 @@ static void hwdownload_process(struct mp_filter *f)
     if (!src->hwctx)
         goto passthrough;
 
-    struct mp_image *dst = mp_image_hw_download(src, d->pool);
+    struct mp_image *dst = d->map ? mp_image_hw_map_dmabuf(src) : NULL;
+    if (!dst)
+        dst = mp_image_hw_download(src, d->pool);
     if (!dst) {
         MP_ERR(f, "Could not copy hardware frame to CPU memory.\n");
         goto passthrough;
@@ -464,6 +468,11 @@ struct mp_hwdownload *mp_hwdownload_create(struct mp_filter *parent)
 
     d->f = f;
     d->pool = mp_image_pool_new(d);
+    mp_image_pool_enable_stats(d->pool, f->global, "image-pool/hwdownload");
+
+    struct filter_opts *opts = mp_get_config_group(NULL, f->global, &filter_conf);
+    d->map = opts->hwdownload_map;
+    talloc_free(opts);
 
     mp_filter_add_pin(f, MP_PIN_IN, "in");
     mp_filter_add_pin(f, MP_PIN_OUT, "out");
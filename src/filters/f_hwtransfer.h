@@ -20,6 +20,9 @@ struct mp_hwdownload {
     struct mp_filter *f;
 
     struct mp_image_pool *pool;
+
+    // Try mp_image_hw_map_dmabuf() before copying (--hwdownload-map).
+    bool map;
 };
 
 struct mp_hwdownload *mp_hwdownload_create(struct mp_filter *parent);
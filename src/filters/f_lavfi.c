@@ -1128,6 +1128,7 @@ const struct mp_user_filter_entry af_lavfi = {
         .print_help = print_help_a,
     },
     .create = lavfi_create,
+    .async_safe = true,
 };
 
 const struct mp_user_filter_entry af_lavfi_bridge = {
@@ -1151,6 +1152,7 @@ const struct mp_user_filter_entry af_lavfi_bridge = {
         .print_help = print_help_a,
     },
     .create = lavfi_create,
+    .async_safe = true,
 };
 
 const struct mp_user_filter_entry vf_lavfi = {
@@ -1172,6 +1174,7 @@ const struct mp_user_filter_entry vf_lavfi = {
         .print_help = print_help_v,
     },
     .create = lavfi_create,
+    .async_safe = true,
 };
 
 const struct mp_user_filter_entry vf_lavfi_bridge = {
@@ -1196,4 +1199,5 @@ const struct mp_user_filter_entry vf_lavfi_bridge = {
         .print_help = print_help_v,
     },
     .create = lavfi_create,
+    .async_safe = true,
 };
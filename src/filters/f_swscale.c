@@ -148,6 +148,7 @@ struct mp_sws_filter *mp_sws_filter_create(struct mp_filter *parent)
     s->sws->log = f->log;
     mp_sws_enable_cmdline_opts(s->sws, f->global);
     s->pool = mp_image_pool_new(s);
+    mp_image_pool_enable_stats(s->pool, f->global, "image-pool/swscale");
 
     return s;
 }
@@ -6,6 +6,10 @@
 #include "common/common.h"
 #include "common/global.h"
 #include "common/msg.h"
+#include "common/stats.h"
+#include "misc/thread_pool.h"
+#include "options/m_config.h"
+#include "options/options.h"
 #include "osdep/atomic.h"
 #include "osdep/timer.h"
 #include "video/hwdec.h"
@@ -71,6 +75,9 @@ struct filter_runner {
 
     struct mp_filter *root_filter;
 
+    // Allocate mp_filter_internal.prof for each filter (--filter-profile).
+    bool profile;
+
     double max_run_time;
     atomic_bool interrupt_flag;
 
@@ -88,6 +95,10 @@ struct filter_runner {
     // Any outside pins have changed state.
     bool external_pending;
 
+    // Workers for filters running asynchronously (see f_async_stage.h).
+    // Created on first use.
+    struct mp_thread_pool *thread_pool;
+
     // For async notifications only. We don't bother making this fine grained
     // across filters.
     pthread_mutex_t async_lock;
@@ -101,6 +112,24 @@ struct filter_runner {
     int num_async_pending;
 };
 
+// Per-filter counters for --filter-profile. Only accessed by the thread running
+// the filter graph; published to stats.c as "filter/<name>.<id>/...".
+struct filter_prof {
+    struct stats_ctx *stats;
+    int64_t calls;          // process() calls
+    int64_t time_us;        // total time spent in process()
+    int64_t frames_in;      // non-signaling frames read from pins
+    int64_t frames_out;     // non-signaling frames written to pins
+    int queue_frames;       // see mp_filter_internal_report_queue(), or -1
+    int64_t queue_bytes;
+    int64_t last_publish;
+};
+
+// Limit how often the stats are updated, as that takes a global lock.
+#define PROF_PUBLISH_INTERVAL_US (100 * 1000)
+
+static atomic_int filter_prof_ids;
+
 struct mp_filter_internal {
     const struct mp_filter_info *info;
 
@@ -118,8 +147,29 @@ struct mp_filter_internal {
     bool pending;
     bool async_pending;
     bool failed;
+
+    struct filter_prof *prof; // NULL if profiling is disabled
 };
 
+static void prof_publish(struct mp_filter *f, bool force)
+{
+    struct filter_prof *prof = f->in->prof;
+    int64_t now = mp_time_us();
+
+    if (!force && now - prof->last_publish < PROF_PUBLISH_INTERVAL_US)
+        return;
+    prof->last_publish = now;
+
+    stats_value(prof->stats, "calls", prof->calls);
+    stats_value(prof->stats, "time-ms", prof->time_us / 1e3);
+    stats_value(prof->stats, "frames-in", prof->frames_in);
+    stats_value(prof->stats, "frames-out", prof->frames_out);
+    if (prof->queue_frames >= 0) {
+        stats_value(prof->stats, "queue-frames", prof->queue_frames);
+        stats_size_value(prof->stats, "queue-bytes", prof->queue_bytes);
+    }
+}
+
 // Called when new work needs to be done on a pin belonging to the filter:
 //  - new data was requested
 //  - new data has been queued
@@ -258,9 +308,19 @@ bool mp_filter_graph_run(struct mp_filter *filter)
             break;
 
         next->in->pending = false;
-        if (next->in->info->process)
+        if (next->in->info->process) {
+            struct filter_prof *prof = next->in->prof;
+            int64_t start = prof ? mp_time_us() : 0;
+
             next->in->info->process(next);
 
+            if (prof) {
+                prof->calls += 1;
+                prof->time_us += mp_time_us() - start;
+                prof_publish(next, false);
+            }
+        }
+
         if (end_time && mp_time_us() >= end_time)
             mp_filter_graph_interrupt(r->root_filter);
     }
@@ -301,6 +361,8 @@ bool mp_pin_in_write(struct mp_pin *p, struct mp_frame frame)
         return false;
     }
     assert(p->conn->data.type == MP_FRAME_NONE);
+    if (p->manual_connection->in->prof && !mp_frame_is_signaling(frame))
+        p->manual_connection->in->prof->frames_out += 1;
     p->conn->data = frame;
     p->conn->data_requested = false;
     add_pending_pin(p->conn);
@@ -341,6 +403,8 @@ struct mp_frame mp_pin_out_read(struct mp_pin *p)
         return MP_NO_FRAME;
     struct mp_frame res = p->data;
     p->data = MP_NO_FRAME;
+    if (p->manual_connection->in->prof && !mp_frame_is_signaling(res))
+        p->manual_connection->in->prof->frames_in += 1;
     return res;
 }
 
@@ -561,6 +625,16 @@ void mp_filter_set_error_handler(struct mp_filter *f, struct mp_filter *handler)
     f->in->error_handler = handler;
 }
 
+void mp_filter_internal_report_queue(struct mp_filter *f, int frames,
+                                     int64_t bytes)
+{
+    struct filter_prof *prof = f->in->prof;
+    if (prof) {
+        prof->queue_frames = frames;
+        prof->queue_bytes = bytes;
+    }
+}
+
 void mp_filter_internal_mark_failed(struct mp_filter *f)
 {
     while (f) {
@@ -741,6 +815,19 @@ void mp_filter_graph_interrupt(struct mp_filter *f)
     atomic_store(&r->interrupt_flag, true);
 }
 
+struct mp_thread_pool *mp_filter_graph_get_thread_pool(struct mp_filter *f,
+                                                       int max_threads)
+{
+    struct filter_runner *r = f->in->runner;
+    if (!r->thread_pool) {
+        r->thread_pool =
+            mp_thread_pool_create(r, 1, 1, MPMAX(max_threads, 1));
+    } else {
+        mp_thread_pool_grow(r->thread_pool, max_threads);
+    }
+    return r->thread_pool;
+}
+
 void mp_filter_free_children(struct mp_filter *f)
 {
     while(f->in->num_children)
@@ -752,6 +839,9 @@ static void filter_destructor(void *p)
     struct mp_filter *f = p;
     struct filter_runner *r = f->in->runner;
 
+    if (f->in->prof)
+        prof_publish(f, true);
+
     if (f->in->info->destroy)
         f->in->info->destroy(f);
 
@@ -784,6 +874,8 @@ static void filter_destructor(void *p)
 
     if (r->root_filter == f) {
         assert(!f->in->parent);
+        // (All filters are gone, so no more work can be queued.)
+        talloc_free(r->thread_pool);
         pthread_mutex_destroy(&r->async_lock);
         talloc_free(r->async_pending);
         talloc_free(r);
@@ -817,6 +909,11 @@ struct mp_filter *mp_filter_create_with_params(struct mp_filter_params *params)
             .max_run_time = INFINITY,
         };
         pthread_mutex_init(&f->in->runner->async_lock, NULL);
+
+        struct filter_opts *opts =
+            mp_get_config_group(NULL, params->global, &filter_conf);
+        f->in->runner->profile = opts->profile;
+        talloc_free(opts);
     }
 
     if (!f->global)
@@ -830,6 +927,15 @@ struct mp_filter *mp_filter_create_with_params(struct mp_filter_params *params)
         f->log = mp_log_new(f, f->global->log, "!root");
     }
 
+    if (f->in->runner->profile) {
+        struct filter_prof *prof = talloc_zero(f, struct filter_prof);
+        prof->queue_frames = -1;
+        prof->stats = stats_ctx_create(prof, f->global,
+            mp_tprintf(80, "filter/%s.%d", params->info->name,
+                       atomic_fetch_add(&filter_prof_ids, 1)));
+        f->in->prof = prof;
+    }
+
     if (f->in->info->init) {
         if (!f->in->info->init(f, params)) {
             talloc_free(f);
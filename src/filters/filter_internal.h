@@ -21,6 +21,12 @@ void mp_filter_mark_async_progress(struct mp_filter *f);
 // In practice, this means process() is repeated.
 void mp_filter_internal_mark_progress(struct mp_filter *f);
 
+// Report the number of frames and bytes currently buffered by the filter, for
+// filters which implement a queue. Used for --filter-profile only.
+// Must be called from f's process function.
+void mp_filter_internal_report_queue(struct mp_filter *f, int frames,
+                                     int64_t bytes);
+
 // Flag the filter as having failed, and propagate the error to the parent
 // filter. The error propagation stops either at the root filter, or if a filter
 // has an error handler set.
@@ -98,6 +104,14 @@ struct mp_filter_info {
     bool (*command)(struct mp_filter *f, struct mp_filter_command *cmd);
 };
 
+// Return the worker thread pool shared by all filters driven by f's filter
+// graph. It is created on first use, and can use up to the largest max_threads
+// passed by any call (so users with different needs can share it). The pool is destroyed together
+// with the root filter, after all other filters have been freed.
+// Must be called from the thread driving the filter graph.
+struct mp_thread_pool *mp_filter_graph_get_thread_pool(struct mp_filter *f,
+                                                       int max_threads);
+
 // Return the mp_filter_info this filter was created with.
 const struct mp_filter_info *mp_filter_get_info(struct mp_filter *f);
 
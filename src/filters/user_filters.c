@@ -5,7 +5,9 @@
 #include "common/common.h"
 #include "common/msg.h"
 #include "options/m_config_frontend.h"
+#include "options/options.h"
 
+#include "f_async_stage.h"
 #include "f_lavfi.h"
 #include "user_filters.h"
 
@@ -110,6 +112,29 @@ const struct m_obj_list vf_obj_list = {
     .print_unknown_entry_help = print_vf_lavfi_help,
 };
 
+struct create_args {
+    const struct mp_user_filter_entry *entry; // NULL: generic lavfi bridge
+    enum mp_frame_type frame_type;
+    const char *name;
+    char **args;
+    void *options;
+};
+
+static struct mp_filter *create_filter(struct mp_filter *parent, void *ctx)
+{
+    struct create_args *c = ctx;
+
+    if (!c->entry) {
+        struct mp_lavfi *l = mp_lavfi_create_filter(parent, c->frame_type, true,
+                                                    NULL, NULL, c->name, c->args);
+        return l ? l->f : NULL;
+    }
+
+    void *options = c->options;
+    c->options = NULL;
+    return c->entry->create(parent, options);
+}
+
 // Create a bidir, single-media filter from command line arguments.
 struct mp_filter *mp_create_user_filter(struct mp_filter *parent,
                                         enum mp_output_chain_type type,
@@ -130,20 +155,20 @@ struct mp_filter *mp_create_user_filter(struct mp_filter *parent,
     assert(frame_type && obj_list);
 
     struct mp_filter *f = NULL;
+    struct create_args c = {
+        .frame_type = frame_type,
+        .name = name,
+        .args = args,
+    };
 
     struct m_obj_desc desc;
     if (!m_obj_list_find(&desc, obj_list, bstr0(name))) {
         // Generic lavfi bridge.
         if (strncmp(name, "lavfi-", 6) == 0)
-            name += 6;
-        struct mp_lavfi *l =
-            mp_lavfi_create_filter(parent, frame_type, true, NULL, NULL, name, args);
-        if (l)
-            f = l->f;
-        goto done;
+            c.name += 6;
+        goto create;
     }
 
-    void *options = NULL;
     if (desc.options) {
         struct m_obj_settings *defs = NULL;
         if (defs_name) {
@@ -161,14 +186,26 @@ struct mp_filter *mp_create_user_filter(struct mp_filter *parent,
         if (!config)
             goto done;
 
-        options = config->optstruct;
+        c.options = config->optstruct;
         // Free config when options is freed.
-        ta_set_parent(options, NULL);
-        ta_set_parent(config, options);
+        ta_set_parent(c.options, NULL);
+        ta_set_parent(config, c.options);
     }
 
-    const struct mp_user_filter_entry *entry = desc.p;
-    f = entry->create(parent, options);
+    c.entry = desc.p;
+
+create: ;
+    struct filter_opts *opts = mp_get_config_group(NULL, parent->global,
+                                                   &filter_conf);
+    int threads = opts->filter_threads;
+    talloc_free(opts);
+
+    if (threads > 0 && (!c.entry || c.entry->async_safe)) {
+        f = mp_async_stage_create(parent, threads, create_filter, &c);
+    } else {
+        f = create_filter(parent, &c);
+    }
+    talloc_free(c.options); // if create_filter() was never called
 
 done:
     if (!f) {
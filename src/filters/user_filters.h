@@ -12,6 +12,9 @@ struct mp_user_filter_entry {
     // struct to be allocated; then options are parsed into it. The callee
     // must always free options (but can reparent it with talloc to keep it).
     struct mp_filter *(*create)(struct mp_filter *parent, void *options);
+    // The filter only touches its pins and its own state, so it can be run on
+    // a worker thread with mp_async_stage_create() (if --filter-threads is set).
+    bool async_safe;
 };
 
 struct mp_filter *mp_create_user_filter(struct mp_filter *parent,
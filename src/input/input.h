@@ -230,14 +230,49 @@ struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
 bool mp_ipc_start_anon_client(struct mp_ipc_ctx *ctx, struct mpv_handle *h,
                               int out_fd[2]);
 void mp_uninit_ipc(struct mp_ipc_ctx *ctx);
+// Apply --input-ipc-property-rate to all clients started by ctx.
+void mp_ipc_set_property_rate(struct mp_ipc_ctx *ctx, double rate);
 
-// Serialize the given mpv_event structure to JSON. Returns an allocated string.
+// Serialize the given mpv_event structure to JSON. Returns an allocated string,
+// or NULL on failure.
 struct mpv_event;
 char *mp_json_encode_event(struct mpv_event *event);
 
+// Like mp_json_encode_event(), but append to dst (see json_write_bstr()).
+// Returns <0 on failure (dst may contain partial output).
+int mp_json_append_event(bstr *dst, struct mpv_event *event);
+
 // Given the raw IPC input buffer "buf", remove the first newline-separated
 // command, execute it and return the result (if any) as an allocated string.
+// buf is advanced past the command; the memory it points to is not touched, so
+// the caller can compact it once after consuming several commands.
 struct mpv_handle;
 char *mp_ipc_consume_next_command(struct mpv_handle *client, void *ctx, bstr *buf);
 
+// Binary IPC protocol. A client opts in by sending the 8 bytes "\0MPVBIN1" as
+// the very first data on the connection. The server echoes them, and from then
+// on both sides exchange frames instead of lines: a 32 bit little endian
+// payload size, followed by a single mpv_node encoded as described in
+// misc/node_wire.c. Requests, replies and events have the same structure as
+// with the JSON protocol. Events sent before the handshake was received are
+// still JSON (which never contains a 0 byte).
+
+// Check whether the raw IPC input buffer "buf" starts with the handshake.
+// Returns 1 if so (and removes it from buf), 0 if more data is needed to
+// decide, and -1 if not (the connection uses the JSON protocol).
+int mp_ipc_check_binary_handshake(bstr *buf);
+
+// Append the handshake reply to dst.
+void mp_ipc_append_binary_handshake(bstr *dst);
+
+// If "buf" contains a complete frame, remove it, execute it and append the
+// reply frame (if any) to out (can be NULL). Like with
+// mp_ipc_consume_next_command(), buf is only advanced past the frame. Returns
+// 1 if a frame was consumed, 0 if more data is needed, and -1 on an invalid
+// frame size (the connection should be closed).
+int mp_ipc_consume_next_frame(struct mpv_handle *client, bstr *buf, bstr *out);
+
+// Like mp_json_append_event(), but append the event as binary frame.
+int mp_ipc_append_event_binary(bstr *dst, struct mpv_event *event);
+
 #endif /* MPLAYER_INPUT_H */
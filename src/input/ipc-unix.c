@@ -17,16 +17,20 @@
 
 #include <pthread.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <limits.h>
-#include <poll.h>
+#include <math.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
 
 #include "osdep/io.h"
+#include "osdep/timer.h"
 #include "osdep/threads.h"
 
 #include "common/common.h"
@@ -34,27 +38,53 @@
 #include "common/msg.h"
 #include "input/input.h"
 #include "libmpv/client.h"
+#include "misc/thread_pool.h"
 #include "options/m_config.h"
 #include "options/options.h"
 #include "options/path.h"
 #include "player/client.h"
 
-#ifndef MSG_NOSIGNAL
-#define MSG_NOSIGNAL 0
-#endif
-
-struct mp_ipc_ctx {
-    struct mp_log *log;
-    struct mp_client_api *client_api;
-    const char *path;
-
-    pthread_t thread;
-    int death_pipe[2];
+// All clients of a listening socket are served by a single thread running an
+// epoll loop (struct ipc_loop). Clients not connected through the socket
+// (mp_ipc_start_anon_client() without a listener, --input-ipc-client) get a
+// loop of their own. Commands are run on a thread pool owned by the loop, so a
+// slow command only delays its own client.
+
+#define READ_BUF_SIZE (64 * 1024)
+#define MAX_EPOLL_EVENTS 64
+
+// Initial size of the per-client output buffer. If it grew larger than
+// OUT_BUF_KEEP_SIZE, it's shrunk back once all output was written.
+#define OUT_BUF_SIZE (16 * 1024)
+#define OUT_BUF_KEEP_SIZE (256 * 1024)
+
+// If this much output is pending for a client, don't process further events
+// or commands for it until some of it was written. This is the equivalent of
+// blocking on write() with a thread per client, and lets the client's event
+// queue handle overflows as usual.
+#define MAX_PENDING_OUTPUT (4 * 1024 * 1024)
+
+// Stop reading from a client if this much received data is waiting for its
+// commands to be run (unless it's an incomplete command).
+#define MAX_PENDING_INPUT (4 * 1024 * 1024)
+
+// Maximum number of clients whose commands run concurrently.
+#define MAX_COMMAND_THREADS 16
+
+struct ipc_loop;
+
+// Rate limiting state of an observed property (see --input-ipc-property-rate).
+struct prop_limit {
+    uint64_t id;                // reply_userdata of the observation
+    char *name;
+    double last_sent;           // mp_time_sec() of the last sent change
+    bstr held;                  // encoded change held back, if len > 0
 };
 
 struct client_arg {
     struct mp_log *log;
     struct mpv_handle *client;
+    struct ipc_loop *loop;
 
     const char *client_name;
     int client_fd;
@@ -62,178 +92,760 @@ struct client_arg {
     bool quit_on_close;
 
     bool writable;
+    bool binary;                // binary protocol (see input.h)
+    bool proto_known;           // binary was decided
+
+    atomic_bool wakeup; // set by the mpv_handle wakeup callback
+
+    pthread_mutex_t cmd_lock;
+
+    // --- Protected by cmd_lock. (Not allocated as children of arg, because
+    //     run_commands() reallocates them on another thread.)
+    bstr cmd_in;                // received data not yet passed to run_commands()
+    bstr cmd_out;               // replies not yet moved to out
+    bool cmd_busy;              // run_commands() is queued or running
+    bool cmd_need_input;        // cmd_in contains no complete command
+    bool cmd_error;             // invalid frame received
+    bool cmd_stop;              // client is going away; don't run commands
+
+    // --- Accessed by the loop thread only.
+    bstr client_msg;            // received data before the protocol is known
+    bstr out;                   // output buffer; reused for all writes
+    size_t out_pos;             // bytes of out already written
+    struct prop_limit **limits;
+    int num_limits;
+    uint32_t epoll_events;      // events currently registered
+    bool watched;               // client_fd is registered with epoll
+    bool input_full;            // too much input pending; stop reading
+    bool eof;                   // client closed its end; no more input
+    bool dead;
+};
+
+struct ipc_loop {
+    struct mp_log *log;
+    struct mp_client_api *client_api;
+
+    int epoll_fd;
+    int wakeup_pipe[2];
+    struct mp_thread_pool *cmd_pool;
+
+    // --- Accessed by the loop thread only.
+    // Minimum time between 2 changes of an observed property sent to a
+    // client, or 0. Copied from new_prop_interval.
+    double prop_interval;
+    int client_num;
+    struct client_arg **clients;
+    int num_clients;
+
+    pthread_mutex_t lock;
+
+    // --- Protected by lock. (listen_fd is closed by mp_uninit_ipc(), which
+    //     can run on a command thread while the core is locked, so it must
+    //     not wait for the loop thread.)
+    int listen_fd;              // -1 if not (or no longer) listening
+    struct client_arg **new_clients;
+    int num_new_clients;
+    bool owner_gone;            // may exit once all clients are gone
+    double new_prop_interval;   // set by mp_ipc_set_property_rate()
+    int refs;                   // loop thread + mp_ipc_ctx; last frees it
+};
+
+struct mp_ipc_ctx {
+    struct mp_log *log;
+    struct ipc_loop *loop;      // listening loop, or NULL
+
+    // Guards loops; anonymous clients are started from script threads.
+    pthread_mutex_t lock;
+    // All loops started by this context (referenced), so that option changes
+    // reach them. The loop threads are detached and may outlive the context,
+    // but never touch the core (options, mpv_global) on their own; they only
+    // access it through their clients' mpv_handles.
+    struct ipc_loop **loops;
+    int num_loops;
+    double prop_interval;
 };
 
-static int ipc_write_str(struct client_arg *client, const char *buf)
+static void wakeup_loop(struct ipc_loop *loop)
+{
+    (void)write(loop->wakeup_pipe[1], &(char){0}, 1);
+}
+
+static double rate_to_interval(double rate)
 {
-    size_t count = strlen(buf);
-    while (count > 0) {
-        ssize_t rc = send(client->client_fd, buf, count, MSG_NOSIGNAL);
-        if (rc <= 0) {
-            if (rc == 0)
-                return -1;
+    return rate > 0 ? 1.0 / rate : 0;
+}
 
-            if (errno == EBADF || errno == ENOTSOCK) {
-                client->writable = false;
-                return 0;
-            }
+// mpv_handle wakeup callback; called from any thread.
+static void wakeup_client(void *p)
+{
+    struct client_arg *arg = p;
 
-            if (errno == EINTR || errno == EAGAIN)
-                continue;
+    if (!atomic_exchange(&arg->wakeup, true))
+        wakeup_loop(arg->loop);
+}
 
-            return rc;
+static size_t pending_output(struct client_arg *arg)
+{
+    return arg->out.len - arg->out_pos;
+}
+
+// Takes over msg (talloc-allocated).
+static void queue_output(struct client_arg *arg, char *msg)
+{
+    if (msg && arg->writable)
+        bstr_xappend(arg, &arg->out, bstr0(msg));
+    talloc_free(msg);
+}
+
+// Write as much pending output as possible without blocking.
+static void flush_output(struct client_arg *arg)
+{
+    while (pending_output(arg)) {
+        ssize_t rc = write(arg->client_fd, arg->out.start + arg->out_pos,
+                           pending_output(arg));
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            // After EOF, keep running the remaining commands even if the
+            // client can't receive the replies anymore.
+            if (errno == EBADF || errno == ENOTSOCK || arg->eof) {
+                arg->writable = false;
+                arg->out_pos = arg->out.len;
+                break;
+            }
+            MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
+            arg->dead = true;
+            return;
         }
+        arg->out_pos += rc;
+    }
 
-        count -= rc;
-        buf   += rc;
+    if (!pending_output(arg)) {
+        arg->out.len = arg->out_pos = 0;
+        if (talloc_get_size(arg->out.start) > OUT_BUF_KEEP_SIZE)
+            arg->out.start = talloc_realloc_size(arg, arg->out.start, OUT_BUF_SIZE);
+    } else if (arg->out_pos >= arg->out.len / 2) {
+        // Don't let the buffer grow forever with a slow reader.
+        memmove(arg->out.start, arg->out.start + arg->out_pos,
+                pending_output(arg));
+        arg->out.len -= arg->out_pos;
+        arg->out_pos = 0;
     }
+}
 
-    return 0;
+static int append_event(struct client_arg *arg, bstr *dst,
+                        struct mpv_event *event)
+{
+    if (arg->binary)
+        return mp_ipc_append_event_binary(dst, event);
+    return mp_json_append_event(dst, event);
 }
 
-static void *client_thread(void *p)
+static struct prop_limit *find_limit(struct client_arg *arg,
+                                     struct mpv_event *event)
 {
-    pthread_detach(pthread_self());
+    struct mpv_event_property *prop = event->data;
 
-    // We don't use MSG_NOSIGNAL because the moldy fruit OS doesn't support it.
-    struct sigaction sa = { .sa_handler = SIG_IGN, .sa_flags = SA_RESTART };
-    sigfillset(&sa.sa_mask);
-    sigaction(SIGPIPE, &sa, NULL);
+    for (int n = 0; n < arg->num_limits; n++) {
+        struct prop_limit *l = arg->limits[n];
+        if (l->id == event->reply_userdata && strcmp(l->name, prop->name) == 0)
+            return l;
+    }
 
-    int rc;
+    struct prop_limit *l = talloc_ptrtype(arg, l);
+    *l = (struct prop_limit){
+        .id = event->reply_userdata,
+        .name = talloc_strdup(l, prop->name),
+        .last_sent = -INFINITY,
+        .held = {talloc_size(l, 1), 0},
+    };
+    MP_TARRAY_APPEND(arg, arg->limits, arg->num_limits, l);
+    return l;
+}
 
-    struct client_arg *arg = p;
-    bstr client_msg = { talloc_strdup(NULL, ""), 0 };
+// Return whether the property change event is held back (instead of being
+// sent now). Only the most recent change within the interval is kept.
+static bool hold_property_change(struct client_arg *arg,
+                                 struct mpv_event *event, double now)
+{
+    struct prop_limit *l = find_limit(arg, event);
 
-    mpthread_set_name(arg->client_name);
+    if (now - l->last_sent >= arg->loop->prop_interval) {
+        l->held.len = 0;
+        l->last_sent = now;
+        return false;
+    }
+
+    l->held.len = 0;
+    if (append_event(arg, &l->held, event) < 0)
+        l->held.len = 0;
+    return true;
+}
+
+// Send held property changes whose interval has expired. Returns the time at
+// which the next one is due, or INFINITY.
+static double send_held_properties(struct client_arg *arg, double now)
+{
+    double next = INFINITY;
 
-    int pipe_fd = mpv_get_wakeup_pipe(arg->client);
-    if (pipe_fd < 0) {
-        MP_ERR(arg, "Could not get wakeup pipe\n");
-        goto done;
+    for (int n = 0; n < arg->num_limits; n++) {
+        struct prop_limit *l = arg->limits[n];
+        if (!l->held.len)
+            continue;
+        double due = l->last_sent + arg->loop->prop_interval;
+        if (now >= due) {
+            if (arg->writable)
+                bstr_xappend(arg, &arg->out, l->held);
+            l->held.len = 0;
+            l->last_sent = now;
+        } else {
+            next = MPMIN(next, due);
+        }
     }
 
-    MP_VERBOSE(arg, "Client connected\n");
+    return next;
+}
 
-    struct pollfd fds[2] = {
-        {.events = POLLIN, .fd = pipe_fd},
-        {.events = POLLIN, .fd = arg->client_fd},
-    };
+// Drain all queued events (as long as output isn't backed up), and encode
+// them into the output buffer, which is then written with a single syscall.
+static void process_events(struct client_arg *arg)
+{
+    double now = mp_time_sec();
 
-    fcntl(arg->client_fd, F_SETFL, fcntl(arg->client_fd, F_GETFL, 0) | O_NONBLOCK);
+    while (pending_output(arg) < MAX_PENDING_OUTPUT) {
+        mpv_event *event = mpv_wait_event(arg->client, 0);
 
-    while (1) {
-        rc = poll(fds, 2, 0);
-        if (rc == 0)
-            rc = poll(fds, 2, -1);
-        if (rc < 0) {
-            MP_ERR(arg, "Poll error\n");
-            continue;
+        if (event->event_id == MPV_EVENT_NONE)
+            return;
+
+        if (event->event_id == MPV_EVENT_SHUTDOWN) {
+            arg->dead = true;
+            return;
         }
 
-        if (fds[0].revents & POLLIN) {
-            mp_flush_wakeup_pipe(pipe_fd);
+        if (!arg->writable)
+            continue;
 
-            while (1) {
-                mpv_event *event = mpv_wait_event(arg->client, 0);
+        if (event->event_id == MPV_EVENT_PROPERTY_CHANGE &&
+            arg->loop->prop_interval > 0 &&
+            hold_property_change(arg, event, now))
+            continue;
 
-                if (event->event_id == MPV_EVENT_NONE)
-                    break;
+        size_t len = arg->out.len;
+        if (append_event(arg, &arg->out, event) < 0) {
+            arg->out.len = len;
+            MP_ERR(arg, "Encoding error\n");
+            arg->dead = true;
+            return;
+        }
+    }
 
-                if (event->event_id == MPV_EVENT_SHUTDOWN)
-                    goto done;
+    // Continue once enough output was written.
+    atomic_store(&arg->wakeup, true);
+}
 
-                if (!arg->writable)
-                    continue;
+static void detect_protocol(struct client_arg *arg)
+{
+    int r = mp_ipc_check_binary_handshake(&arg->client_msg);
+    if (r == 0)
+        return;
 
-                char *event_msg = mp_json_encode_event(event);
-                if (!event_msg) {
-                    MP_ERR(arg, "Encoding error\n");
-                    goto done;
-                }
+    arg->proto_known = true;
+    arg->binary = r > 0;
+    if (!arg->binary)
+        return;
 
-                rc = ipc_write_str(arg, event_msg);
-                talloc_free(event_msg);
-                if (rc < 0) {
-                    MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
-                    goto done;
-                }
-            }
+    MP_VERBOSE(arg, "Switching to binary protocol.\n");
+    // Held changes are encoded as JSON, which is fine before the handshake
+    // reply. Send them now instead of dropping them.
+    double now = mp_time_sec();
+    for (int n = 0; n < arg->num_limits; n++) {
+        struct prop_limit *l = arg->limits[n];
+        if (!l->held.len)
+            continue;
+        if (arg->writable)
+            bstr_xappend(arg, &arg->out, l->held);
+        l->held.len = 0;
+        l->last_sent = now;
+    }
+    if (arg->writable)
+        mp_ipc_append_binary_handshake(&arg->out);
+}
+
+// Run the next command in in (and advance in past it), and append the reply to
+// out. Returns 1 if a command was run, 0 if in contains no complete command,
+// -1 on error.
+static int run_next_command(struct client_arg *arg, bstr *in, bstr *out)
+{
+    if (arg->binary)
+        return mp_ipc_consume_next_frame(arg->client, in, out);
+
+    if (bstrchr(*in, '\n') == -1)
+        return 0;
+    char *reply = mp_ipc_consume_next_command(arg->client, NULL, in);
+    if (reply)
+        bstr_xappend(NULL, out, bstr0(reply));
+    talloc_free(reply);
+    return 1;
+}
+
+// Thread pool function: run the commands received so far, in order. Commands
+// may block for a long time (or lock the core), so this must not hold
+// cmd_lock while running them.
+static void run_commands(void *p)
+{
+    struct client_arg *arg = p;
+    bstr out = {0};
+
+    pthread_mutex_lock(&arg->cmd_lock);
+    bstr in = arg->cmd_in;
+    bstr rest = in; // not yet processed part of in
+    arg->cmd_in = (bstr){0};
+    int r = 1;
+    while (r > 0 && !arg->cmd_stop && arg->cmd_out.len < MAX_PENDING_OUTPUT) {
+        pthread_mutex_unlock(&arg->cmd_lock);
+        out.len = 0;
+        r = run_next_command(arg, &rest, &out);
+        pthread_mutex_lock(&arg->cmd_lock);
+        if (out.len) {
+            bstr_xappend(NULL, &arg->cmd_out, out);
+            wakeup_loop(arg->loop);
         }
+    }
+    // Put the unprocessed data back in front of what was received meanwhile.
+    if (rest.len)
+        memmove(in.start, rest.start, rest.len);
+    in.len = rest.len;
+    bstr_xappend(NULL, &in, arg->cmd_in);
+    talloc_free(arg->cmd_in.start);
+    arg->cmd_in = in;
+    arg->cmd_need_input = r == 0 && !arg->cmd_in.len;
+    arg->cmd_error |= r < 0;
+    arg->cmd_busy = false;
+    // The loop may free arg (and itself) as soon as cmd_lock is released.
+    wakeup_loop(arg->loop);
+    pthread_mutex_unlock(&arg->cmd_lock);
+
+    talloc_free(out.start);
+}
 
-        if (fds[1].revents & (POLLIN | POLLHUP | POLLNVAL)) {
-            while (1) {
-                char buf[128];
-                bstr append = { buf, 0 };
+// Pass received data to run_commands(), and collect the replies.
+static void process_commands(struct client_arg *arg)
+{
+    if (!arg->proto_known)
+        detect_protocol(arg);
+
+    pthread_mutex_lock(&arg->cmd_lock);
+    if (arg->proto_known && arg->client_msg.len) {
+        bstr_xappend(NULL, &arg->cmd_in, arg->client_msg);
+        arg->client_msg.len = 0;
+        arg->cmd_need_input = false;
+    }
+    if (arg->cmd_out.len && pending_output(arg) < MAX_PENDING_OUTPUT) {
+        if (arg->writable)
+            bstr_xappend(arg, &arg->out, arg->cmd_out);
+        arg->cmd_out.len = 0;
+    }
+    if (arg->cmd_error) {
+        MP_ERR(arg, "Invalid frame received.\n");
+        arg->dead = true;
+    }
+    bool runnable = arg->cmd_in.len && !arg->cmd_need_input;
+    if (runnable && !arg->cmd_busy && !arg->dead &&
+        arg->cmd_out.len < MAX_PENDING_OUTPUT)
+    {
+        arg->cmd_busy = true;
+        mp_thread_pool_queue(arg->loop->cmd_pool, run_commands, arg);
+    }
+    arg->input_full = runnable && arg->cmd_in.len >= MAX_PENDING_INPUT;
+    // The client closed the connection; it's done once all commands ran.
+    if (arg->eof && !arg->cmd_busy && !runnable)
+        arg->dead = true;
+    pthread_mutex_unlock(&arg->cmd_lock);
+}
 
-                ssize_t bytes = read(arg->client_fd, buf, sizeof(buf));
-                if (bytes < 0) {
-                    if (errno == EAGAIN)
-                        break;
+// Stop watching the client fd (no more reading or waiting for writability).
+static void unwatch_client(struct client_arg *arg)
+{
+    if (arg->watched)
+        epoll_ctl(arg->loop->epoll_fd, EPOLL_CTL_DEL, arg->client_fd, NULL);
+    arg->watched = false;
+}
 
-                    MP_ERR(arg, "Read error (%s)\n", mp_strerror(errno));
-                    goto done;
-                }
+// Return whether the client can be destroyed, i.e. no commands are running.
+static bool stop_commands(struct client_arg *arg)
+{
+    unwatch_client(arg);
 
-                if (bytes == 0) {
-                    MP_VERBOSE(arg, "Client disconnected\n");
-                    goto done;
-                }
+    pthread_mutex_lock(&arg->cmd_lock);
+    arg->cmd_stop = true;
+    bool idle = !arg->cmd_busy;
+    pthread_mutex_unlock(&arg->cmd_lock);
+    return idle;
+}
 
-                append.len = bytes;
+static void read_client(struct client_arg *arg, char *buf)
+{
+    ssize_t bytes = read(arg->client_fd, buf, READ_BUF_SIZE);
+    if (bytes < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return;
 
-                bstr_xappend(NULL, &client_msg, append);
+        MP_ERR(arg, "Read error (%s)\n", mp_strerror(errno));
+        arg->dead = true;
+        return;
+    }
 
-                while (bstrchr(client_msg, '\n') != -1) {
-                    char *reply_msg = mp_ipc_consume_next_command(arg->client,
-                        NULL, &client_msg);
+    if (bytes == 0) {
+        MP_VERBOSE(arg, "Client disconnected\n");
+        arg->eof = true;
+        return;
+    }
 
-                    if (reply_msg && arg->writable) {
-                        rc = ipc_write_str(arg, reply_msg);
-                        if (rc < 0) {
-                            MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
-                            talloc_free(reply_msg);
-                            goto done;
-                        }
-                    }
+    bstr_xappend(arg, &arg->client_msg, (bstr){(unsigned char *)buf, bytes});
+}
 
-                    talloc_free(reply_msg);
-                }
-            }
-        }
+static void update_client_events(struct client_arg *arg)
+{
+    if (!arg->watched)
+        return;
+
+    uint32_t events = 0;
+    if (pending_output(arg) < MAX_PENDING_OUTPUT && !arg->input_full &&
+        !arg->eof)
+        events |= EPOLLIN;
+    if (pending_output(arg))
+        events |= EPOLLOUT;
+
+    if (events != arg->epoll_events) {
+        struct epoll_event ev = {.events = events, .data.ptr = arg};
+        epoll_ctl(arg->loop->epoll_fd, EPOLL_CTL_MOD, arg->client_fd, &ev);
+        arg->epoll_events = events;
     }
+}
+
+static bool add_client(struct ipc_loop *loop, struct client_arg *arg)
+{
+    arg->loop = loop;
+    arg->epoll_events = EPOLLIN;
+    pthread_mutex_init(&arg->cmd_lock, NULL);
+    arg->out = (bstr){talloc_size(arg, OUT_BUF_SIZE), 0};
+
+    fcntl(arg->client_fd, F_SETFL, fcntl(arg->client_fd, F_GETFL, 0) | O_NONBLOCK);
+
+    struct epoll_event ev = {.events = arg->epoll_events, .data.ptr = arg};
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, arg->client_fd, &ev) < 0) {
+        MP_ERR(arg, "Could not watch client fd (%s)\n", mp_strerror(errno));
+        return false;
+    }
+    arg->watched = true;
+
+    MP_TARRAY_APPEND(loop, loop->clients, loop->num_clients, arg);
+
+    MP_VERBOSE(arg, "Client connected\n");
 
-done:
-    if (client_msg.len > 0)
+    // Also picks up events queued before this.
+    mpv_set_wakeup_callback(arg->client, wakeup_client, arg);
+    return true;
+}
+
+static void destroy_client(struct ipc_loop *loop, struct client_arg *arg)
+{
+    if (arg->client_msg.len > 0 || arg->cmd_in.len > 0)
         MP_WARN(arg, "Ignoring unterminated command on disconnect.\n");
-    talloc_free(client_msg.start);
+    talloc_free(arg->cmd_in.start);
+    talloc_free(arg->cmd_out.start);
+
+    if (arg->loop) {
+        unwatch_client(arg);
+        pthread_mutex_destroy(&arg->cmd_lock);
+    }
+    mpv_set_wakeup_callback(arg->client, NULL, NULL);
+
     if (arg->close_client_fd)
         close(arg->client_fd);
     struct mpv_handle *h = arg->client;
     bool quit = arg->quit_on_close;
     talloc_free(arg);
     if (quit) {
+        // (Such clients always have a loop of their own; see mp_init_ipc().)
         mpv_terminate_destroy(h);
     } else {
         mpv_destroy(h);
     }
+}
+
+static void close_listener(struct ipc_loop *loop)
+{
+    if (loop->listen_fd >= 0) {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, loop->listen_fd, NULL);
+        close(loop->listen_fd);
+        loop->listen_fd = -1;
+    }
+}
+
+static void accept_client(struct ipc_loop *loop)
+{
+    pthread_mutex_lock(&loop->lock);
+    int client_fd = -1;
+    if (loop->listen_fd >= 0) {
+        client_fd = accept(loop->listen_fd, NULL, NULL);
+        if (client_fd < 0 && errno != EAGAIN && errno != EINTR &&
+            errno != ECONNABORTED)
+        {
+            MP_ERR(loop, "Could not accept IPC client\n");
+            close_listener(loop);
+        }
+    }
+    pthread_mutex_unlock(&loop->lock);
+    if (client_fd < 0)
+        return;
+
+    int id = loop->client_num++;
+    struct client_arg *client = talloc_ptrtype(NULL, client);
+    *client = (struct client_arg){
+        .client_name = talloc_asprintf(client, "ipc-%d", id),
+        .client_fd = client_fd,
+        .close_client_fd = true,
+        .writable = true,
+    };
+
+    client->client = mp_new_client(loop->client_api, client->client_name);
+    if (!client->client) {
+        close(client_fd);
+        talloc_free(client);
+        return;
+    }
+    client->log = mp_client_get_log(client->client);
+
+    if (!add_client(loop, client))
+        destroy_client(loop, client);
+}
+
+static void free_loop(struct ipc_loop *loop)
+{
+    if (loop->listen_fd >= 0)
+        close(loop->listen_fd);
+    if (loop->epoll_fd >= 0)
+        close(loop->epoll_fd);
+    if (loop->wakeup_pipe[0] >= 0) {
+        close(loop->wakeup_pipe[0]);
+        close(loop->wakeup_pipe[1]);
+    }
+    pthread_mutex_destroy(&loop->lock);
+    talloc_free(loop); // also waits for and destroys cmd_pool
+}
+
+static void unref_loop(struct ipc_loop *loop)
+{
+    pthread_mutex_lock(&loop->lock);
+    bool last = --loop->refs == 0;
+    pthread_mutex_unlock(&loop->lock);
+    if (last)
+        free_loop(loop);
+}
+
+static void *ipc_loop_thread(void *p)
+{
+    struct ipc_loop *loop = p;
+
+    pthread_detach(pthread_self());
+
+    // We don't use MSG_NOSIGNAL because the moldy fruit OS doesn't support it.
+    struct sigaction sa = { .sa_handler = SIG_IGN, .sa_flags = SA_RESTART };
+    sigfillset(&sa.sa_mask);
+    sigaction(SIGPIPE, &sa, NULL);
+
+    mpthread_set_name("ipc");
+
+    char *buf = talloc_size(NULL, READ_BUF_SIZE);
+    double next_held = INFINITY; // when the next held property change is due
+
+    while (1) {
+        pthread_mutex_lock(&loop->lock);
+        for (int n = 0; n < loop->num_new_clients; n++) {
+            struct client_arg *arg = loop->new_clients[n];
+            if (!add_client(loop, arg))
+                destroy_client(loop, arg);
+        }
+        loop->num_new_clients = 0;
+        bool done = loop->owner_gone && !loop->num_clients;
+        // Connected clients use a changed property rate from now on; changes
+        // held back so far become due according to it.
+        if (loop->prop_interval != loop->new_prop_interval) {
+            loop->prop_interval = loop->new_prop_interval;
+            next_held = mp_time_sec();
+        }
+        pthread_mutex_unlock(&loop->lock);
+
+        if (done)
+            break;
+
+        struct epoll_event events[MAX_EPOLL_EVENTS];
+        int timeout = -1;
+        if (next_held < INFINITY)
+            timeout = MPCLAMP(ceil((next_held - mp_time_sec()) * 1000), 0, INT_MAX);
+        int num = epoll_wait(loop->epoll_fd, events, MAX_EPOLL_EVENTS, timeout);
+        if (num < 0) {
+            if (errno != EINTR)
+                MP_ERR(loop, "Poll error\n");
+            continue;
+        }
+
+        for (int n = 0; n < num; n++) {
+            void *ptr = events[n].data.ptr;
+            if (ptr == &loop->wakeup_pipe) {
+                mp_flush_wakeup_pipe(loop->wakeup_pipe[0]);
+            } else if (ptr == &loop->listen_fd) {
+                accept_client(loop);
+            } else {
+                struct client_arg *arg = ptr;
+                if (arg->dead)
+                    continue;
+                if (events[n].events & EPOLLOUT)
+                    flush_output(arg);
+                if (events[n].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    // (Hangups are reported even if no events are requested.)
+                    if (arg->eof) {
+                        unwatch_client(arg);
+                    } else {
+                        read_client(arg, buf);
+                    }
+                }
+            }
+        }
+
+        // Handle events and command replies, then write everything that was
+        // produced in one go.
+        double now = mp_time_sec();
+        next_held = INFINITY;
+        for (int n = loop->num_clients - 1; n >= 0; n--) {
+            struct client_arg *arg = loop->clients[n];
+            if (!arg->dead)
+                process_commands(arg);
+            if (!arg->dead && pending_output(arg) < MAX_PENDING_OUTPUT &&
+                atomic_exchange(&arg->wakeup, false))
+                process_events(arg);
+            if (!arg->dead && arg->num_limits)
+                next_held = MPMIN(next_held, send_held_properties(arg, now));
+            if (!arg->dead)
+                flush_output(arg);
+            if (arg->dead) {
+                // Wait for a running command to finish; it wakes up the loop.
+                if (!stop_commands(arg))
+                    continue;
+                MP_TARRAY_REMOVE_AT(loop->clients, loop->num_clients, n);
+                destroy_client(loop, arg);
+            } else {
+                update_client_events(arg);
+            }
+        }
+    }
+
+    talloc_free(buf);
+    unref_loop(loop);
     return NULL;
 }
 
-static bool ipc_start_client(struct mp_ipc_ctx *ctx, struct client_arg *client,
-                             bool free_on_init_fail)
+// Start a loop thread, referenced by ctx.
+static struct ipc_loop *create_loop(struct mp_ipc_ctx *ctx, struct mp_log *log,
+                                    struct mp_client_api *client_api,
+                                    int listen_fd)
+{
+    struct ipc_loop *loop = talloc_ptrtype(NULL, loop);
+    *loop = (struct ipc_loop){
+        .log = mp_log_new(loop, log, NULL),
+        .client_api = client_api,
+        .listen_fd = listen_fd,
+        .wakeup_pipe = {-1, -1},
+        .refs = 2,
+    };
+    pthread_mutex_init(&loop->lock, NULL);
+
+    loop->cmd_pool = mp_thread_pool_create(loop, 1, 1, MAX_COMMAND_THREADS);
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (!loop->cmd_pool || loop->epoll_fd < 0 ||
+        mp_make_wakeup_pipe(loop->wakeup_pipe) < 0)
+        goto error;
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &loop->wakeup_pipe};
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wakeup_pipe[0], &ev) < 0)
+        goto error;
+
+    if (listen_fd >= 0) {
+        ev = (struct epoll_event){.events = EPOLLIN, .data.ptr = &loop->listen_fd};
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0)
+            goto error;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    loop->prop_interval = loop->new_prop_interval = ctx->prop_interval;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ipc_loop_thread, loop)) {
+        pthread_mutex_unlock(&ctx->lock);
+        goto error;
+    }
+
+    // Drop loops whose thread has exited (only ctx's reference is left).
+    for (int n = ctx->num_loops - 1; n >= 0; n--) {
+        struct ipc_loop *old = ctx->loops[n];
+        pthread_mutex_lock(&old->lock);
+        bool exited = old->refs == 1;
+        pthread_mutex_unlock(&old->lock);
+        if (exited) {
+            MP_TARRAY_REMOVE_AT(ctx->loops, ctx->num_loops, n);
+            free_loop(old);
+        }
+    }
+    MP_TARRAY_APPEND(ctx, ctx->loops, ctx->num_loops, loop);
+    pthread_mutex_unlock(&ctx->lock);
+
+    return loop;
+
+error:
+    MP_ERR(loop, "Could not start IPC event loop\n");
+    loop->listen_fd = -1; // owned by caller on failure
+    free_loop(loop);
+    return NULL;
+}
+
+// Hand the client over to the loop thread. If standalone is set, the loop
+// exits once the client is gone.
+static void loop_add_client(struct ipc_loop *loop, struct client_arg *client,
+                            bool standalone)
+{
+    pthread_mutex_lock(&loop->lock);
+    MP_TARRAY_APPEND(loop, loop->new_clients, loop->num_new_clients, client);
+    if (standalone)
+        loop->owner_gone = true;
+    wakeup_loop(loop);
+    pthread_mutex_unlock(&loop->lock);
+}
+
+// Serve the client by ctx's listening loop, or (if there is none) by a new
+// loop that exits with the client.
+static bool ipc_start_client(struct mp_ipc_ctx *ctx, struct mp_log *log,
+                             struct mp_client_api *client_api,
+                             struct client_arg *client, bool free_on_init_fail)
 {
     if (!client->client)
-        client->client = mp_new_client(ctx->client_api, client->client_name);
+        client->client = mp_new_client(client_api, client->client_name);
     if (!client->client)
         goto err;
 
     client->log = mp_client_get_log(client->client);
 
-    pthread_t client_thr;
-    if (pthread_create(&client_thr, NULL, client_thread, client))
-        goto err;
+    struct ipc_loop *loop = ctx->loop;
+    if (!loop) {
+        loop = create_loop(ctx, log ? log : client->log, client_api, -1);
+        if (!loop)
+            goto err;
+    }
 
+    loop_add_client(loop, client, !ctx->loop);
     return true;
 
 err:
@@ -249,24 +861,12 @@ err:
     return false;
 }
 
-static void ipc_start_client_json(struct mp_ipc_ctx *ctx, int id, int fd)
-{
-    struct client_arg *client = talloc_ptrtype(NULL, client);
-    *client = (struct client_arg){
-        .client_name =
-            id >= 0 ? talloc_asprintf(client, "ipc-%d", id) : "ipc",
-        .client_fd = fd,
-        .close_client_fd = id >= 0,
-        .quit_on_close = id < 0,
-        .writable = true,
-    };
-
-    ipc_start_client(ctx, client, true);
-}
-
 bool mp_ipc_start_anon_client(struct mp_ipc_ctx *ctx, struct mpv_handle *h,
                               int out_fd[2])
 {
+    if (!ctx)
+        return false;
+
     int pair[2];
     if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair))
         return false;
@@ -282,7 +882,7 @@ bool mp_ipc_start_anon_client(struct mp_ipc_ctx *ctx, struct mpv_handle *h,
         .writable = true,
     };
 
-    if (!ipc_start_client(ctx, client, false)) {
+    if (!ipc_start_client(ctx, NULL, NULL, client, false)) {
         close(pair[0]);
         close(pair[1]);
         return false;
@@ -293,35 +893,33 @@ bool mp_ipc_start_anon_client(struct mp_ipc_ctx *ctx, struct mpv_handle *h,
     return true;
 }
 
-static void *ipc_thread(void *p)
+static int create_listen_socket(struct mp_ipc_ctx *ctx, const char *path)
 {
     int rc;
 
     int ipc_fd;
     struct sockaddr_un ipc_un = {0};
 
-    struct mp_ipc_ctx *arg = p;
-
-    mpthread_set_name("ipc socket listener");
-
-    MP_VERBOSE(arg, "Starting IPC master\n");
+    MP_VERBOSE(ctx, "Starting IPC master\n");
 
     ipc_fd = socket(AF_UNIX, SOCK_STREAM, 0);
     if (ipc_fd < 0) {
-        MP_ERR(arg, "Could not create IPC socket\n");
-        goto done;
+        MP_ERR(ctx, "Could not create IPC socket\n");
+        goto error;
     }
 
     fchmod(ipc_fd, 0600);
+    mp_set_cloexec(ipc_fd);
+    fcntl(ipc_fd, F_SETFL, fcntl(ipc_fd, F_GETFL, 0) | O_NONBLOCK);
 
-    size_t path_len = strlen(arg->path);
+    size_t path_len = strlen(path);
     if (path_len >= sizeof(ipc_un.sun_path) - 1) {
-        MP_ERR(arg, "Could not create IPC socket\n");
-        goto done;
+        MP_ERR(ctx, "Could not create IPC socket\n");
+        goto error;
     }
 
     ipc_un.sun_family = AF_UNIX,
-    strncpy(ipc_un.sun_path, arg->path, sizeof(ipc_un.sun_path) - 1);
+    strncpy(ipc_un.sun_path, path, sizeof(ipc_un.sun_path) - 1);
 
     unlink(ipc_un.sun_path);
 
@@ -333,51 +931,24 @@ static void *ipc_thread(void *p)
     size_t addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + path_len;
     rc = bind(ipc_fd, (struct sockaddr *) &ipc_un, addr_len);
     if (rc < 0) {
-        MP_ERR(arg, "Could not bind IPC socket\n");
-        goto done;
+        MP_ERR(ctx, "Could not bind IPC socket\n");
+        goto error;
     }
 
     rc = listen(ipc_fd, 10);
     if (rc < 0) {
-        MP_ERR(arg, "Could not listen on IPC socket\n");
-        goto done;
+        MP_ERR(ctx, "Could not listen on IPC socket\n");
+        goto error;
     }
 
-    MP_VERBOSE(arg, "Listening to IPC socket.\n");
-
-    int client_num = 0;
-
-    struct pollfd fds[2] = {
-        {.events = POLLIN, .fd = arg->death_pipe[0]},
-        {.events = POLLIN, .fd = ipc_fd},
-    };
-
-    while (1) {
-        rc = poll(fds, 2, -1);
-        if (rc < 0) {
-            MP_ERR(arg, "Poll error\n");
-            continue;
-        }
+    MP_VERBOSE(ctx, "Listening to IPC socket.\n");
 
-        if (fds[0].revents & POLLIN)
-            goto done;
+    return ipc_fd;
 
-        if (fds[1].revents & POLLIN) {
-            int client_fd = accept(ipc_fd, NULL, NULL);
-            if (client_fd < 0) {
-                MP_ERR(arg, "Could not accept IPC client\n");
-                goto done;
-            }
-
-            ipc_start_client_json(arg, client_num++, client_fd);
-        }
-    }
-
-done:
+error:
     if (ipc_fd >= 0)
         close(ipc_fd);
-
-    return NULL;
+    return -1;
 }
 
 struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
@@ -388,10 +959,10 @@ struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
     struct mp_ipc_ctx *arg = talloc_ptrtype(NULL, arg);
     *arg = (struct mp_ipc_ctx){
         .log        = mp_log_new(arg, global->log, "ipc"),
-        .client_api = client_api,
-        .path       = mp_get_user_path(arg, global, opts->ipc_path),
-        .death_pipe = {-1, -1},
+        .prop_interval = rate_to_interval(opts->ipc_property_rate),
     };
+    pthread_mutex_init(&arg->lock, NULL);
+    char *path = mp_get_user_path(arg, global, opts->ipc_path);
 
     if (opts->ipc_client && opts->ipc_client[0]) {
         int fd = -1;
@@ -404,30 +975,50 @@ struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
         if (fd < 0) {
             MP_ERR(arg, "Invalid IPC client argument: '%s'\n", opts->ipc_client);
         } else {
-            ipc_start_client_json(arg, -1, fd);
+            struct client_arg *client = talloc_ptrtype(NULL, client);
+            *client = (struct client_arg){
+                .client_name = "ipc",
+                .client_fd = fd,
+                .quit_on_close = true,
+                .writable = true,
+            };
+            ipc_start_client(arg, arg->log, client_api, client, true);
         }
     }
 
     talloc_free(opts);
 
-    if (!arg->path || !arg->path[0])
+    if (!path || !path[0])
         goto out;
 
-    if (mp_make_wakeup_pipe(arg->death_pipe) < 0)
+    int listen_fd = create_listen_socket(arg, path);
+    if (listen_fd < 0)
         goto out;
 
-    if (pthread_create(&arg->thread, NULL, ipc_thread, arg))
-        goto out;
+    arg->loop = create_loop(arg, arg->log, client_api, listen_fd);
+    if (!arg->loop)
+        close(listen_fd);
 
+out:
+    // Returned even without a listening socket, for other clients' loops.
     return arg;
+}
 
-out:
-    if (arg->death_pipe[0] >= 0) {
-        close(arg->death_pipe[0]);
-        close(arg->death_pipe[1]);
+void mp_ipc_set_property_rate(struct mp_ipc_ctx *arg, double rate)
+{
+    if (!arg)
+        return;
+
+    pthread_mutex_lock(&arg->lock);
+    arg->prop_interval = rate_to_interval(rate);
+    for (int n = 0; n < arg->num_loops; n++) {
+        struct ipc_loop *loop = arg->loops[n];
+        pthread_mutex_lock(&loop->lock);
+        loop->new_prop_interval = arg->prop_interval;
+        wakeup_loop(loop);
+        pthread_mutex_unlock(&loop->lock);
     }
-    talloc_free(arg);
-    return NULL;
+    pthread_mutex_unlock(&arg->lock);
 }
 
 void mp_uninit_ipc(struct mp_ipc_ctx *arg)
@@ -435,10 +1026,22 @@ void mp_uninit_ipc(struct mp_ipc_ctx *arg)
     if (!arg)
         return;
 
-    (void)write(arg->death_pipe[1], &(char){0}, 1);
-    pthread_join(arg->thread, NULL);
+    // Stop accepting new clients. Connected clients are still served until
+    // they disconnect or their mpv_handle is shut down; the loop thread then
+    // exits on its own. This is also called by IPC commands (on cmd_pool,
+    // with the core locked), so it must not wait for the loop thread. (The
+    // loop of such a command is still running, so it's not freed here.)
+    struct ipc_loop *loop = arg->loop;
+    if (loop) {
+        pthread_mutex_lock(&loop->lock);
+        close_listener(loop);
+        loop->owner_gone = true;
+        wakeup_loop(loop);
+        pthread_mutex_unlock(&loop->lock);
+    }
 
-    close(arg->death_pipe[0]);
-    close(arg->death_pipe[1]);
+    for (int n = 0; n < arg->num_loops; n++)
+        unref_loop(arg->loops[n]);
+    pthread_mutex_destroy(&arg->lock);
     talloc_free(arg);
 }
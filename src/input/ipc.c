@@ -19,11 +19,20 @@
 #include "input/input.h"
 #include "misc/json.h"
 #include "misc/node.h"
+#include "misc/node_wire.h"
 #include "options/m_option.h"
 #include "options/options.h"
 #include "options/path.h"
 #include "player/client.h"
 
+// Sent by a client as the very first data on a connection to switch it to the
+// binary protocol, and echoed by the server.
+#define BINARY_MAGIC "\0MPVBIN1"
+#define BINARY_MAGIC_LEN 8
+
+// Maximum payload size of a frame sent by a client.
+#define BINARY_MAX_FRAME (16 * 1024 * 1024)
+
 static mpv_node *mpv_node_array_get(mpv_node *src, int index)
 {
     if (src->format != MPV_FORMAT_NODE_ARRAY)
@@ -87,38 +96,82 @@ static void mpv_format_command_reply(void *ta_parent, mpv_event *event,
     mpv_node_map_add(ta_parent, dst, "data", &cmd->result);
 }
 
-char *mp_json_encode_event(mpv_event *event)
+static void event_to_node(void *ta_parent, mpv_event *event, mpv_node *dst)
 {
-    void *ta_parent = talloc_new(NULL);
-
-    struct mpv_node event_node;
     if (event->event_id == MPV_EVENT_COMMAND_REPLY) {
-        event_node = (mpv_node){.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
-        mpv_format_command_reply(ta_parent, event, &event_node);
+        *dst = (mpv_node){.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
+        mpv_format_command_reply(ta_parent, event, dst);
     } else {
-        mpv_event_to_node(&event_node, event);
+        mpv_event_to_node(dst, event);
         // Abuse mpv_event_to_node() internals.
-        talloc_steal(ta_parent, node_get_alloc(&event_node));
+        talloc_steal(ta_parent, node_get_alloc(dst));
     }
+}
 
-    char *output = talloc_strdup(NULL, "");
-    json_write(&output, &event_node);
-    output = ta_talloc_strdup_append(output, "\n");
+int mp_json_append_event(bstr *dst, mpv_event *event)
+{
+    void *ta_parent = talloc_new(NULL);
+
+    struct mpv_node event_node;
+    event_to_node(ta_parent, event, &event_node);
+
+    int r = json_write_bstr(dst, &event_node);
+    if (r >= 0)
+        bstr_xappend(NULL, dst, bstr0("\n"));
 
     talloc_free(ta_parent);
 
-    return output;
+    return r;
 }
 
-// Function is allowed to modify src[n].
-static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
-                                  char *src)
+// Append node as binary frame: 32 bit little endian payload size, payload.
+static int append_frame(bstr *dst, mpv_node *node)
+{
+    size_t start = dst->len;
+    bstr_xappend(NULL, dst, (bstr){(unsigned char[4]){0}, 4});
+    if (node_wire_write(dst, node) < 0 || dst->len - start - 4 > UINT32_MAX) {
+        dst->len = start;
+        return -1;
+    }
+    uint32_t size = dst->len - start - 4;
+    for (int n = 0; n < 4; n++)
+        dst->start[start + n] = size >> (n * 8);
+    return 0;
+}
+
+int mp_ipc_append_event_binary(bstr *dst, mpv_event *event)
+{
+    void *ta_parent = talloc_new(NULL);
+
+    struct mpv_node event_node;
+    event_to_node(ta_parent, event, &event_node);
+
+    int r = append_frame(dst, &event_node);
+
+    talloc_free(ta_parent);
+
+    return r;
+}
+
+char *mp_json_encode_event(mpv_event *event)
+{
+    bstr output = {0};
+    if (mp_json_append_event(&output, event) < 0) {
+        talloc_free(output.start);
+        return NULL;
+    }
+    return (char *)output.start;
+}
+
+// Execute the request in msg_node (NULL if it couldn't be parsed), and write
+// the reply to *reply_node. Returns false if no reply should be sent.
+static bool execute_command_node(struct mpv_handle *client, void *ta_parent,
+                                 mpv_node *msg_node, mpv_node *reply_node_out)
 {
     int rc;
     const char *cmd = NULL;
     struct mp_log *log = mp_client_get_log(client);
 
-    mpv_node msg_node;
     mpv_node reply_node = {.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
     mpv_node *reqid_node = NULL;
     int64_t reqid = 0;
@@ -126,19 +179,12 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
     bool async = false;
     bool send_reply = true;
 
-    rc = json_parse(ta_parent, &msg_node, &src, MAX_JSON_DEPTH);
-    if (rc < 0) {
-        mp_err(log, "malformed JSON received: '%s'\n", src);
-        rc = MPV_ERROR_INVALID_PARAMETER;
-        goto error;
-    }
-
-    if (msg_node.format != MPV_FORMAT_NODE_MAP) {
+    if (!msg_node || msg_node->format != MPV_FORMAT_NODE_MAP) {
         rc = MPV_ERROR_INVALID_PARAMETER;
         goto error;
     }
 
-    async_node = node_map_get(&msg_node, "async");
+    async_node = node_map_get(msg_node, "async");
     if (async_node) {
         if (async_node->format != MPV_FORMAT_FLAG) {
             rc = MPV_ERROR_INVALID_PARAMETER;
@@ -147,7 +193,7 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
         async = async_node->u.flag;
     }
 
-    reqid_node = node_map_get(&msg_node, "request_id");
+    reqid_node = node_map_get(msg_node, "request_id");
     if (reqid_node) {
         if (reqid_node->format == MPV_FORMAT_INT64) {
             reqid = reqid_node->u.int64;
@@ -161,7 +207,7 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
         }
     }
 
-    mpv_node *cmd_node = node_map_get(&msg_node, "command");
+    mpv_node *cmd_node = node_map_get(msg_node, "command");
     if (!cmd_node) {
         rc = MPV_ERROR_INVALID_PARAMETER;
         goto error;
@@ -370,9 +416,28 @@ error:
 
     mpv_node_map_add_string(ta_parent, &reply_node, "error", mpv_error_string(rc));
 
+    *reply_node_out = reply_node;
+    return send_reply;
+}
+
+// Function is allowed to modify src[n].
+static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
+                                  char *src)
+{
+    struct mp_log *log = mp_client_get_log(client);
+
+    mpv_node msg_node;
+    mpv_node reply_node;
+
+    bool ok = json_parse(ta_parent, &msg_node, &src, MAX_JSON_DEPTH) >= 0;
+    if (!ok)
+        mp_err(log, "malformed JSON received: '%s'\n", src);
+
     char *output = talloc_strdup(ta_parent, "");
 
-    if (send_reply) {
+    if (execute_command_node(client, ta_parent, ok ? &msg_node : NULL,
+                             &reply_node))
+    {
         json_write(&output, &reply_node);
         output = ta_talloc_strdup_append(output, "\n");
     }
@@ -387,6 +452,60 @@ static char *text_execute_command(struct mpv_handle *client, void *tmp, char *sr
     return NULL;
 }
 
+int mp_ipc_check_binary_handshake(bstr *buf)
+{
+    size_t len = MPMIN(buf->len, BINARY_MAGIC_LEN);
+    if (!len)
+        return 0;
+    if (memcmp(buf->start, BINARY_MAGIC, len) != 0)
+        return -1;
+    if (len < BINARY_MAGIC_LEN)
+        return 0;
+    // (Only done once per connection.)
+    memmove(buf->start, buf->start + len, buf->len - len);
+    buf->len -= len;
+    return 1;
+}
+
+void mp_ipc_append_binary_handshake(bstr *dst)
+{
+    bstr_xappend(NULL, dst, (bstr){(unsigned char *)BINARY_MAGIC,
+                                   BINARY_MAGIC_LEN});
+}
+
+int mp_ipc_consume_next_frame(struct mpv_handle *client, bstr *buf, bstr *out)
+{
+    if (buf->len < 4)
+        return 0;
+    uint32_t size = 0;
+    for (int n = 0; n < 4; n++)
+        size |= (uint32_t)buf->start[n] << (n * 8);
+    if (size > BINARY_MAX_FRAME)
+        return -1;
+    if (buf->len - 4 < size)
+        return 0;
+
+    void *tmp = talloc_new(NULL);
+
+    mpv_node msg_node;
+    mpv_node reply_node;
+
+    bstr payload = {buf->start + 4, size};
+    bool ok = node_wire_parse(tmp, &msg_node, &payload, MAX_JSON_DEPTH) >= 0 &&
+              !payload.len;
+    if (!ok)
+        mp_err(mp_client_get_log(client), "malformed binary request received\n");
+
+    *buf = bstr_cut(*buf, 4 + size);
+
+    if (execute_command_node(client, tmp, ok ? &msg_node : NULL, &reply_node) &&
+        out)
+        append_frame(out, &reply_node);
+
+    talloc_free(tmp);
+    return 1;
+}
+
 char *mp_ipc_consume_next_command(struct mpv_handle *client, void *ctx, bstr *buf)
 {
     void *tmp = talloc_new(NULL);
@@ -394,8 +513,7 @@ char *mp_ipc_consume_next_command(struct mpv_handle *client, void *ctx, bstr *bu
     bstr rest;
     bstr line = bstr_getline(*buf, &rest);
     char *line0 = bstrto0(tmp, line);
-    talloc_steal(tmp, buf->start);
-    *buf = bstrdup(NULL, rest);
+    *buf = rest;
 
     json_skip_whitespace(&line0);
 
@@ -352,6 +352,15 @@ int json_write(char **dst, struct mpv_node *src)
     return json_append_str(dst, src, -1);
 }
 
+/* Same as json_write(), but append to the string in *dst, using dst->len as
+ * start offset. dst->start must be a talloc allocation (which keeps its
+ * parent when extended) or NULL. Avoids strlen() on a large existing buffer.
+ */
+int json_write_bstr(bstr *dst, struct mpv_node *src)
+{
+    return json_append(dst, src, -1);
+}
+
 // Same as json_write(), but add whitespace to make it readable.
 int json_write_pretty(char **dst, struct mpv_node *src)
 {
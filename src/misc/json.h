@@ -20,6 +20,7 @@
 
 // We reuse mpv_node.
 #include "libmpv/client.h"
+#include "misc/bstr.h"
 
 #define MAX_JSON_DEPTH 50
 
@@ -27,5 +28,6 @@ int json_parse(void *ta_parent, struct mpv_node *dst, char **src, int max_depth)
 void json_skip_whitespace(char **src);
 int json_write(char **s, struct mpv_node *src);
 int json_write_pretty(char **s, struct mpv_node *src);
+int json_write_bstr(bstr *dst, struct mpv_node *src);
 
 #endif
@@ -0,0 +1,255 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compact binary encoding of mpv_node, used by the binary IPC protocol.
+ *
+ * Each node starts with a tag byte, followed by a payload depending on it:
+ *
+ *  NW_NONE, NW_FALSE, NW_TRUE: nothing
+ *  NW_INT64:      zigzag-encoded varint
+ *  NW_DOUBLE:     8 bytes, IEEE 754 binary64, little endian
+ *  NW_STRING:     varint length, UTF-8 bytes (no terminating 0 byte)
+ *  NW_ARRAY:      varint number of entries, nodes
+ *  NW_MAP:        varint number of entries, each a key (varint length, bytes)
+ *                 followed by a node
+ *  NW_BYTE_ARRAY: varint length, bytes
+ *
+ * A varint is an unsigned LEB128 number (7 bits per byte, low bits first,
+ * highest bit set on all bytes but the last), at most 10 bytes long.
+ */
+
+#include <string.h>
+#include <inttypes.h>
+
+#include "common/common.h"
+#include "misc/bstr.h"
+
+#include "node_wire.h"
+
+enum {
+    NW_NONE         = 0,
+    NW_FALSE        = 1,
+    NW_TRUE         = 2,
+    NW_INT64        = 3,
+    NW_DOUBLE       = 4,
+    NW_STRING       = 5,
+    NW_ARRAY        = 6,
+    NW_MAP          = 7,
+    NW_BYTE_ARRAY   = 8,
+};
+
+static void write_byte(bstr *dst, uint8_t v)
+{
+    bstr_xappend(NULL, dst, (bstr){&v, 1});
+}
+
+static void write_varint(bstr *dst, uint64_t v)
+{
+    uint8_t buf[10];
+    int len = 0;
+    do {
+        buf[len] = v & 0x7F;
+        v >>= 7;
+        if (v)
+            buf[len] |= 0x80;
+        len++;
+    } while (v);
+    bstr_xappend(NULL, dst, (bstr){buf, len});
+}
+
+static void write_bytes(bstr *dst, const void *data, size_t len)
+{
+    write_varint(dst, len);
+    bstr_xappend(NULL, dst, (bstr){(unsigned char *)data, len});
+}
+
+/* Encode *src, and append the result to *dst. dst->start must be a talloc
+ * allocation (which keeps its parent when extended) or NULL.
+ * Returns: 0 on success, <0 on failure (unknown format; dst is left with
+ * partial output).
+ */
+int node_wire_write(bstr *dst, struct mpv_node *src)
+{
+    switch (src->format) {
+    case MPV_FORMAT_NONE:
+        write_byte(dst, NW_NONE);
+        return 0;
+    case MPV_FORMAT_FLAG:
+        write_byte(dst, src->u.flag ? NW_TRUE : NW_FALSE);
+        return 0;
+    case MPV_FORMAT_INT64: {
+        uint64_t v = src->u.int64;
+        write_byte(dst, NW_INT64);
+        write_varint(dst, (v << 1) ^ (src->u.int64 < 0 ? UINT64_MAX : 0));
+        return 0;
+    }
+    case MPV_FORMAT_DOUBLE: {
+        uint64_t v;
+        memcpy(&v, &src->u.double_, sizeof(v));
+        uint8_t buf[8];
+        for (int n = 0; n < 8; n++)
+            buf[n] = v >> (n * 8);
+        write_byte(dst, NW_DOUBLE);
+        bstr_xappend(NULL, dst, (bstr){buf, sizeof(buf)});
+        return 0;
+    }
+    case MPV_FORMAT_STRING:
+        write_byte(dst, NW_STRING);
+        write_bytes(dst, src->u.string, strlen(src->u.string));
+        return 0;
+    case MPV_FORMAT_BYTE_ARRAY:
+        write_byte(dst, NW_BYTE_ARRAY);
+        write_bytes(dst, src->u.ba->data, src->u.ba->size);
+        return 0;
+    case MPV_FORMAT_NODE_ARRAY:
+    case MPV_FORMAT_NODE_MAP: {
+        struct mpv_node_list *list = src->u.list;
+        bool is_obj = src->format == MPV_FORMAT_NODE_MAP;
+        write_byte(dst, is_obj ? NW_MAP : NW_ARRAY);
+        write_varint(dst, list->num);
+        for (int n = 0; n < list->num; n++) {
+            if (is_obj)
+                write_bytes(dst, list->keys[n], strlen(list->keys[n]));
+            if (node_wire_write(dst, &list->values[n]) < 0)
+                return -1;
+        }
+        return 0;
+    }
+    }
+    return -1; // unknown format
+}
+
+static int read_varint(bstr *src, uint64_t *out)
+{
+    uint64_t v = 0;
+    for (int n = 0; n < 10; n++) {
+        if (!src->len)
+            return -1;
+        uint8_t b = src->start[0];
+        *src = bstr_cut(*src, 1);
+        v |= (uint64_t)(b & 0x7F) << (n * 7);
+        if (!(b & 0x80)) {
+            *out = v;
+            return 0;
+        }
+    }
+    return -1; // too long
+}
+
+// Read a length-prefixed byte string, and return a 0-terminated copy.
+static char *read_str(void *ta_parent, bstr *src)
+{
+    uint64_t len;
+    if (read_varint(src, &len) < 0 || len > src->len)
+        return NULL;
+    bstr str = bstr_splice(*src, 0, len);
+    if (bstrchr(str, '\0') >= 0)
+        return NULL; // can't be represented
+    *src = bstr_cut(*src, len);
+    return bstrto0(ta_parent, str);
+}
+
+/* Decode a node from the start of *src, and write the result into *dst.
+ * max_depth limits the recursion and tree depth.
+ * Returns:
+ *   0: success, *dst is valid, *src is advanced past the node
+ *  -1: failure, *dst is invalid, there may be dead allocs under ta_parent
+ *      (ta_free_children(ta_parent) is the only way to free them)
+ * Unlike json_parse(), *dst never references the input data.
+ */
+int node_wire_parse(void *ta_parent, struct mpv_node *dst, bstr *src,
+                    int max_depth)
+{
+    max_depth -= 1;
+    if (max_depth < 0 || !src->len)
+        return -1;
+
+    uint8_t tag = src->start[0];
+    *src = bstr_cut(*src, 1);
+
+    switch (tag) {
+    case NW_NONE:
+        dst->format = MPV_FORMAT_NONE;
+        return 0;
+    case NW_FALSE:
+    case NW_TRUE:
+        dst->format = MPV_FORMAT_FLAG;
+        dst->u.flag = tag == NW_TRUE;
+        return 0;
+    case NW_INT64: {
+        uint64_t v;
+        if (read_varint(src, &v) < 0)
+            return -1;
+        dst->format = MPV_FORMAT_INT64;
+        dst->u.int64 = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+        return 0;
+    }
+    case NW_DOUBLE: {
+        if (src->len < 8)
+            return -1;
+        uint64_t v = 0;
+        for (int n = 0; n < 8; n++)
+            v |= (uint64_t)src->start[n] << (n * 8);
+        *src = bstr_cut(*src, 8);
+        dst->format = MPV_FORMAT_DOUBLE;
+        memcpy(&dst->u.double_, &v, sizeof(v));
+        return 0;
+    }
+    case NW_STRING:
+        dst->format = MPV_FORMAT_STRING;
+        dst->u.string = read_str(ta_parent, src);
+        return dst->u.string ? 0 : -1;
+    case NW_BYTE_ARRAY: {
+        uint64_t len;
+        if (read_varint(src, &len) < 0 || len > src->len)
+            return -1;
+        struct mpv_byte_array *ba = talloc_zero(ta_parent, struct mpv_byte_array);
+        ba->data = talloc_memdup(ba, src->start, len);
+        ba->size = len;
+        *src = bstr_cut(*src, len);
+        dst->format = MPV_FORMAT_BYTE_ARRAY;
+        dst->u.ba = ba;
+        return 0;
+    }
+    case NW_ARRAY:
+    case NW_MAP: {
+        bool is_obj = tag == NW_MAP;
+        uint64_t num;
+        // Each entry needs at least 1 byte; avoids huge bogus allocations.
+        if (read_varint(src, &num) < 0 || num > src->len)
+            return -1;
+        struct mpv_node_list *list = talloc_zero(ta_parent, struct mpv_node_list);
+        list->values = talloc_array(list, struct mpv_node, num);
+        if (is_obj)
+            list->keys = talloc_array(list, char *, num);
+        for (list->num = 0; list->num < num; list->num++) {
+            if (is_obj) {
+                list->keys[list->num] = read_str(list, src);
+                if (!list->keys[list->num])
+                    return -1;
+            }
+            if (node_wire_parse(ta_parent, &list->values[list->num], src,
+                                max_depth) < 0)
+                return -1;
+        }
+        dst->format = is_obj ? MPV_FORMAT_NODE_MAP : MPV_FORMAT_NODE_ARRAY;
+        dst->u.list = list;
+        return 0;
+    }
+    }
+    return -1; // unknown tag
+}
@@ -0,0 +1,28 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_NODE_WIRE_H
+#define MP_NODE_WIRE_H
+
+#include "libmpv/client.h"
+#include "misc/bstr.h"
+
+int node_wire_write(bstr *dst, struct mpv_node *src);
+int node_wire_parse(void *ta_parent, struct mpv_node *dst, bstr *src,
+                    int max_depth);
+
+#endif
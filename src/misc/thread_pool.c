@@ -31,13 +31,14 @@ struct work {
 };
 
 struct mp_thread_pool {
-    int min_threads, max_threads;
+    int min_threads;
 
     pthread_mutex_t lock;
     pthread_cond_t wakeup;
 
     // --- the following fields are protected by lock
 
+    int max_threads;
     pthread_t *threads;
     int num_threads;
 
@@ -221,3 +222,10 @@ bool mp_thread_pool_run(struct mp_thread_pool *pool, void (*fn)(void *ctx),
 {
     return thread_pool_add(pool, fn, fn_ctx, false);
 }
+
+void mp_thread_pool_grow(struct mp_thread_pool *pool, int max_threads)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->max_threads = MPMAX(pool->max_threads, max_threads);
+    pthread_mutex_unlock(&pool->lock);
+}
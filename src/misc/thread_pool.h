@@ -31,4 +31,9 @@ bool mp_thread_pool_queue(struct mp_thread_pool *pool, void (*fn)(void *ctx),
 bool mp_thread_pool_run(struct mp_thread_pool *pool, void (*fn)(void *ctx),
                         void *fn_ctx);
 
+// Raise the maximum number of worker threads to max_threads (never lowers it).
+// Threads are still created on demand.
+// This function is explicitly thread-safe.
+void mp_thread_pool_grow(struct mp_thread_pool *pool, int max_threads);
+
 #endif
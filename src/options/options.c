@@ -66,6 +66,7 @@ extern const struct m_sub_options demux_cue_conf;
 extern const struct m_sub_options vd_lavc_conf;
 extern const struct m_sub_options vd_omap_dce_conf;
 extern const struct m_sub_options ad_lavc_conf;
+extern const struct m_sub_options decoder_pool_conf;
 extern const struct m_sub_options input_config;
 extern const struct m_sub_options encode_config;
 extern const struct m_sub_options ra_ctx_conf;
@@ -173,6 +174,8 @@ static const m_option_t mp_vo_opt_list[] = {
         {"display-desync", VS_DISP_NONE},
         {"desync", VS_NONE})},
     {"swapchain-depth", OPT_INT(swapchain_depth), M_RANGE(1, VO_MAX_SWAPCHAIN_DEPTH)},
+    {"vo-render-ahead", OPT_INT(render_ahead), M_RANGE(0, VO_MAX_SWAPCHAIN_DEPTH)},
+    {"vo-frame-trace", OPT_INT(frame_trace_size), M_RANGE(0, 100000)},
     {0}
 };
 
@@ -352,6 +355,9 @@ const struct m_sub_options dvd_conf = {
 const struct m_sub_options filter_conf = {
     .opts = (const struct m_option[]){
         {"deinterlace", OPT_BOOL(deinterlace)},
+        {"filter-threads", OPT_INT(filter_threads), M_RANGE(0, 16)},
+        {"filter-profile", OPT_BOOL(profile)},
+        {"hwdownload-map", OPT_BOOL(hwdownload_map)},
         {0}
     },
     .size = sizeof(OPT_BASE_STRUCT),
@@ -501,6 +507,7 @@ static const m_option_t mp_opts[] = {
     {"demuxer-termination-timeout", OPT_DOUBLE(demux_termination_timeout)},
     {"demuxer-cache-wait", OPT_BOOL(demuxer_cache_wait)},
     {"prefetch-playlist", OPT_BOOL(prefetch_open)},
+    {"prefetch-playlist-count", OPT_INT(prefetch_count), M_RANGE(1, 16)},
     {"cache-pause", OPT_BOOL(cache_pause)},
     {"cache-pause-initial", OPT_BOOL(cache_pause_initial)},
     {"cache-pause-wait", OPT_FLOAT(cache_pause_wait), M_RANGE(0, DBL_MAX)},
@@ -537,6 +544,7 @@ static const m_option_t mp_opts[] = {
     {"", OPT_SUBSTRUCT(filter_opts, filter_conf)},
 
     {"", OPT_SUBSTRUCT(dec_wrapper, dec_wrapper_conf)},
+    {"", OPT_SUBSTRUCT(decoder_pool_opts, decoder_pool_conf)},
     {"", OPT_SUBSTRUCT(vd_lavc_params, vd_lavc_conf)},
 #if HAVE_OMAP_DCE
     {"", OPT_SUBSTRUCT(vd_omap_dce_params, vd_omap_dce_conf)},
@@ -612,6 +620,7 @@ static const m_option_t mp_opts[] = {
         {"no", 0},
         {"yes", 1},
         {"weak", -1})},
+    {"gapless-video", OPT_BOOL(gapless_video)},
 
     {"title", OPT_STRING(wintitle)},
     {"force-media-title", OPT_STRING(media_title)},
@@ -644,7 +653,15 @@ static const m_option_t mp_opts[] = {
         {"no", 0},
         {"vo", 1},
         {"decoder", 2},
-        {"decoder+vo", 3})},
+        {"decoder+vo", 3},
+        {"decoder-adaptive", 4},
+        {"decoder-adaptive+vo", 5})},
+    {"video-keyframes-only", OPT_CHOICE(video_keyframes_only,
+        {"no", 0},
+        {"yes", 1},
+        {"auto", 2})},
+    {"video-keyframes-only-speed", OPT_DOUBLE(video_keyframes_only_speed),
+        M_RANGE(1, 100.0)},
     {"video-latency-hacks", OPT_BOOL(video_latency_hacks)},
 
     {"untimed", OPT_BOOL(untimed)},
@@ -727,6 +744,14 @@ static const m_option_t mp_opts[] = {
 
     {"input-ipc-server", OPT_STRING(ipc_path), .flags = M_OPT_FILE},
     {"input-ipc-client", OPT_STRING(ipc_client)},
+    {"input-ipc-property-rate", OPT_DOUBLE(ipc_property_rate),
+        M_RANGE(0, 1000)},
+    {"playback-shm", OPT_STRING(playback_shm)},
+    {"client-property-snapshot", OPT_BOOL(client_property_snapshot)},
+    {"playloop-trace", OPT_BOOL(playloop_trace)},
+    {"playloop-trace-interval", OPT_DOUBLE(playloop_trace_interval),
+        M_RANGE(0, 3600)},
+    {"tickless-idle", OPT_BOOL(tickless_idle)},
 
     {"screenshot", OPT_SUBSTRUCT(screenshot_image_opts, screenshot_conf)},
     {"screenshot-template", OPT_STRING(screenshot_template)},
@@ -917,6 +942,8 @@ static const struct MPOpts mp_default_opts = {
     .position_resume = true,
     .autoload_files = true,
     .demuxer_thread = true,
+    .prefetch_count = 1,
+    .playloop_trace_interval = 10,
     .demux_termination_timeout = 0.1,
     .hls_bitrate = INT_MAX,
     .cache_pause = true,
@@ -927,6 +954,7 @@ static const struct MPOpts mp_default_opts = {
     .default_max_pts_correction = -1,
     .initial_audio_sync = true,
     .frame_dropping = 1,
+    .video_keyframes_only_speed = 8.0,
     .term_osd = 2,
     .term_osd_bar_chars = "[-+-]",
     .consolecontrols = true,
@@ -72,6 +72,9 @@ typedef struct mp_vo_opts {
     struct m_geometry android_surface_size;
 
     int swapchain_depth;  // max number of images to render ahead
+    int render_ahead;     // frames rendered while a flip is pending (0: sync)
+
+    int frame_trace_size; // number of frames kept by the latency tracer
 } mp_vo_opts;
 
 // Subtitle options needed by the subtitle decoders/renderers.
@@ -174,6 +177,7 @@ typedef struct MPOpts {
     int softvol_mute;
     float softvol_max;
     int gapless_audio;
+    bool gapless_video;
 
     mp_vo_opts *vo;
     struct ao_opts *ao_opts;
@@ -227,6 +231,8 @@ typedef struct MPOpts {
     float default_max_pts_correction;
     int autosync;
     int frame_dropping;
+    int video_keyframes_only;
+    double video_keyframes_only_speed;
     bool video_latency_hacks;
     int term_osd;
     bool term_osd_bar;
@@ -277,6 +283,7 @@ typedef struct MPOpts {
     double demux_termination_timeout;
     bool demuxer_cache_wait;
     bool prefetch_open;
+    int prefetch_count;
     char *audio_demuxer_name;
     char *sub_demuxer_name;
 
@@ -300,6 +307,7 @@ typedef struct MPOpts {
     struct m_obj_settings *af_settings, *af_defs;
     struct filter_opts *filter_opts;
     struct dec_wrapper_opts *dec_wrapper;
+    struct decoder_pool_opts *decoder_pool_opts;
     char **sub_name;
     char **sub_paths;
     char **audiofile_paths;
@@ -348,6 +356,12 @@ typedef struct MPOpts {
 
     char *ipc_path;
     char *ipc_client;
+    double ipc_property_rate;
+    char *playback_shm;
+    bool client_property_snapshot;
+    bool playloop_trace;
+    double playloop_trace_interval;
+    bool tickless_idle;
 
     int wingl_dwm_flush;
 
@@ -382,6 +396,9 @@ struct dvd_opts {
 
 struct filter_opts {
     bool deinterlace;
+    int filter_threads;
+    bool profile;
+    bool hwdownload_map;
 };
 
 extern const struct m_sub_options vo_sub_opts;
@@ -442,7 +442,7 @@ static int reinit_audio_filters_and_output(struct MPContext *mpctx)
 
     mpctx->ao_filter_fmt = out_fmt;
 
-    mpctx->ao = ao_init_best(mpctx->global, ao_flags, mp_wakeup_core_cb,
+    mpctx->ao = ao_init_best(mpctx->global, ao_flags, mp_wakeup_core_ao_cb,
                              mpctx, mpctx->encode_lavc_ctx, out_rate,
                              out_format, out_channels);
 
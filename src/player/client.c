@@ -61,6 +61,17 @@
  *
  */
 
+// Properties that mpv_get_property() can read from the snapshot. They must
+// all send change notifications (mp_notify_property() or the event lists in
+// command.c), or the snapshot would return outdated values.
+static const char *const snapshot_props[] = {
+    "pause", "speed", "volume", "mute", "time-pos", "playback-time",
+    "percent-pos", "time-remaining", "duration", "seeking", "core-idle",
+    "idle-active", "eof-reached", "paused-for-cache", "filename", "path",
+    "media-title", "playlist-pos", "playlist-count",
+};
+#define NUM_SNAPSHOT_PROPS MP_ARRAY_SIZE(snapshot_props)
+
 struct mp_client_api {
     struct MPContext *mpctx;
 
@@ -83,6 +94,64 @@ struct mp_client_api {
     int num_custom_protocols;
 
     struct mpv_render_context *render_context;
+
+    // Leaf lock; may be taken while holding any other lock.
+    pthread_mutex_t prop_cache_lock;
+    // -- protected by prop_cache_lock (the array; see prop_cache_entry too)
+    struct prop_cache_entry **prop_cache;
+    int num_prop_cache;
+
+    // Property snapshot (see struct prop_snapshot).
+    // -- immutable
+    int snapshot_ids[NUM_SNAPSHOT_PROPS];           // mp_get_property_id()
+    uint64_t snapshot_event_masks[NUM_SNAPSHOT_PROPS];
+    // -- atomic
+    _Atomic(struct prop_snapshot *) snapshot;       // current, or NULL
+    atomic_int snapshot_readers;    // threads possibly accessing any snapshot
+    mp_atomic_uint64 snapshot_stale; // bit n: snapshot_props[n] changed since
+                                     // the current snapshot was published
+    mp_atomic_uint64 snapshot_dirty; // bit n: snapshot_props[n] needs re-reading
+    // -- accessed by the core thread only
+    struct prop_snapshot **snapshot_retired; // replaced, but maybe still read
+    int num_snapshot_retired;
+};
+
+// Last value of a property (with a given format) fetched for an observer. All
+// observers of the same property share it, so it's read only once per change,
+// no matter how many clients observe it.
+struct prop_cache_entry {
+    // -- immutable
+    struct mp_client_api *clients;
+    char *name;
+    int id;                 // ==mp_get_property_id(name)
+    mpv_format format;
+    const struct m_option *type;
+    // -- protected by clients->prop_cache_lock
+    int users;              // number of observe_property referencing it
+    uint64_t version;       // incremented on each change notification
+    // -- accessed by the core thread only (mp_client_send_property_changes())
+    uint64_t value_version; // version the value was read at (0: not yet read)
+    int status;             // result of reading the value
+    union m_option_value value;
+};
+
+struct prop_snapshot_entry {
+    int node_status;        // M_PROPERTY_GET_NODE result
+    struct mpv_node node;
+    int string_status;      // M_PROPERTY_GET_STRING result
+    char *string;
+};
+
+// Values of snapshot_props[], read by the core thread and published with an
+// atomic pointer swap, so that clients polling them don't need to lock the
+// core (--client-property-snapshot). A snapshot is never modified after it has
+// been published. Replaced snapshots are freed by the core thread once no
+// reader is active (mp_client_api.snapshot_readers). Values that change on
+// every tick (like time-pos) are as recent as the last playloop iteration, the
+// same as with property observation; other properties are marked stale on
+// change notification, and read through the core until the next snapshot.
+struct prop_snapshot {
+    struct prop_snapshot_entry entries[NUM_SNAPSHOT_PROPS];
 };
 
 struct observe_property {
@@ -94,6 +163,7 @@ struct observe_property {
     int64_t reply_id;
     mpv_format format;
     const struct m_option *type;
+    struct prop_cache_entry *cache; // NULL if not shared
     // -- protected by owner->lock
     size_t refcount;
     uint64_t change_ts;     // logical timestamp incremented on each change
@@ -165,6 +235,7 @@ struct mpv_handle {
 static bool gen_log_message_event(struct mpv_handle *ctx);
 static bool gen_property_change_event(struct mpv_handle *ctx);
 static void notify_property_events(struct mpv_handle *ctx, int event);
+static void snapshot_notify_event(struct mp_client_api *clients, int event);
 
 // Must be called with prop->owner->lock held.
 static void prop_unref(struct observe_property *prop)
@@ -186,6 +257,15 @@ void mp_clients_init(struct MPContext *mpctx)
     };
     mpctx->global->client_api = mpctx->clients;
     pthread_mutex_init(&mpctx->clients->lock, NULL);
+    pthread_mutex_init(&mpctx->clients->prop_cache_lock, NULL);
+
+    static_assert(NUM_SNAPSHOT_PROPS < 64, "");
+    for (int n = 0; n < NUM_SNAPSHOT_PROPS; n++) {
+        const char *name = snapshot_props[n];
+        mpctx->clients->snapshot_ids[n] = mp_get_property_id(mpctx, name);
+        mpctx->clients->snapshot_event_masks[n] =
+            mp_get_property_event_mask(name);
+    }
 }
 
 void mp_clients_destroy(struct MPContext *mpctx)
@@ -201,6 +281,17 @@ void mp_clients_destroy(struct MPContext *mpctx)
         abort();
     }
 
+    for (int n = 0; n < mpctx->clients->num_prop_cache; n++) {
+        struct prop_cache_entry *e = mpctx->clients->prop_cache[n];
+        assert(!e->users);
+        m_option_free(e->type, &e->value);
+    }
+
+    talloc_free(atomic_load(&mpctx->clients->snapshot));
+    for (int n = 0; n < mpctx->clients->num_snapshot_retired; n++)
+        talloc_free(mpctx->clients->snapshot_retired[n]);
+
+    pthread_mutex_destroy(&mpctx->clients->prop_cache_lock);
     pthread_mutex_destroy(&mpctx->clients->lock);
     talloc_free(mpctx->clients);
     mpctx->clients = NULL;
@@ -771,6 +862,8 @@ void mp_client_broadcast_event(struct MPContext *mpctx, int event, void *data)
 {
     struct mp_client_api *clients = mpctx->clients;
 
+    snapshot_notify_event(clients, event);
+
     pthread_mutex_lock(&clients->lock);
 
     for (int n = 0; n < clients->num_clients; n++) {
@@ -1471,6 +1564,51 @@ static void getproperty_fn(void *arg)
     }
 }
 
+// Read the property from the snapshot if possible, without locking the core.
+// Returns false if the caller has to read it through the core instead.
+static bool get_snapshot_property(struct mp_client_api *clients,
+                                  const char *name, mpv_format format,
+                                  void *data, int *status)
+{
+    if (format == MPV_FORMAT_OSD_STRING)
+        return false;
+
+    int index = -1;
+    for (int n = 0; n < NUM_SNAPSHOT_PROPS; n++) {
+        if (strcmp(snapshot_props[n], name) == 0) {
+            index = n;
+            break;
+        }
+    }
+    if (index < 0 || (atomic_load(&clients->snapshot_stale) & (1ULL << index)))
+        return false;
+
+    bool ok = false;
+    atomic_fetch_add(&clients->snapshot_readers, 1);
+    struct prop_snapshot *snap = atomic_load(&clients->snapshot);
+    if (snap) {
+        struct prop_snapshot_entry *e = &snap->entries[index];
+        int err = e->node_status;
+        // Properties without GET_NODE need the string conversion done by
+        // getproperty_fn().
+        ok = format == MPV_FORMAT_STRING || err != M_PROPERTY_NOT_IMPLEMENTED;
+        if (format == MPV_FORMAT_STRING) {
+            err = e->string_status;
+            if (err == M_PROPERTY_OK)
+                *(char **)data = talloc_strdup(NULL, e->string);
+        } else if (ok && err > 0) {
+            if (format == MPV_FORMAT_NODE) {
+                m_option_copy(get_mp_type(format), data, &e->node);
+            } else if (!conv_node_to_format(data, format, &e->node)) {
+                err = M_PROPERTY_INVALID_FORMAT;
+            }
+        }
+        *status = translate_property_error(err);
+    }
+    atomic_fetch_sub(&clients->snapshot_readers, 1);
+    return ok;
+}
+
 int mpv_get_property(mpv_handle *ctx, const char *name, mpv_format format,
                      void *data)
 {
@@ -1481,6 +1619,10 @@ int mpv_get_property(mpv_handle *ctx, const char *name, mpv_format format,
     if (!get_mp_type_get(format))
         return MPV_ERROR_PROPERTY_FORMAT;
 
+    int status;
+    if (get_snapshot_property(ctx->clients, name, format, data, &status))
+        return status;
+
     struct getproperty_request req = {
         .mpctx = ctx->mpctx,
         .name = name,
@@ -1524,12 +1666,73 @@ int mpv_get_property_async(mpv_handle *ctx, uint64_t ud, const char *name,
     return run_async(ctx, getproperty_fn, req);
 }
 
+static struct prop_cache_entry *prop_cache_ref(struct mp_client_api *clients,
+                                               struct observe_property *prop)
+{
+    if (!prop->type || prop->id < 0)
+        return NULL;
+
+    pthread_mutex_lock(&clients->prop_cache_lock);
+    struct prop_cache_entry *e = NULL;
+    for (int n = 0; n < clients->num_prop_cache; n++) {
+        struct prop_cache_entry *cur = clients->prop_cache[n];
+        if (cur->format == prop->format && strcmp(cur->name, prop->name) == 0) {
+            e = cur;
+            break;
+        }
+    }
+    if (!e) {
+        e = talloc_ptrtype(clients, e);
+        *e = (struct prop_cache_entry){
+            .clients = clients,
+            .name = talloc_strdup(e, prop->name),
+            .id = prop->id,
+            .format = prop->format,
+            .type = prop->type,
+            .version = 1,
+        };
+        MP_TARRAY_APPEND(clients, clients->prop_cache, clients->num_prop_cache, e);
+    }
+    e->users += 1;
+    pthread_mutex_unlock(&clients->prop_cache_lock);
+    return e;
+}
+
+// Entries are only freed by the core thread (see prop_cache_collect()).
+static void prop_cache_unref(struct prop_cache_entry *e)
+{
+    if (!e)
+        return;
+
+    pthread_mutex_lock(&e->clients->prop_cache_lock);
+    assert(e->users > 0);
+    e->users -= 1;
+    pthread_mutex_unlock(&e->clients->prop_cache_lock);
+}
+
+// Free unused entries. Must be called on the core thread.
+static void prop_cache_collect(struct mp_client_api *clients)
+{
+    pthread_mutex_lock(&clients->prop_cache_lock);
+    for (int n = clients->num_prop_cache - 1; n >= 0; n--) {
+        struct prop_cache_entry *e = clients->prop_cache[n];
+        if (!e->users) {
+            m_option_free(e->type, &e->value);
+            talloc_free(e);
+            MP_TARRAY_REMOVE_AT(clients->prop_cache, clients->num_prop_cache, n);
+        }
+    }
+    pthread_mutex_unlock(&clients->prop_cache_lock);
+}
+
 static void property_free(void *p)
 {
     struct observe_property *prop = p;
 
     assert(prop->refcount == 0);
 
+    prop_cache_unref(prop->cache);
+
     if (prop->type) {
         m_option_free(prop->type, &prop->value);
         m_option_free(prop->type, &prop->value_ret);
@@ -1561,6 +1764,7 @@ int mpv_observe_property(mpv_handle *ctx, uint64_t userdata,
         .change_ts = 1, // force initial event
         .refcount = 1,
     };
+    prop->cache = prop_cache_ref(ctx->clients, prop);
     ctx->properties_change_ts += 1;
     MP_TARRAY_APPEND(ctx, ctx->properties, ctx->num_properties, prop);
     ctx->property_event_masks |= prop->event_mask;
@@ -1625,6 +1829,14 @@ void mp_client_property_change(struct MPContext *mpctx, const char *name)
 
     pthread_mutex_lock(&clients->lock);
 
+    pthread_mutex_lock(&clients->prop_cache_lock);
+    for (int n = 0; n < clients->num_prop_cache; n++) {
+        struct prop_cache_entry *e = clients->prop_cache[n];
+        if (e->id == id && property_shared_prefix(name, e->name))
+            e->version += 1;
+    }
+    pthread_mutex_unlock(&clients->prop_cache_lock);
+
     for (int n = 0; n < clients->num_clients; n++) {
         struct mpv_handle *client = clients->clients[n];
         pthread_mutex_lock(&client->lock);
@@ -1641,6 +1853,18 @@ void mp_client_property_change(struct MPContext *mpctx, const char *name)
 
     pthread_mutex_unlock(&clients->lock);
 
+    uint64_t changed = 0;
+    for (int n = 0; n < NUM_SNAPSHOT_PROPS; n++) {
+        if (clients->snapshot_ids[n] == id &&
+            property_shared_prefix(name, snapshot_props[n]))
+            changed |= 1ULL << n;
+    }
+    if (changed) {
+        atomic_fetch_or(&clients->snapshot_stale, changed);
+        atomic_fetch_or(&clients->snapshot_dirty, changed);
+        any_pending |= !!atomic_load(&clients->snapshot);
+    }
+
     // If we're inside mp_dispatch_queue_process(), this will cause the playloop
     // to be re-run (to get mp_client_send_property_changes() called). If we're
     // inside the normal playloop, this does nothing, but the latter function
@@ -1654,18 +1878,133 @@ void mp_client_property_change(struct MPContext *mpctx, const char *name)
 static void notify_property_events(struct mpv_handle *ctx, int event)
 {
     uint64_t mask = 1ULL << event;
+    pthread_mutex_lock(&ctx->clients->prop_cache_lock);
     for (int i = 0; i < ctx->num_properties; i++) {
-        if (ctx->properties[i]->event_mask & mask) {
-            ctx->properties[i]->change_ts += 1;
+        struct observe_property *prop = ctx->properties[i];
+        if (prop->event_mask & mask) {
+            prop->change_ts += 1;
+            if (prop->cache)
+                prop->cache->version += 1;
             ctx->has_pending_properties = true;
         }
     }
+    pthread_mutex_unlock(&ctx->clients->prop_cache_lock);
 
     // Same as in mp_client_property_change().
     if (ctx->has_pending_properties)
         mp_dispatch_adjust_timeout(ctx->mpctx->dispatch, 0);
 }
 
+// Mark snapshot properties changed by the event. Can be called from any thread.
+static void snapshot_notify_event(struct mp_client_api *clients, int event)
+{
+    uint64_t mask = 1ULL << event;
+    uint64_t changed = 0;
+    for (int n = 0; n < NUM_SNAPSHOT_PROPS; n++) {
+        if (clients->snapshot_event_masks[n] & mask)
+            changed |= 1ULL << n;
+    }
+    if (!changed)
+        return;
+
+    atomic_fetch_or(&clients->snapshot_dirty, changed);
+    // Ticks happen too often to send readers to the core each time. The
+    // playloop iteration sending them updates the snapshot at its end anyway.
+    if (event != MPV_EVENT_TICK) {
+        atomic_fetch_or(&clients->snapshot_stale, changed);
+        if (atomic_load(&clients->snapshot))
+            mp_dispatch_adjust_timeout(clients->mpctx->dispatch, 0);
+    }
+}
+
+static void snapshot_destroy(void *ptr)
+{
+    struct prop_snapshot *snap = ptr;
+
+    for (int n = 0; n < NUM_SNAPSHOT_PROPS; n++)
+        mpv_free_node_contents(&snap->entries[n].node);
+}
+
+static void read_snapshot_entry(struct MPContext *mpctx,
+                                struct prop_snapshot *snap, int n)
+{
+    struct prop_snapshot_entry *e = &snap->entries[n];
+    const char *name = snapshot_props[n];
+
+    e->node_status = mp_property_do(name, M_PROPERTY_GET_NODE, &e->node, mpctx);
+    if (e->node_status <= 0)
+        e->node = (struct mpv_node){0};
+
+    char *s = NULL;
+    e->string_status = mp_property_do(name, M_PROPERTY_GET_STRING, &s, mpctx);
+    if (e->string_status == M_PROPERTY_OK)
+        e->string = talloc_steal(snap, s);
+}
+
+static void copy_snapshot_entry(struct prop_snapshot *snap, int n,
+                                struct prop_snapshot *src)
+{
+    struct prop_snapshot_entry *e = &snap->entries[n];
+    struct prop_snapshot_entry *s = &src->entries[n];
+
+    e->node_status = s->node_status;
+    m_option_copy(get_mp_type(MPV_FORMAT_NODE), &e->node, &s->node);
+    e->string_status = s->string_status;
+    e->string = talloc_strdup(snap, s->string);
+}
+
+// Publish a new snapshot if properties changed, and free replaced snapshots
+// that no reader can access anymore. Must be called on the core thread.
+static void update_snapshot(struct mp_client_api *clients)
+{
+    struct MPContext *mpctx = clients->mpctx;
+    struct prop_snapshot *old = atomic_load(&clients->snapshot);
+    struct prop_snapshot *new = NULL;
+    uint64_t stale = 0;
+
+    if (mpctx->opts->client_property_snapshot) {
+        // Re-read stale entries even if their dirty bit isn't set yet (events
+        // from other threads set stale first).
+        stale = atomic_load(&clients->snapshot_stale);
+        uint64_t dirty = atomic_exchange(&clients->snapshot_dirty, 0) | stale;
+        if (!old)
+            dirty = (1ULL << NUM_SNAPSHOT_PROPS) - 1;
+        new = old;
+        if (dirty) {
+            new = talloc_zero(NULL, struct prop_snapshot);
+            talloc_set_destructor(new, snapshot_destroy);
+            for (int n = 0; n < NUM_SNAPSHOT_PROPS; n++) {
+                if (dirty & (1ULL << n)) {
+                    read_snapshot_entry(mpctx, new, n);
+                } else {
+                    copy_snapshot_entry(new, n, old);
+                }
+            }
+        }
+    }
+
+    if (new != old) {
+        atomic_store(&clients->snapshot, new);
+        // Readers check the stale bits before loading the pointer, so they
+        // can't see a cleared bit with the old snapshot.
+        atomic_fetch_and(&clients->snapshot_stale, ~stale);
+        if (old) {
+            MP_TARRAY_APPEND(clients, clients->snapshot_retired,
+                             clients->num_snapshot_retired, old);
+        }
+    }
+
+    // Readers increment the counter before loading the pointer, so if it's 0,
+    // nobody can get a retired snapshot anymore.
+    if (clients->num_snapshot_retired &&
+        !atomic_load(&clients->snapshot_readers))
+    {
+        for (int n = 0; n < clients->num_snapshot_retired; n++)
+            talloc_free(clients->snapshot_retired[n]);
+        clients->num_snapshot_retired = 0;
+    }
+}
+
 // Call with ctx->lock held (only). May temporarily drop the lock.
 static void send_client_property_changes(struct mpv_handle *ctx)
 {
@@ -1682,6 +2021,7 @@ static void send_client_property_changes(struct mpv_handle *ctx)
         bool changed = false;
         if (prop->format) {
             const struct m_option *type = prop->type;
+            struct prop_cache_entry *e = prop->cache;
             union m_option_value val = {0};
             struct getproperty_request req = {
                 .mpctx = ctx->mpctx,
@@ -1690,41 +2030,71 @@ static void send_client_property_changes(struct mpv_handle *ctx)
                 .data = &val,
             };
 
-            // Temporarily unlock and read the property. The very important
-            // thing is that property getters can do whatever they want, _and_
-            // that they may wait on the client API user thread (if vo_libmpv
-            // or similar things are involved).
-            prop->refcount += 1; // keep prop alive (esp. prop->name)
-            ctx->async_counter += 1; // keep ctx alive
-            pthread_mutex_unlock(&ctx->lock);
-            getproperty_fn(&req);
-            pthread_mutex_lock(&ctx->lock);
-            ctx->async_counter -= 1;
-            prop_unref(prop);
+            // If another client already read the value since the last change
+            // notification, use that. Initial values are always read, as not
+            // all properties send change notifications.
+            uint64_t version = 0;
+            if (e) {
+                pthread_mutex_lock(&ctx->clients->prop_cache_lock);
+                version = e->version;
+                pthread_mutex_unlock(&ctx->clients->prop_cache_lock);
+            }
+            bool cached = e && prop->value_ts && e->value_version == version;
 
-            // Set if observed properties was changed or something similar
-            // => start over, retry next time.
-            if (cur_ts != ctx->properties_change_ts || ctx->destroying) {
-                m_option_free(type, &val);
-                mp_wakeup_core(ctx->mpctx);
-                ctx->has_pending_properties = true;
-                break;
+            if (cached) {
+                req.status = e->status;
+            } else {
+                // Temporarily unlock and read the property. The very important
+                // thing is that property getters can do whatever they want,
+                // _and_ that they may wait on the client API user thread (if
+                // vo_libmpv or similar things are involved).
+                prop->refcount += 1; // keep prop alive (esp. prop->name)
+                ctx->async_counter += 1; // keep ctx alive
+                pthread_mutex_unlock(&ctx->lock);
+                getproperty_fn(&req);
+                pthread_mutex_lock(&ctx->lock);
+                ctx->async_counter -= 1;
+                prop_unref(prop);
+
+                // Set if observed properties was changed or something similar
+                // => start over, retry next time.
+                if (cur_ts != ctx->properties_change_ts || ctx->destroying) {
+                    m_option_free(type, &val);
+                    mp_wakeup_core(ctx->mpctx);
+                    ctx->has_pending_properties = true;
+                    break;
+                }
+                assert(prop->refcount > 0);
+
+                if (e) {
+                    // Changes during the read bumped the version further, so
+                    // they will cause another read.
+                    m_option_free(type, &e->value);
+                    e->status = req.status;
+                    if (req.status >= 0)
+                        m_option_copy(type, &e->value, &val);
+                    e->value_version = version;
+                }
             }
-            assert(prop->refcount > 0);
+            union m_option_value *new_val = cached ? &e->value : &val;
 
             bool val_valid = req.status >= 0;
             changed = prop->value_valid != val_valid;
             if (prop->value_valid && val_valid)
-                changed = !equal_mpv_value(&prop->value, &val, prop->format);
+                changed = !equal_mpv_value(&prop->value, new_val, prop->format);
             if (prop->value_ts == 0)
                 changed = true; // initial event
 
             prop->value_valid = val_valid;
             if (changed && val_valid) {
-                // move val to prop->value
                 m_option_free(type, &prop->value);
-                memcpy(&prop->value, &val, type->type->size);
-                memset(&val, 0, type->type->size);
+                if (cached) {
+                    m_option_copy(type, &prop->value, new_val);
+                } else {
+                    // move val to prop->value
+                    memcpy(&prop->value, &val, type->type->size);
+                    memset(&val, 0, type->type->size);
+                }
             }
 
             m_option_free(prop->type, &val);
@@ -1755,6 +2125,9 @@ void mp_client_send_property_changes(struct MPContext *mpctx)
 {
     struct mp_client_api *clients = mpctx->clients;
 
+    update_snapshot(clients);
+    prop_cache_collect(clients);
+
     pthread_mutex_lock(&clients->lock);
     uint64_t cur_ts = clients->clients_list_change_ts;
 
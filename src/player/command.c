@@ -61,7 +61,10 @@
 #include "audio/format.h"
 #include "audio/out/ao.h"
 #include "video/out/bitmap_packer.h"
+#include "video/out/frame_trace.h"
 #include "options/path.h"
+#include "playback_shm.h"
+#include "playloop_trace.h"
 #include "screenshot.h"
 #include "misc/dispatch.h"
 #include "misc/node.h"
@@ -1699,7 +1702,7 @@ static void create_hotplug(struct MPContext *mpctx)
     struct command_ctx *cmd = mpctx->command_ctx;
 
     if (!cmd->hotplug) {
-        cmd->hotplug = ao_hotplug_create(mpctx->global, mp_wakeup_core_cb,
+        cmd->hotplug = ao_hotplug_create(mpctx->global, mp_wakeup_core_ao_cb,
                                          mpctx);
     }
 }
@@ -2605,6 +2608,54 @@ out:
     return ret;
 }
 
+static int mp_property_vo_frame_trace(void *ctx, struct m_property *prop,
+                                      int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->video_out)
+        return M_PROPERTY_UNAVAILABLE;
+
+    switch (action) {
+    case M_PROPERTY_GET_TYPE:
+        *(struct m_option *)arg = (struct m_option){.type = CONF_TYPE_NODE};
+        return M_PROPERTY_OK;
+    case M_PROPERTY_GET: {
+        struct mp_frame_trace *trace = vo_get_frame_trace(mpctx->video_out, NULL);
+        if (!trace)
+            return M_PROPERTY_UNAVAILABLE;
+        mp_frame_trace_get_node(trace, (struct mpv_node *)arg);
+        talloc_free(trace);
+        return M_PROPERTY_OK;
+    }
+    }
+    return M_PROPERTY_NOT_IMPLEMENTED;
+}
+
+static int mp_property_playloop_wakeup_rate(void *ctx, struct m_property *prop,
+                                            int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    return m_property_double_ro(action, arg, get_wakeup_rate(mpctx));
+}
+
+static int mp_property_playloop_trace(void *ctx, struct m_property *prop,
+                                      int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->playloop_trace)
+        return M_PROPERTY_UNAVAILABLE;
+
+    switch (action) {
+    case M_PROPERTY_GET_TYPE:
+        *(struct m_option *)arg = (struct m_option){.type = CONF_TYPE_NODE};
+        return M_PROPERTY_OK;
+    case M_PROPERTY_GET:
+        mp_playloop_trace_get_node(mpctx, (struct mpv_node *)arg);
+        return M_PROPERTY_OK;
+    }
+    return M_PROPERTY_NOT_IMPLEMENTED;
+}
+
 static int mp_property_perf_info(void *ctx, struct m_property *p, int action,
                                  void *arg)
 {
@@ -2622,6 +2673,24 @@ static int mp_property_perf_info(void *ctx, struct m_property *p, int action,
     return M_PROPERTY_NOT_IMPLEMENTED;
 }
 
+static int mp_property_filter_stats(void *ctx, struct m_property *p,
+                                    int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+
+    switch (action) {
+    case M_PROPERTY_GET_TYPE:
+        *(struct m_option *)arg = (struct m_option){.type = CONF_TYPE_NODE};
+        return M_PROPERTY_OK;
+    case M_PROPERTY_GET: {
+        stats_global_query_values(mpctx->global, "filter/",
+                                  (struct mpv_node *)arg);
+        return M_PROPERTY_OK;
+    }
+    }
+    return M_PROPERTY_NOT_IMPLEMENTED;
+}
+
 static int mp_property_vo(void *ctx, struct m_property *p, int action, void *arg)
 {
     MPContext *mpctx = ctx;
@@ -3857,7 +3926,11 @@ static const struct m_property mp_properties_base[] = {
     {"current-window-scale", mp_property_current_window_scale},
     {"vo-configured", mp_property_vo_configured},
     {"vo-passes", mp_property_vo_passes},
+    {"vo-frame-trace", mp_property_vo_frame_trace},
     {"perf-info", mp_property_perf_info},
+    {"playloop-trace", mp_property_playloop_trace},
+    {"playloop-wakeup-rate", mp_property_playloop_wakeup_rate},
+    {"filter-stats", mp_property_filter_stats},
     {"current-vo", mp_property_vo},
     {"container-fps", mp_property_fps},
     {"estimated-vf-fps", mp_property_vf_fps},
@@ -6218,6 +6291,31 @@ static void run_dump_cmd(struct mp_cmd_ctx *cmd, double start, double end,
     cache_dump_poll(mpctx);
 }
 
+static void cmd_dump_frame_trace(void *p)
+{
+    struct mp_cmd_ctx *cmd = p;
+    struct MPContext *mpctx = cmd->mpctx;
+    char *filename = cmd->args[0].v.s;
+
+    struct mp_frame_trace *trace = mpctx->video_out ?
+        vo_get_frame_trace(mpctx->video_out, NULL) : NULL;
+    if (!trace) {
+        mp_cmd_msg(cmd, MSGL_ERR, "Frame tracing is not enabled "
+                   "(use --vo-frame-trace).");
+        cmd->success = false;
+        return;
+    }
+
+    if (filename && filename[0]) {
+        char *path = mp_get_user_path(NULL, mpctx->global, filename);
+        cmd->success = mp_frame_trace_dump(trace, mpctx->log, path);
+        talloc_free(path);
+    } else {
+        cmd->success = mp_frame_trace_dump(trace, mpctx->log, NULL);
+    }
+    talloc_free(trace);
+}
+
 static void cmd_dump_cache(void *p)
 {
     struct mp_cmd_ctx *cmd = p;
@@ -6671,6 +6769,9 @@ const struct mp_cmd_def mp_cmds[] = {
 
     { "ab-loop-align-cache", cmd_align_cache_ab },
 
+    { "dump-frame-trace", cmd_dump_frame_trace,
+        {{"filename", OPT_STRING(v.s), .flags = MP_CMD_OPT_ARG}} },
+
     {0}
 };
 
@@ -6883,6 +6984,15 @@ void mp_option_change_callback(void *ctx, struct m_config_option *co, int flags,
         mpctx->ipc_ctx = mp_init_ipc(mpctx->clients, mpctx->global);
     }
 
+    if (opt_ptr == &opts->ipc_property_rate)
+        mp_ipc_set_property_rate(mpctx->ipc_ctx, opts->ipc_property_rate);
+
+    if (init || opt_ptr == &opts->playback_shm)
+        mp_playback_shm_update_opts(mpctx);
+
+    if (init || opt_ptr == &opts->playloop_trace)
+        mp_playloop_trace_update_opts(mpctx);
+
     if (opt_ptr == &opts->vo->video_driver_list) {
         struct track *track = mpctx->current_track[0][STREAM_VIDEO];
         uninit_video_out(mpctx);
@@ -6915,9 +7025,14 @@ void mp_option_change_callback(void *ctx, struct m_config_option *co, int flags,
 
     if (opt_ptr == &opts->playback_speed) {
         update_playback_speed(mpctx);
+        update_video_keyframes_only(mpctx);
         mp_wakeup_core(mpctx);
     }
 
+    if (opt_ptr == &opts->video_keyframes_only ||
+        opt_ptr == &opts->video_keyframes_only_speed)
+        update_video_keyframes_only(mpctx);
+
     if (opt_ptr == &opts->play_dir) {
         if (mpctx->play_dir != opts->play_dir) {
             queue_seek(mpctx, MPSEEK_ABSOLUTE, get_current_time(mpctx),
@@ -171,6 +171,12 @@ struct vo_chain {
 
     bool underrun;
     bool underrun_signaled;
+
+    // Fraction of a frame drop accumulated by the adaptive framedropper.
+    double drop_acc;
+
+    // Decoder for the next file (--gapless-video), or NULL.
+    struct video_primer *primer;
 };
 
 // Like vo_chain, for audio.
@@ -205,6 +211,18 @@ struct ao_chain {
     bool underrun;      // for cache pause logic
 };
 
+// Origin of a core wakeup, see mp_wakeup_core_from().
+enum mp_wakeup_source {
+    MP_WAKEUP_OTHER,        // mp_wakeup_core()
+    MP_WAKEUP_LOCK,         // mp_dispatch_lock() (client API, scripts)
+    MP_WAKEUP_INPUT,
+    MP_WAKEUP_DEMUX,
+    MP_WAKEUP_FILTERS,
+    MP_WAKEUP_AO,
+    MP_WAKEUP_VO,
+    MP_WAKEUP_SOURCE_COUNT
+};
+
 /* Note that playback can be paused, stopped, etc. at any time. While paused,
  * playback restart is still active, because you want seeking to work even
  * if paused.
@@ -316,6 +334,9 @@ typedef struct MPContext {
     struct ao_chain *ao_chain;
 
     struct vo_chain *vo_chain;
+    // Video chain of the previous file, kept for the next (--gapless-video).
+    // filter_root is kept along with it.
+    struct vo_chain *kept_vo_chain;
 
     struct vo *video_out;
     // next_frame[0] is the next frame, next_frame[1] the one after that.
@@ -379,10 +400,16 @@ typedef struct MPContext {
     int num_past_frames;
 
     double last_idle_tick;
+    double last_tick_pts;  // playback_pts at the last --tickless-idle tick
     double next_cache_update;
 
     double sleeptime;      // number of seconds to sleep before next iteration
 
+    // See get_wakeup_rate().
+    double wakeup_rate_start;   // mp_time_sec() at start of the current window
+    uint64_t wakeup_rate_count; // mp_wait_events() returns in it
+    double wakeup_rate;         // wakeups per second in the last window
+
     double mouse_timer;
     unsigned int mouse_event_ts;
     bool mouse_cursor_visible;
@@ -430,6 +457,12 @@ typedef struct MPContext {
     struct encode_lavc_context *encode_lavc_ctx;
 
     struct mp_ipc_ctx *ipc_ctx;
+    struct playback_shm *playback_shm;
+    struct playloop_trace *playloop_trace;
+
+    // Updated by mp_record_wakeup() from any thread.
+    mp_atomic_uint64 wakeup_counts[MP_WAKEUP_SOURCE_COUNT];
+    atomic_uint wakeup_pending; // bit per source since the last trace update
 
     int64_t builtin_script_ids[5];
 
@@ -441,20 +474,10 @@ typedef struct MPContext {
     bool abort_all; // during final termination
 
     // --- Owned by MPContext
-    pthread_t open_thread;
-    bool open_active; // open_thread is a valid thread handle, all setup
-    atomic_bool open_done;
-    // --- All fields below are immutable while open_active is true.
-    //     Otherwise, they're owned by MPContext.
-    struct mp_cancel *open_cancel;
-    char *open_url;
-    char *open_format;
-    int open_url_flags;
-    bool open_for_prefetch;
-    // --- All fields below are owned by open_thread, unless open_done was set
-    //     to true.
-    struct demuxer *open_res_demuxer;
-    int open_res_error;
+    // Asynchronous opens of the current and upcoming playlist entries (see
+    // loadfile.c). Each has its own thread, so they all probe concurrently.
+    struct mp_opener **openers;
+    int num_openers;
 
     bool is_4k;
     bool is_2398;
@@ -588,10 +611,17 @@ void set_osd_bar_chapters(struct MPContext *mpctx, int type);
 void mp_wait_events(struct MPContext *mpctx);
 void mp_set_timeout(struct MPContext *mpctx, double sleeptime);
 void mp_wakeup_core(struct MPContext *mpctx);
+void mp_wakeup_core_from(struct MPContext *mpctx, enum mp_wakeup_source src);
+void mp_record_wakeup(struct MPContext *mpctx, enum mp_wakeup_source src);
 void mp_wakeup_core_cb(void *ctx);
+void mp_wakeup_core_input_cb(void *ctx);
+void mp_wakeup_core_filters_cb(void *ctx);
+void mp_wakeup_core_ao_cb(void *ctx);
+void mp_wakeup_core_vo_cb(void *ctx);
 void mp_core_lock(struct MPContext *mpctx);
 void mp_core_unlock(struct MPContext *mpctx);
 double get_relative_time(struct MPContext *mpctx);
+double get_wakeup_rate(struct MPContext *mpctx);
 void reset_playback_state(struct MPContext *mpctx);
 void set_pause_state(struct MPContext *mpctx, bool user_pause);
 void update_internal_pause_state(struct MPContext *mpctx);
@@ -659,8 +689,13 @@ void reinit_video_chain_src(struct MPContext *mpctx, struct track *track);
 int reinit_video_filters(struct MPContext *mpctx);
 void write_video(struct MPContext *mpctx);
 void mp_force_video_refresh(struct MPContext *mpctx);
+void update_video_keyframes_only(struct MPContext *mpctx);
 void uninit_video_out(struct MPContext *mpctx);
 void uninit_video_chain(struct MPContext *mpctx);
+bool keep_video_chain(struct MPContext *mpctx);
+void uninit_kept_video_chain(struct MPContext *mpctx);
+void prime_next_video(struct MPContext *mpctx, struct demuxer *demuxer);
+void drop_video_primer(struct MPContext *mpctx, struct demuxer *demuxer);
 double calc_average_frame_duration(struct MPContext *mpctx);
 int init_video_decoder(struct MPContext *mpctx, struct track *track);
 
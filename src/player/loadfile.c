@@ -61,13 +61,14 @@
 
 #include "core.h"
 #include "command.h"
+#include "playback_shm.h"
 #include "libmpv/client.h"
 
 // Called from the demuxer thread if a new packet is available, or other changes.
 static void wakeup_demux(void *pctx)
 {
     struct MPContext *mpctx = pctx;
-    mp_wakeup_core(mpctx);
+    mp_wakeup_core_from(mpctx, MP_WAKEUP_DEMUX);
 }
 
 // Called by foreign threads when playback should be stopped and such.
@@ -193,6 +194,8 @@ static void kill_demuxers_reentrant(struct MPContext *mpctx,
 
 static void uninit_demuxer(struct MPContext *mpctx)
 {
+    drop_video_primer(mpctx, mpctx->demuxer);
+
     for (int t = 0; t < STREAM_TYPE_COUNT; t++) {
         for (int r = 0; r < num_ptracks[t]; r++)
             mpctx->current_track[r][t] = NULL;
@@ -1159,153 +1162,268 @@ static void load_per_file_options(m_config_t *conf,
     }
 }
 
+// Maximum for --prefetch-playlist-count.
+#define MAX_PREFETCH_ENTRIES 16
+
+struct mp_opener {
+    struct MPContext *mpctx;
+    pthread_t thread;
+    atomic_bool done;
+    // Set by the core to make the thread start packet readahead once opened.
+    atomic_bool readahead;
+    // --- All fields below are immutable while the thread is running.
+    struct mp_cancel *cancel;
+    char *url;
+    char *format;
+    int url_flags;
+    // --- All fields below are owned by the thread, unless done was set.
+    struct demuxer *res_demuxer;
+    int res_error;
+    bool readahead_started;
+};
+
+// Select all tracks and start reading packets in the background. Called by
+// whoever owns the demuxer at this point.
+static void start_readahead(struct mp_opener *o)
+{
+    struct demuxer *demux = o->res_demuxer;
+
+    o->readahead_started = true;
+    if (demux->fully_read)
+        return;
+
+    int num_streams = demux_get_num_stream(demux);
+    for (int n = 0; n < num_streams; n++) {
+        struct sh_stream *sh = demux_get_stream(demux, n);
+        demuxer_select_track(demux, sh, MP_NOPTS_VALUE, true);
+    }
+
+    demux_set_wakeup_cb(demux, wakeup_demux, o->mpctx);
+    demux_start_thread(demux);
+    demux_start_prefetch(demux);
+}
+
 static void *open_demux_thread(void *ctx)
 {
-    struct MPContext *mpctx = ctx;
+    struct mp_opener *o = ctx;
+    struct MPContext *mpctx = o->mpctx;
 
     mpthread_set_name("opener");
 
     struct demuxer_params p = {
-        .force_format = mpctx->open_format,
-        .stream_flags = mpctx->open_url_flags,
+        .force_format = o->format,
+        .stream_flags = o->url_flags,
         .stream_record = true,
         .is_top_level = true,
     };
-    struct demuxer *demux =
-        demux_open_url(mpctx->open_url, &p, mpctx->open_cancel, mpctx->global);
-    mpctx->open_res_demuxer = demux;
+    struct demuxer *demux = demux_open_url(o->url, &p, o->cancel, mpctx->global);
+    o->res_demuxer = demux;
 
     if (demux) {
-        MP_VERBOSE(mpctx, "Opening done: %s\n", mpctx->open_url);
+        MP_VERBOSE(mpctx, "Opening done: %s\n", o->url);
 
-        if (mpctx->open_for_prefetch && !demux->fully_read) {
-            int num_streams = demux_get_num_stream(demux);
-            for (int n = 0; n < num_streams; n++) {
-                struct sh_stream *sh = demux_get_stream(demux, n);
-                demuxer_select_track(demux, sh, MP_NOPTS_VALUE, true);
-            }
-
-            demux_set_wakeup_cb(demux, wakeup_demux, mpctx);
-            demux_start_thread(demux);
-            demux_start_prefetch(demux);
-        }
+        if (atomic_load(&o->readahead))
+            start_readahead(o);
     } else {
-        MP_VERBOSE(mpctx, "Opening failed or was aborted: %s\n", mpctx->open_url);
+        MP_VERBOSE(mpctx, "Opening failed or was aborted: %s\n", o->url);
 
         if (p.demuxer_failed) {
-            mpctx->open_res_error = MPV_ERROR_UNKNOWN_FORMAT;
+            o->res_error = MPV_ERROR_UNKNOWN_FORMAT;
         } else {
-            mpctx->open_res_error = MPV_ERROR_LOADING_FAILED;
+            o->res_error = MPV_ERROR_LOADING_FAILED;
         }
     }
 
-    atomic_store(&mpctx->open_done, true);
+    atomic_store(&o->done, true);
     mp_wakeup_core(mpctx);
     return NULL;
 }
 
-static void cancel_open(struct MPContext *mpctx)
+// Abort the opener, wait for its thread, and free it.
+static void free_opener(struct mp_opener *o)
 {
-    if (mpctx->open_cancel)
-        mp_cancel_trigger(mpctx->open_cancel);
+    mp_cancel_trigger(o->cancel);
+    pthread_join(o->thread, NULL);
 
-    if (mpctx->open_active)
-        pthread_join(mpctx->open_thread, NULL);
-    mpctx->open_active = false;
+    if (o->res_demuxer) {
+        drop_video_primer(o->mpctx, o->res_demuxer);
+        demux_cancel_and_free(o->res_demuxer);
+    }
 
-    if (mpctx->open_res_demuxer)
-        demux_cancel_and_free(mpctx->open_res_demuxer);
-    mpctx->open_res_demuxer = NULL;
+    talloc_free(o);
+}
 
-    TA_FREEP(&mpctx->open_cancel);
-    TA_FREEP(&mpctx->open_url);
-    TA_FREEP(&mpctx->open_format);
+static void remove_opener(struct MPContext *mpctx, struct mp_opener *o)
+{
+    int idx = -1;
+    for (int n = 0; n < mpctx->num_openers; n++) {
+        if (mpctx->openers[n] == o)
+            idx = n;
+    }
+    assert(idx >= 0);
+    MP_TARRAY_REMOVE_AT(mpctx->openers, mpctx->num_openers, idx);
+    free_opener(o);
+}
 
-    atomic_store(&mpctx->open_done, false);
+static void cancel_open(struct MPContext *mpctx)
+{
+    while (mpctx->num_openers)
+        remove_opener(mpctx, mpctx->openers[mpctx->num_openers - 1]);
+    TA_FREEP(&mpctx->openers);
 }
 
-// Setup all the field to open this url, and make sure a thread is running.
-static void start_open(struct MPContext *mpctx, char *url, int url_flags,
-                       bool for_prefetch)
+static struct mp_opener *find_opener(struct MPContext *mpctx, const char *url)
 {
-    cancel_open(mpctx);
+    for (int n = 0; n < mpctx->num_openers; n++) {
+        if (strcmp(mpctx->openers[n]->url, url) == 0)
+            return mpctx->openers[n];
+    }
+    return NULL;
+}
 
-    assert(!mpctx->open_active);
-    assert(!mpctx->open_cancel);
-    assert(!mpctx->open_res_demuxer);
-    assert(!atomic_load(&mpctx->open_done));
+// Collect up to --prefetch-playlist-count entries with a filename, starting
+// with first. Returns the number of entries written to entries[].
+static int get_prefetch_entries(struct MPContext *mpctx,
+                                struct playlist_entry *first,
+                                struct playlist_entry **entries, int max)
+{
+    struct MPOpts *opts = mpctx->opts;
+    int count = MPMIN(opts->prefetch_count, max);
+    if (!opts->prefetch_open && !opts->gapless_video)
+        count = 0;
+    int num = 0;
+    for (struct playlist_entry *e = first; e && num < count;
+         e = playlist_entry_get_rel(e, +1))
+    {
+        if (e->filename)
+            entries[num++] = e;
+    }
+    return num;
+}
 
-    mpctx->open_cancel = mp_cancel_new(NULL);
-    mpctx->open_url = talloc_strdup(NULL, url);
-    mpctx->open_format = talloc_strdup(NULL, mpctx->opts->demuxer_name);
-    mpctx->open_url_flags = url_flags;
-    mpctx->open_for_prefetch = for_prefetch && mpctx->opts->demuxer_thread;
+// Drop openers whose URL is neither keep_url (may be NULL) nor one of entries.
+static void drop_other_openers(struct MPContext *mpctx, const char *keep_url,
+                               struct playlist_entry **entries, int num_entries)
+{
+    for (int n = mpctx->num_openers - 1; n >= 0; n--) {
+        struct mp_opener *o = mpctx->openers[n];
+        bool wanted = keep_url && strcmp(keep_url, o->url) == 0;
+        for (int i = 0; i < num_entries; i++)
+            wanted |= strcmp(entries[i]->filename, o->url) == 0;
+        if (!wanted) {
+            if (atomic_load(&o->done)) {
+                MP_VERBOSE(mpctx, "Dropping finished prefetch of %s\n", o->url);
+            } else {
+                MP_VERBOSE(mpctx, "Aborting ongoing prefetch of %s\n", o->url);
+            }
+            remove_opener(mpctx, o);
+        }
+    }
+}
 
-    if (pthread_create(&mpctx->open_thread, NULL, open_demux_thread, mpctx)) {
-        cancel_open(mpctx);
-        return;
+// Start a thread opening this url. Returns NULL on failure.
+static struct mp_opener *start_open(struct MPContext *mpctx, char *url,
+                                    int url_flags, bool readahead)
+{
+    struct mp_opener *o = talloc_zero(NULL, struct mp_opener);
+    o->mpctx = mpctx;
+    o->cancel = mp_cancel_new(o);
+    o->url = talloc_strdup(o, url);
+    o->format = talloc_strdup(o, mpctx->opts->demuxer_name);
+    o->url_flags = url_flags;
+    atomic_init(&o->done, false);
+    atomic_init(&o->readahead, readahead && mpctx->opts->demuxer_thread);
+
+    if (pthread_create(&o->thread, NULL, open_demux_thread, o)) {
+        talloc_free(o);
+        return NULL;
     }
 
-    mpctx->open_active = true;
+    MP_TARRAY_APPEND(NULL, mpctx->openers, mpctx->num_openers, o);
+    return o;
 }
 
 static void open_demux_reentrant(struct MPContext *mpctx)
 {
     char *url = mpctx->stream_open_filename;
 
-    if (mpctx->open_active) {
-        bool done = atomic_load(&mpctx->open_done);
-        bool failed = done && !mpctx->open_res_demuxer;
-        bool correct_url = strcmp(mpctx->open_url, url) == 0;
-
-        if (correct_url && !failed) {
+    struct mp_opener *o = find_opener(mpctx, url);
+    if (o) {
+        bool failed = atomic_load(&o->done) && !o->res_demuxer;
+        if (!failed) {
             MP_VERBOSE(mpctx, "Using prefetched/prefetching URL.\n");
-        } else if (correct_url && failed) {
-            MP_VERBOSE(mpctx, "Prefetched URL failed, retrying.\n");
-            cancel_open(mpctx);
         } else {
-            if (done) {
-                MP_VERBOSE(mpctx, "Dropping finished prefetch of wrong URL.\n");
-            } else {
-                MP_VERBOSE(mpctx, "Aborting ongoing prefetch of wrong URL.\n");
-            }
-            cancel_open(mpctx);
+            MP_VERBOSE(mpctx, "Prefetched URL failed, retrying.\n");
+            remove_opener(mpctx, o);
+            o = NULL;
         }
     }
 
-    if (!mpctx->open_active)
-        start_open(mpctx, url, mpctx->playing->stream_flags, false);
+    // Keep prefetches of the entries following this one.
+    struct playlist_entry *entries[MAX_PREFETCH_ENTRIES];
+    int num_entries = get_prefetch_entries(mpctx,
+        playlist_entry_get_rel(mpctx->playing, +1),
+        entries, MP_ARRAY_SIZE(entries));
+    drop_other_openers(mpctx, url, entries, num_entries);
+
+    if (!o)
+        o = start_open(mpctx, url, mpctx->playing->stream_flags, false);
+    if (!o) {
+        mpctx->error_playing = MPV_ERROR_LOADING_FAILED;
+        return;
+    }
 
     // User abort should cancel the opener now.
-    mp_cancel_set_parent(mpctx->open_cancel, mpctx->playback_abort);
+    mp_cancel_set_parent(o->cancel, mpctx->playback_abort);
 
-    while (!atomic_load(&mpctx->open_done)) {
+    while (!atomic_load(&o->done)) {
         mp_idle(mpctx);
 
         if (mpctx->stop_play)
             mp_abort_playback_async(mpctx);
     }
 
-    if (mpctx->open_res_demuxer) {
-        mpctx->demuxer = mpctx->open_res_demuxer;
-        mpctx->open_res_demuxer = NULL;
+    if (o->res_demuxer) {
+        mpctx->demuxer = o->res_demuxer;
+        o->res_demuxer = NULL;
         mp_cancel_set_parent(mpctx->demuxer->cancel, mpctx->playback_abort);
     } else {
-        mpctx->error_playing = mpctx->open_res_error;
+        mpctx->error_playing = o->res_error;
     }
 
-    cancel_open(mpctx); // cleanup
+    remove_opener(mpctx, o); // cleanup
 }
 
+// Open the next --prefetch-playlist-count playlist entries in the background.
+// Only the first of them reads packets ahead; the others stop after opening,
+// so memory use stays at roughly the stream buffer and headers per entry.
 void prefetch_next(struct MPContext *mpctx)
 {
-    if (!mpctx->opts->prefetch_open)
+    if (!mpctx->opts->prefetch_open && !mpctx->opts->gapless_video)
         return;
 
-    struct playlist_entry *new_entry = mp_next_file(mpctx, +1, false, false);
-    if (new_entry && !mpctx->open_active && new_entry->filename) {
-        MP_VERBOSE(mpctx, "Prefetching: %s\n", new_entry->filename);
-        start_open(mpctx, new_entry->filename, new_entry->stream_flags, true);
+    struct playlist_entry *entries[MAX_PREFETCH_ENTRIES];
+    int num_entries = get_prefetch_entries(mpctx,
+        mp_next_file(mpctx, +1, false, false), entries, MP_ARRAY_SIZE(entries));
+    drop_other_openers(mpctx, NULL, entries, num_entries);
+
+    for (int i = 0; i < num_entries; i++) {
+        struct mp_opener *o = find_opener(mpctx, entries[i]->filename);
+        if (!o) {
+            MP_VERBOSE(mpctx, "Prefetching: %s\n", entries[i]->filename);
+            start_open(mpctx, entries[i]->filename, entries[i]->stream_flags,
+                       i == 0);
+        } else if (i == 0 && mpctx->opts->demuxer_thread) {
+            // Was opened as a later entry, and is the next one now. If the
+            // thread is done without having seen the flag, start it here.
+            atomic_store(&o->readahead, true);
+            if (atomic_load(&o->done) && o->res_demuxer &&
+                !o->readahead_started)
+                start_readahead(o);
+        }
+        if (i == 0 && o && atomic_load(&o->done) && o->res_demuxer &&
+            o->readahead_started)
+            prime_next_video(mpctx, o->res_demuxer);
     }
 }
 
@@ -1586,9 +1704,13 @@ static void play_current_file(struct MPContext *mpctx)
     // let get_current_time() show 0 as start time (before playback_pts is set)
     mpctx->last_seek_pts = 0.0;
     mpctx->seek = (struct seek_params){ 0 };
-    mpctx->filter_root = mp_filter_create_root(mpctx->global);
-    mp_filter_graph_set_wakeup_cb(mpctx->filter_root, mp_wakeup_core_cb, mpctx);
-    mp_filter_graph_set_max_run_time(mpctx->filter_root, 0.1);
+    // (Still exists if the previous file's video chain was kept.)
+    if (!mpctx->filter_root) {
+        mpctx->filter_root = mp_filter_create_root(mpctx->global);
+        mp_filter_graph_set_wakeup_cb(mpctx->filter_root,
+                                      mp_wakeup_core_filters_cb, mpctx);
+        mp_filter_graph_set_max_run_time(mpctx->filter_root, 0.1);
+    }
 
     reset_playback_state(mpctx);
 
@@ -1734,6 +1856,7 @@ static void play_current_file(struct MPContext *mpctx)
     update_playback_speed(mpctx);
 
     reinit_video_chain(mpctx);
+    uninit_kept_video_chain(mpctx); // if there was no video track to take it
     reinit_audio_chain(mpctx);
     reinit_sub_all(mpctx);
 
@@ -1836,7 +1959,9 @@ terminate_playback:
     // time to uninit all, except global stuff:
     reinit_complex_filters(mpctx, true);
     uninit_audio_chain(mpctx);
-    uninit_video_chain(mpctx);
+    uninit_kept_video_chain(mpctx);
+    if (!keep_video_chain(mpctx))
+        uninit_video_chain(mpctx);
     uninit_sub_all(mpctx);
     if (!opts->gapless_audio && !mpctx->encode_lavc_ctx)
         uninit_audio_out(mpctx);
@@ -1850,7 +1975,8 @@ terminate_playback:
 
     m_config_restore_backups(mpctx->mconfig);
 
-    TA_FREEP(&mpctx->filter_root);
+    if (!mpctx->kept_vo_chain)
+        TA_FREEP(&mpctx->filter_root);
     talloc_free(mpctx->filtered_tags);
     mpctx->filtered_tags = NULL;
 
@@ -1907,6 +2033,8 @@ terminate_playback:
     mpctx->filename = NULL;
     mpctx->stream_open_filename = NULL;
 
+    mp_playback_shm_update(mpctx);
+
     if (end_event.error < 0 && nothing_played) {
         mpctx->files_broken++;
     } else if (end_event.error < 0) {
@@ -2013,11 +2141,17 @@ void mp_play_files(struct MPContext *mpctx)
         mpctx->playlist->current_was_replaced = false;
         mpctx->stop_play = new_entry ? PT_NEXT_ENTRY : PT_STOP;
 
+        // Nothing to hand a kept video chain over to.
+        if (!new_entry)
+            uninit_kept_video_chain(mpctx);
+
         if (!mpctx->playlist->current && mpctx->opts->player_idle_mode < 2)
             break;
     }
 
     cancel_open(mpctx);
+    uninit_kept_video_chain(mpctx);
+    TA_FREEP(&mpctx->filter_root);
 
     if (mpctx->encode_lavc_ctx) {
         // Make sure all streams get finished.
@@ -46,6 +46,7 @@
 #include "common/msg_control.h"
 #include "common/stats.h"
 #include "common/global.h"
+#include "filters/f_decoder_pool.h"
 #include "filters/f_decoder_wrapper.h"
 #include "options/parse_configfile.h"
 #include "options/parse_commandline.h"
@@ -62,6 +63,8 @@
 #include "core.h"
 #include "client.h"
 #include "command.h"
+#include "playback_shm.h"
+#include "playloop_trace.h"
 #include "screenshot.h"
 
 static const char def_config[] =
@@ -160,6 +163,9 @@ void mp_destroy(struct MPContext *mpctx)
     mp_uninit_ipc(mpctx->ipc_ctx);
     mpctx->ipc_ctx = NULL;
 
+    mp_playback_shm_uninit(mpctx);
+    mp_playloop_trace_uninit(mpctx);
+
     uninit_audio_out(mpctx);
     uninit_video_out(mpctx);
 
@@ -180,6 +186,7 @@ void mp_destroy(struct MPContext *mpctx)
 
     mp_input_uninit(mpctx->input);
 
+    mp_decoder_pool_global_uninit(mpctx->global);
     uninit_libav(mpctx->global);
 
     mp_msg_uninit(mpctx->global);
@@ -226,6 +233,13 @@ static bool check_locale(void)
     return !name || strcmp(name, "C") == 0 || strcmp(name, "C.UTF-8") == 0;
 }
 
+// Called by mp_dispatch_lock() with the queue locked, so it must not wake up
+// the core itself (which it doesn't need to anyway).
+static void record_core_lock(void *ctx)
+{
+    mp_record_wakeup(ctx, MP_WAKEUP_LOCK);
+}
+
 struct MPContext *mp_create(void)
 {
     if (!check_locale()) {
@@ -255,10 +269,13 @@ struct MPContext *mp_create(void)
         .thread_pool = mp_thread_pool_create(mpctx, 0, 1, 30),
         .stop_play = PT_NEXT_ENTRY,
         .play_dir = 1,
+        .wakeup_rate_start = mp_time_sec(),
     };
 
     pthread_mutex_init(&mpctx->abort_lock, NULL);
 
+    mp_dispatch_set_onlock_fn(mpctx->dispatch, record_core_lock, mpctx);
+
     mpctx->global = talloc_zero(mpctx, struct mpv_global);
 
     stats_global_init(mpctx->global);
@@ -281,10 +298,11 @@ struct MPContext *mp_create(void)
     mpctx->mconfig->global = mpctx->global;
     m_config_parse(mpctx->mconfig, "", bstr0(def_config), NULL, 0);
 
-    mpctx->input = mp_input_init(mpctx->global, mp_wakeup_core_cb, mpctx);
+    mpctx->input = mp_input_init(mpctx->global, mp_wakeup_core_input_cb, mpctx);
     screenshot_init(mpctx);
     command_init(mpctx);
     init_libav(mpctx->global);
+    mp_decoder_pool_global_init(mpctx->global);
     mp_clients_init(mpctx);
     mpctx->osd = osd_create(mpctx->global);
 
@@ -0,0 +1,296 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "demux/demux.h"
+#include "filters/f_decoder_wrapper.h"
+#include "mpv_talloc.h"
+#include "options/options.h"
+#include "osdep/timer.h"
+#include "video/out/vo.h"
+
+#include "core.h"
+#include "playback_shm.h"
+
+// Reading demuxer state requires taking the demuxer lock, so do it less often.
+#define DEMUX_STATS_INTERVAL 0.1
+
+struct playback_shm {
+    struct mp_log *log;
+    char *opt_name;             // --playback-shm value it was created for
+    char *name;                 // actual object name
+    struct mp_playback_shm_data *data;  // mapping
+
+    uint64_t update_count;
+
+    double last_demux_update;   // mp_time_sec(), or 0 to force an update
+    double cache_duration, cache_time;
+    int64_t cache_fw_bytes, cache_speed;
+    bool cache_idle;
+    double video_bitrate, audio_bitrate;
+};
+
+// Replace the first "%p" with the process ID, and make sure it starts with
+// a "/" as required by shm_open().
+static char *get_object_name(void *ta_parent, const char *opt)
+{
+    char *pid = strstr(opt, "%p");
+    char *name = pid ? talloc_asprintf(ta_parent, "%.*s%d%s", (int)(pid - opt),
+                                       opt, (int)getpid(), pid + 2)
+                     : talloc_strdup(ta_parent, opt);
+    if (name[0] != '/')
+        name = talloc_asprintf(ta_parent, "/%s", name);
+    return name;
+}
+
+// Return whether an existing object with the name was left over by an mpv
+// process that is gone. Anything else (not an mpv object, or the writer is
+// still running) must not be touched.
+static bool is_stale_object(struct playback_shm *ctx)
+{
+    int fd = shm_open(ctx->name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        MP_ERR(ctx, "'%s' already exists: %s\n", ctx->name, mp_strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    struct mp_playback_shm_data *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_uid == geteuid() &&
+        st.st_size >= sizeof(*data))
+        data = mmap(NULL, sizeof(*data), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        MP_ERR(ctx, "'%s' already exists.\n", ctx->name);
+        return false;
+    }
+
+    bool mpv_object = data->magic == MP_PLAYBACK_SHM_MAGIC &&
+                      data->pid > 0 && data->pid <= INT_MAX;
+    bool stale = mpv_object && data->pid != getpid() &&
+                 kill(data->pid, 0) < 0 && errno == ESRCH;
+    if (!stale && mpv_object) {
+        MP_ERR(ctx, "'%s' is already used by process %lld.\n", ctx->name,
+               (long long)data->pid);
+    } else if (!stale) {
+        MP_ERR(ctx, "'%s' already exists.\n", ctx->name);
+    }
+    munmap(data, sizeof(*data));
+    return stale;
+}
+
+void mp_playback_shm_uninit(struct MPContext *mpctx)
+{
+    struct playback_shm *ctx = mpctx->playback_shm;
+    if (!ctx)
+        return;
+
+    munmap(ctx->data, sizeof(*ctx->data));
+    shm_unlink(ctx->name);
+    talloc_free(ctx);
+    mpctx->playback_shm = NULL;
+}
+
+void mp_playback_shm_update_opts(struct MPContext *mpctx)
+{
+    const char *opt = mpctx->opts->playback_shm;
+    if (!opt)
+        opt = "";
+
+    struct playback_shm *cur = mpctx->playback_shm;
+    if (cur && strcmp(cur->opt_name, opt) == 0)
+        return;
+
+    mp_playback_shm_uninit(mpctx);
+    if (!opt[0])
+        return;
+
+    struct playback_shm *ctx = talloc_zero(NULL, struct playback_shm);
+    ctx->log = mp_log_new(ctx, mpctx->log, "playback-shm");
+    ctx->opt_name = talloc_strdup(ctx, opt);
+    ctx->name = get_object_name(ctx, opt);
+
+    const int flags = O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC;
+    int fd = shm_open(ctx->name, flags, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        if (!is_stale_object(ctx))
+            goto error;
+        MP_VERBOSE(ctx, "Replacing stale '%s'.\n", ctx->name);
+        shm_unlink(ctx->name);
+        fd = shm_open(ctx->name, flags, 0600);
+    }
+    if (fd < 0) {
+        MP_ERR(ctx, "Could not create '%s': %s\n", ctx->name,
+               mp_strerror(errno));
+        goto error;
+    }
+
+    size_t size = sizeof(*ctx->data);
+    if (ftruncate(fd, size) < 0) {
+        MP_ERR(ctx, "Could not resize '%s': %s\n", ctx->name,
+               mp_strerror(errno));
+        close(fd);
+        shm_unlink(ctx->name);
+        goto error;
+    }
+
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        MP_ERR(ctx, "Could not map '%s': %s\n", ctx->name, mp_strerror(errno));
+        shm_unlink(ctx->name);
+        goto error;
+    }
+    ctx->data = ptr;
+
+    *ctx->data = (struct mp_playback_shm_data){0};
+
+    MP_VERBOSE(ctx, "Publishing playback state to '%s'.\n", ctx->name);
+    mpctx->playback_shm = ctx;
+    mp_playback_shm_update(mpctx);
+    return;
+
+error:
+    talloc_free(ctx);
+}
+
+static void update_demux_stats(struct MPContext *mpctx, struct playback_shm *ctx)
+{
+    double now = mp_time_sec();
+    if (ctx->last_demux_update && now - ctx->last_demux_update < DEMUX_STATS_INTERVAL)
+        return;
+    ctx->last_demux_update = now;
+
+    ctx->cache_duration = ctx->cache_time = NAN;
+    ctx->cache_fw_bytes = ctx->cache_speed = -1;
+    ctx->cache_idle = false;
+    ctx->video_bitrate = ctx->audio_bitrate = NAN;
+
+    if (!mpctx->demuxer)
+        return;
+
+    struct demux_reader_state s;
+    demux_get_reader_state(mpctx->demuxer, &s);
+    if (s.ts_duration >= 0)
+        ctx->cache_duration = s.ts_duration;
+    if (s.ts_end != MP_NOPTS_VALUE)
+        ctx->cache_time = s.ts_end;
+    ctx->cache_fw_bytes = s.fw_bytes;
+    ctx->cache_speed = s.bytes_per_second;
+    ctx->cache_idle = s.idle;
+
+    // Same as the "video-bitrate"/"audio-bitrate" properties.
+    double *rates[] = {[STREAM_VIDEO] = &ctx->video_bitrate,
+                       [STREAM_AUDIO] = &ctx->audio_bitrate};
+    for (int type = STREAM_VIDEO; type <= STREAM_AUDIO; type++) {
+        struct demuxer *demuxer = mpctx->demuxer;
+        if (mpctx->current_track[0][type])
+            demuxer = mpctx->current_track[0][type]->demuxer;
+        double r[STREAM_TYPE_COUNT];
+        demux_get_bitrate_stats(demuxer, r);
+        if (r[type] >= 0)
+            *rates[type] = r[type] * 8;
+    }
+}
+
+static double nopts_to_nan(double v)
+{
+    return v == MP_NOPTS_VALUE ? NAN : v;
+}
+
+void mp_playback_shm_update(struct MPContext *mpctx)
+{
+    struct playback_shm *ctx = mpctx->playback_shm;
+    if (!ctx)
+        return;
+
+    bool playing = mpctx->playback_initialized;
+    if (!playing)
+        ctx->last_demux_update = 0;
+    update_demux_stats(mpctx, ctx);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    struct mp_playback_shm_data d = {
+        .magic = MP_PLAYBACK_SHM_MAGIC,
+        .version = MP_PLAYBACK_SHM_VERSION,
+        .size = sizeof(d),
+        .pid = getpid(),
+        .update_count = ++ctx->update_count,
+        .update_time_us = ts.tv_sec * INT64_C(1000000) + ts.tv_nsec / 1000,
+        .flags = (playing ? MP_PLAYBACK_SHM_PLAYING : 0) |
+                 (mpctx->opts->pause ? MP_PLAYBACK_SHM_PAUSED : 0) |
+                 (mpctx->paused_for_cache ? MP_PLAYBACK_SHM_BUFFERING : 0) |
+                 (playing && !mpctx->restart_complete ?
+                    MP_PLAYBACK_SHM_SEEKING : 0) |
+                 (ctx->cache_idle ? MP_PLAYBACK_SHM_CACHE_IDLE : 0),
+        .time_pos = NAN,
+        .duration = NAN,
+        .speed = mpctx->opts->playback_speed,
+        .avsync = NAN,
+        .total_avsync_change = NAN,
+        .cache_duration = ctx->cache_duration,
+        .cache_time = ctx->cache_time,
+        .cache_fw_bytes = ctx->cache_fw_bytes,
+        .cache_speed = ctx->cache_speed,
+        .frame_drop_count = -1,
+        .decoder_frame_drop_count = -1,
+        .video_bitrate = ctx->video_bitrate,
+        .audio_bitrate = ctx->audio_bitrate,
+    };
+
+    if (playing) {
+        d.time_pos = nopts_to_nan(get_playback_time(mpctx));
+        d.duration = nopts_to_nan(get_time_length(mpctx));
+        if (mpctx->ao_chain && mpctx->vo_chain) {
+            d.avsync = mpctx->last_av_difference;
+            d.total_avsync_change = nopts_to_nan(mpctx->total_avsync_change);
+        }
+        if (mpctx->vo_chain) {
+            d.frame_drop_count = vo_get_drop_count(mpctx->video_out);
+            if (mpctx->vo_chain->track && mpctx->vo_chain->track->dec) {
+                d.decoder_frame_drop_count =
+                    mp_decoder_wrapper_get_frames_dropped(mpctx->vo_chain->track->dec);
+            }
+        }
+    }
+
+    // Seqlock write; we're the only writer.
+    atomic_uint_least32_t *seq = (atomic_uint_least32_t *)&ctx->data->seq;
+    uint32_t cur = atomic_load_explicit(seq, memory_order_relaxed);
+    atomic_store_explicit(seq, cur + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(ctx->data, &d, offsetof(struct mp_playback_shm_data, seq));
+    memcpy((char *)ctx->data + offsetof(struct mp_playback_shm_data, pid),
+           (char *)&d + offsetof(struct mp_playback_shm_data, pid),
+           sizeof(d) - offsetof(struct mp_playback_shm_data, pid));
+    atomic_store_explicit(seq, cur + 2, memory_order_release);
+}
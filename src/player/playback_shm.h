@@ -0,0 +1,89 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPLAYER_PLAYBACK_SHM_H
+#define MPLAYER_PLAYBACK_SHM_H
+
+#include <stdint.h>
+
+/* Layout of the POSIX shared memory object created with --playback-shm.
+ * This part of the header is self-contained, so that external readers can
+ * use it as is. Fields use native byte order and alignment.
+ *
+ * The object is written with a seqlock. A reader does:
+ *
+ *      for (;;) {
+ *          seq0 = atomic load-acquire of seq
+ *          if (seq0 & 1)
+ *              continue;               // update in progress, retry
+ *          copy the struct
+ *          acquire fence
+ *          seq1 = atomic relaxed load of seq
+ *          if (seq0 == seq1)
+ *              break;                  // the copy is consistent
+ *      }
+ *
+ * The copy must not be used if magic, version or size don't match.
+ * Unavailable values are NAN (double) or -1 (integer).
+ */
+
+#define MP_PLAYBACK_SHM_MAGIC 0x5356504D // "MPVS"
+#define MP_PLAYBACK_SHM_VERSION 1
+
+enum {
+    MP_PLAYBACK_SHM_PLAYING     = 1 << 0,   // a file is loaded
+    MP_PLAYBACK_SHM_PAUSED      = 1 << 1,   // "pause" property
+    MP_PLAYBACK_SHM_BUFFERING   = 1 << 2,   // "paused-for-cache" property
+    MP_PLAYBACK_SHM_SEEKING     = 1 << 3,   // "seeking" property
+    MP_PLAYBACK_SHM_CACHE_IDLE  = 1 << 4,   // demuxer cache is not reading
+};
+
+struct mp_playback_shm_data {
+    uint32_t magic;                 // MP_PLAYBACK_SHM_MAGIC
+    uint32_t version;               // MP_PLAYBACK_SHM_VERSION
+    uint32_t size;                  // sizeof(struct mp_playback_shm_data)
+    uint32_t seq;                   // seqlock counter; odd while writing
+    int64_t pid;                    // process ID of the writer
+    uint64_t update_count;          // number of updates
+    int64_t update_time_us;         // CLOCK_MONOTONIC time of last update
+    uint32_t flags;                 // MP_PLAYBACK_SHM_* flags
+    uint32_t reserved;
+    double time_pos;                // "time-pos"
+    double duration;                // "duration"
+    double speed;                   // "speed"
+    double avsync;                  // "avsync"
+    double total_avsync_change;     // "total-avsync-change"
+    double cache_duration;          // "demuxer-cache-duration"
+    double cache_time;              // "demuxer-cache-time"
+    int64_t cache_fw_bytes;         // "demuxer-cache-state/fw-bytes"
+    int64_t cache_speed;            // "cache-speed" (bytes/second)
+    int64_t frame_drop_count;       // "frame-drop-count"
+    int64_t decoder_frame_drop_count; // "decoder-frame-drop-count"
+    double video_bitrate;           // "video-bitrate" (bits/second)
+    double audio_bitrate;           // "audio-bitrate" (bits/second)
+};
+
+struct MPContext;
+
+// (Re)create or remove the object according to --playback-shm.
+void mp_playback_shm_update_opts(struct MPContext *mpctx);
+void mp_playback_shm_uninit(struct MPContext *mpctx);
+
+// Publish the current state. Called by the playloop.
+void mp_playback_shm_update(struct MPContext *mpctx);
+
+#endif
@@ -25,6 +25,8 @@
 #include "command.h"
 #include "core.h"
 #include "mpv_talloc.h"
+#include "playback_shm.h"
+#include "playloop_trace.h"
 #include "screenshot.h"
 
 #include "audio/out/ao.h"
@@ -49,11 +51,36 @@
 #include "sub/osd.h"
 #include "video/out/vo.h"
 
+// Count mp_wait_events() returns, in windows of at least 1 second.
+static void update_wakeup_rate(struct MPContext *mpctx)
+{
+    double now = mp_time_sec();
+    double duration = now - mpctx->wakeup_rate_start;
+    mpctx->wakeup_rate_count += 1;
+    if (duration >= 1.0) {
+        mpctx->wakeup_rate = mpctx->wakeup_rate_count / duration;
+        mpctx->wakeup_rate_count = 0;
+        mpctx->wakeup_rate_start = now;
+    }
+}
+
+// Return the number of playloop wakeups per second.
+double get_wakeup_rate(struct MPContext *mpctx)
+{
+    // If the core has been sleeping for longer than a window, the last
+    // completed window is outdated.
+    double duration = mp_time_sec() - mpctx->wakeup_rate_start;
+    if (duration >= 1.0)
+        return mpctx->wakeup_rate_count / duration;
+    return mpctx->wakeup_rate;
+}
+
 // Wait until mp_wakeup_core() is called, since the last time
 // mp_wait_events() was called.
 void mp_wait_events(struct MPContext *mpctx)
 {
-    mp_client_send_property_changes(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_PROPERTY_CHANGES,
+                  mp_client_send_property_changes(mpctx));
 
     stats_event(mpctx->stats, "iterations");
 
@@ -61,7 +88,10 @@ void mp_wait_events(struct MPContext *mpctx)
     if (sleeping)
         MP_STATS(mpctx, "start sleep");
 
+    int64_t trace_start = MP_TRACE_NOW(mpctx);
     mp_dispatch_queue_process(mpctx->dispatch, mpctx->sleeptime);
+    mp_playloop_trace_wait(mpctx, trace_start, mpctx->sleeptime);
+    update_wakeup_rate(mpctx);
 
     mpctx->sleeptime = INFINITY;
 
@@ -81,19 +111,53 @@ void mp_set_timeout(struct MPContext *mpctx, double sleeptime)
     }
 }
 
+// Count a wakeup for --playloop-trace, without actually waking up the core.
+// Can be called from any thread.
+void mp_record_wakeup(struct MPContext *mpctx, enum mp_wakeup_source src)
+{
+    atomic_fetch_add(&mpctx->wakeup_counts[src], 1);
+    atomic_fetch_or(&mpctx->wakeup_pending, 1u << src);
+}
+
 // Cause the playloop to run. This can be called from any thread. If called
 // from within the playloop itself, it will be run immediately again, instead
 // of going to sleep in the next mp_wait_events().
 void mp_wakeup_core(struct MPContext *mpctx)
 {
+    mp_wakeup_core_from(mpctx, MP_WAKEUP_OTHER);
+}
+
+// Like mp_wakeup_core(), but attribute the wakeup to src.
+void mp_wakeup_core_from(struct MPContext *mpctx, enum mp_wakeup_source src)
+{
+    mp_record_wakeup(mpctx, src);
     mp_dispatch_interrupt(mpctx->dispatch);
 }
 
-// Opaque callback variant of mp_wakeup_core().
+// Opaque callback variants of mp_wakeup_core()/mp_wakeup_core_from().
 void mp_wakeup_core_cb(void *ctx)
 {
-    struct MPContext *mpctx = ctx;
-    mp_wakeup_core(mpctx);
+    mp_wakeup_core_from(ctx, MP_WAKEUP_OTHER);
+}
+
+void mp_wakeup_core_input_cb(void *ctx)
+{
+    mp_wakeup_core_from(ctx, MP_WAKEUP_INPUT);
+}
+
+void mp_wakeup_core_filters_cb(void *ctx)
+{
+    mp_wakeup_core_from(ctx, MP_WAKEUP_FILTERS);
+}
+
+void mp_wakeup_core_ao_cb(void *ctx)
+{
+    mp_wakeup_core_from(ctx, MP_WAKEUP_AO);
+}
+
+void mp_wakeup_core_vo_cb(void *ctx)
+{
+    mp_wakeup_core_from(ctx, MP_WAKEUP_VO);
 }
 
 void mp_core_lock(struct MPContext *mpctx)
@@ -663,6 +727,15 @@ static void handle_osd_redraw(struct MPContext *mpctx)
     vo_redraw(mpctx->video_out);
 }
 
+// Whether the playloop is not driven by video output, i.e. paused, idle, or
+// playing without video. (What --tickless-idle applies to.)
+static bool video_idle(struct MPContext *mpctx)
+{
+    return (mpctx->video_status != STATUS_PLAYING &&
+            mpctx->video_status != STATUS_DRAINING) ||
+           mpctx->paused;
+}
+
 static void clear_underruns(struct MPContext *mpctx)
 {
     if (mpctx->ao_chain && mpctx->ao_chain->underrun) {
@@ -756,7 +829,10 @@ static void handle_update_cache(struct MPContext *mpctx)
         busy = true;
     if (busy || mpctx->next_cache_update > 0) {
         if (mpctx->next_cache_update <= now) {
-            mpctx->next_cache_update = busy ? now + 0.25 : 0;
+            double interval = 0.25;
+            if (opts->tickless_idle && video_idle(mpctx))
+                interval = 1.0;
+            mpctx->next_cache_update = busy ? now + interval : 0;
             force_update = true;
         }
         if (mpctx->next_cache_update > 0)
@@ -1005,7 +1081,7 @@ int handle_force_window(struct MPContext *mpctx, bool force)
             .input_ctx = mpctx->input,
             .osd = mpctx->osd,
             .encode_lavc_ctx = mpctx->encode_lavc_ctx,
-            .wakeup_cb = mp_wakeup_core_cb,
+            .wakeup_cb = mp_wakeup_core_vo_cb,
             .wakeup_ctx = mpctx,
         };
         mpctx->video_out = init_best_video_out(mpctx->global, &ex);
@@ -1053,14 +1129,50 @@ err:
     return -1;
 }
 
+// Minimum time between 2 ticks sent while video is idle.
+#define IDLE_TICK_INTERVAL 0.050
+
 // Potentially needed by some Lua scripts, which assume TICK always comes.
+// With --tickless-idle, send ticks only when the playback time as displayed
+// (in whole seconds) can have changed, and sleep until exactly then. While the
+// time is frozen (paused, idle), this is only after it was changed by seeking.
+// If it changes otherwise (e.g. while audio is syncing or draining), ticks are
+// rate limited as without --tickless-idle.
+static void handle_tickless_ticks(struct MPContext *mpctx)
+{
+    double now = mp_time_sec();
+    double pts = mpctx->playback_pts;
+    double last = mpctx->last_tick_pts;
+    bool advancing = !mpctx->paused && mpctx->audio_status == STATUS_PLAYING &&
+                     pts != MP_NOPTS_VALUE;
+
+    bool tick = pts != last;
+    if (advancing && last != MP_NOPTS_VALUE) {
+        tick = floor(pts) != floor(last);
+    } else if (tick && now - mpctx->last_idle_tick < IDLE_TICK_INTERVAL) {
+        mp_set_timeout(mpctx, mpctx->last_idle_tick + IDLE_TICK_INTERVAL - now);
+        tick = false;
+    }
+    if (tick) {
+        mpctx->last_tick_pts = pts;
+        mpctx->last_idle_tick = now;
+        mp_notify(mpctx, MPV_EVENT_TICK, NULL);
+    }
+
+    if (advancing) {
+        double next = mpctx->play_dir > 0 ? floor(pts) + 1 - pts
+                                          : pts - floor(pts);
+        // Wake up slightly late, so that the AO position is past the boundary.
+        mp_set_timeout(mpctx, next / mpctx->audio_speed + 0.001);
+    }
+}
+
 static void handle_dummy_ticks(struct MPContext *mpctx)
 {
-    if ((mpctx->video_status != STATUS_PLAYING &&
-         mpctx->video_status != STATUS_DRAINING) ||
-         mpctx->paused)
-    {
-        if (mp_time_sec() - mpctx->last_idle_tick > 0.050) {
+    if (video_idle(mpctx)) {
+        if (mpctx->opts->tickless_idle) {
+            handle_tickless_ticks(mpctx);
+        } else if (mp_time_sec() - mpctx->last_idle_tick > IDLE_TICK_INTERVAL) {
             mpctx->last_idle_tick = mp_time_sec();
             mp_notify(mpctx, MPV_EVENT_TICK, NULL);
         }
@@ -1090,6 +1202,8 @@ static void handle_playback_time(struct MPContext *mpctx)
         if (mpts != MP_NOPTS_VALUE)
             mpctx->playback_pts = mpts;
     }
+
+    mp_playback_shm_update(mpctx);
 }
 
 // We always make sure audio and video buffers are filled before actually
@@ -1201,72 +1315,80 @@ void run_playloop(struct MPContext *mpctx)
         return;
     }
 
-    update_demuxer_properties(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_DEMUXER_PROPERTIES,
+                  update_demuxer_properties(mpctx));
 
-    handle_cursor_autohide(mpctx);
-    handle_vo_events(mpctx);
-    handle_command_updates(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_CURSOR_AUTOHIDE, handle_cursor_autohide(mpctx));
+    MP_TRACE_STEP(mpctx, MP_STEP_VO_EVENTS, handle_vo_events(mpctx));
+    MP_TRACE_STEP(mpctx, MP_STEP_COMMAND_UPDATES, handle_command_updates(mpctx));
 
     if (mpctx->lavfi && mp_filter_has_failed(mpctx->lavfi))
         mpctx->stop_play = AT_END_OF_FILE;
 
-    fill_audio_out_buffers(mpctx);
-    write_video(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_AUDIO, fill_audio_out_buffers(mpctx));
+    MP_TRACE_STEP(mpctx, MP_STEP_VIDEO, write_video(mpctx));
 
-    handle_playback_restart(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_PLAYBACK_RESTART,
+                  handle_playback_restart(mpctx));
 
-    handle_playback_time(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_PLAYBACK_TIME, handle_playback_time(mpctx));
 
-    handle_dummy_ticks(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_DUMMY_TICKS, handle_dummy_ticks(mpctx));
 
-    update_osd_msg(mpctx);
-    if (mpctx->video_status == STATUS_EOF)
-        update_subtitles(mpctx, mpctx->playback_pts);
+    MP_TRACE_STEP(mpctx, MP_STEP_OSD_MSG, update_osd_msg(mpctx));
+    if (mpctx->video_status == STATUS_EOF) {
+        MP_TRACE_STEP(mpctx, MP_STEP_SUBTITLES,
+                      update_subtitles(mpctx, mpctx->playback_pts));
+    }
 
-    handle_each_frame_screenshot(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_SCREENSHOT,
+                  handle_each_frame_screenshot(mpctx));
 
-    handle_eof(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_EOF, handle_eof(mpctx));
 
-    handle_loop_file(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_LOOP_FILE, handle_loop_file(mpctx));
 
-    handle_keep_open(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_KEEP_OPEN, handle_keep_open(mpctx));
 
-    handle_sstep(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_SSTEP, handle_sstep(mpctx));
 
-    update_core_idle_state(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_CORE_IDLE, update_core_idle_state(mpctx));
 
-    execute_queued_seek(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_SEEK, execute_queued_seek(mpctx));
 
     if (mpctx->stop_play)
         return;
 
-    handle_osd_redraw(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_OSD_REDRAW, handle_osd_redraw(mpctx));
 
-    if (mp_filter_graph_run(mpctx->filter_root))
-        mp_wakeup_core(mpctx);
+    bool filters_active;
+    MP_TRACE_STEP(mpctx, MP_STEP_FILTERS,
+                  filters_active = mp_filter_graph_run(mpctx->filter_root));
+    if (filters_active)
+        mp_wakeup_core_from(mpctx, MP_WAKEUP_FILTERS);
 
     mp_wait_events(mpctx);
 
-    handle_update_cache(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_UPDATE_CACHE, handle_update_cache(mpctx));
 
-    mp_process_input(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_INPUT, mp_process_input(mpctx));
 
-    handle_chapter_change(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_CHAPTER_CHANGE, handle_chapter_change(mpctx));
 
-    handle_force_window(mpctx, false);
+    MP_TRACE_STEP(mpctx, MP_STEP_FORCE_WINDOW, handle_force_window(mpctx, false));
 }
 
 void mp_idle(struct MPContext *mpctx)
 {
-    handle_dummy_ticks(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_DUMMY_TICKS, handle_dummy_ticks(mpctx));
     mp_wait_events(mpctx);
-    mp_process_input(mpctx);
-    handle_command_updates(mpctx);
-    handle_update_cache(mpctx);
-    handle_cursor_autohide(mpctx);
-    handle_vo_events(mpctx);
-    update_osd_msg(mpctx);
-    handle_osd_redraw(mpctx);
+    MP_TRACE_STEP(mpctx, MP_STEP_INPUT, mp_process_input(mpctx));
+    MP_TRACE_STEP(mpctx, MP_STEP_COMMAND_UPDATES, handle_command_updates(mpctx));
+    MP_TRACE_STEP(mpctx, MP_STEP_UPDATE_CACHE, handle_update_cache(mpctx));
+    MP_TRACE_STEP(mpctx, MP_STEP_CURSOR_AUTOHIDE, handle_cursor_autohide(mpctx));
+    MP_TRACE_STEP(mpctx, MP_STEP_VO_EVENTS, handle_vo_events(mpctx));
+    MP_TRACE_STEP(mpctx, MP_STEP_OSD_MSG, update_osd_msg(mpctx));
+    MP_TRACE_STEP(mpctx, MP_STEP_OSD_REDRAW, handle_osd_redraw(mpctx));
 }
 
 // Waiting for the slave master to send us a new file to play.
@@ -0,0 +1,294 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "misc/node.h"
+#include "mpv_talloc.h"
+#include "options/options.h"
+
+#include "core.h"
+#include "playloop_trace.h"
+
+// Number of steps listed in the log summary.
+#define LOG_STEPS 5
+
+// Reasons a mp_dispatch_queue_process() call returned. The first entries are
+// the wakeup sources (enum mp_wakeup_source).
+enum {
+    REASON_TIMEOUT = MP_WAKEUP_SOURCE_COUNT, // the requested timeout elapsed
+    REASON_NO_SLEEP,    // the core asked to run again without waiting
+    REASON_DISPATCH,    // client requests or a shortened timeout
+    NUM_REASONS
+};
+
+static const char *const reason_names[NUM_REASONS] = {
+    [MP_WAKEUP_OTHER]   = "other",
+    [MP_WAKEUP_LOCK]    = "core-lock",
+    [MP_WAKEUP_INPUT]   = "input",
+    [MP_WAKEUP_DEMUX]   = "demux",
+    [MP_WAKEUP_FILTERS] = "filters",
+    [MP_WAKEUP_AO]      = "ao",
+    [MP_WAKEUP_VO]      = "vo",
+    [REASON_TIMEOUT]    = "timeout",
+    [REASON_NO_SLEEP]   = "no-sleep",
+    [REASON_DISPATCH]   = "dispatch",
+};
+
+static const char *const step_names[MP_STEP_COUNT] = {
+    [MP_STEP_DEMUXER_PROPERTIES]    = "demuxer-properties",
+    [MP_STEP_CURSOR_AUTOHIDE]       = "cursor-autohide",
+    [MP_STEP_VO_EVENTS]             = "vo-events",
+    [MP_STEP_COMMAND_UPDATES]       = "command-updates",
+    [MP_STEP_AUDIO]                 = "audio",
+    [MP_STEP_VIDEO]                 = "video",
+    [MP_STEP_PLAYBACK_RESTART]      = "playback-restart",
+    [MP_STEP_PLAYBACK_TIME]         = "playback-time",
+    [MP_STEP_DUMMY_TICKS]           = "dummy-ticks",
+    [MP_STEP_OSD_MSG]               = "osd-msg",
+    [MP_STEP_SUBTITLES]             = "subtitles",
+    [MP_STEP_SCREENSHOT]            = "screenshot",
+    [MP_STEP_EOF]                   = "eof",
+    [MP_STEP_LOOP_FILE]             = "loop-file",
+    [MP_STEP_KEEP_OPEN]             = "keep-open",
+    [MP_STEP_SSTEP]                 = "sstep",
+    [MP_STEP_CORE_IDLE]             = "core-idle",
+    [MP_STEP_SEEK]                  = "seek",
+    [MP_STEP_OSD_REDRAW]            = "osd-redraw",
+    [MP_STEP_FILTERS]               = "filters",
+    [MP_STEP_PROPERTY_CHANGES]      = "property-changes",
+    [MP_STEP_UPDATE_CACHE]          = "update-cache",
+    [MP_STEP_INPUT]                 = "input",
+    [MP_STEP_CHAPTER_CHANGE]        = "chapter-change",
+    [MP_STEP_FORCE_WINDOW]          = "force-window",
+};
+
+struct step_stats {
+    uint64_t count;
+    int64_t total_ns, max_ns;
+};
+
+struct trace_stats {
+    uint64_t iterations;                    // mp_wait_events() calls
+    int64_t wait_ns;                        // in mp_dispatch_queue_process()
+    uint64_t woken_by[NUM_REASONS];         // iterations per wakeup reason
+    uint64_t wakeups[MP_WAKEUP_SOURCE_COUNT]; // wakeup calls per source
+    struct step_stats steps[MP_STEP_COUNT];
+};
+
+// Accessed by the core thread only.
+struct playloop_trace {
+    struct mp_log *log;
+    int64_t start_ns;
+    struct trace_stats total;       // since tracing was enabled
+    int64_t interval_start_ns;
+    struct trace_stats interval;    // since the last log summary
+    // MPContext.wakeup_counts at the last mp_playloop_trace_wait()
+    uint64_t wakeup_base[MP_WAKEUP_SOURCE_COUNT];
+};
+
+int64_t mp_playloop_trace_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
+}
+
+void mp_playloop_trace_uninit(struct MPContext *mpctx)
+{
+    TA_FREEP(&mpctx->playloop_trace);
+}
+
+void mp_playloop_trace_update_opts(struct MPContext *mpctx)
+{
+    bool enable = mpctx->opts->playloop_trace;
+    if (enable == !!mpctx->playloop_trace)
+        return;
+
+    if (!enable) {
+        mp_playloop_trace_uninit(mpctx);
+        return;
+    }
+
+    struct playloop_trace *t = talloc_zero(NULL, struct playloop_trace);
+    t->log = mp_log_new(t, mpctx->log, "trace");
+    t->start_ns = t->interval_start_ns = mp_playloop_trace_time();
+    atomic_store(&mpctx->wakeup_pending, 0);
+    for (int n = 0; n < MP_WAKEUP_SOURCE_COUNT; n++)
+        t->wakeup_base[n] = atomic_load(&mpctx->wakeup_counts[n]);
+    mpctx->playloop_trace = t;
+}
+
+void mp_playloop_trace_step(struct MPContext *mpctx, enum mp_playloop_step step,
+                            int64_t start)
+{
+    struct playloop_trace *t = mpctx->playloop_trace;
+    if (!t) // disabled by the step itself
+        return;
+
+    int64_t d = mp_playloop_trace_time() - start;
+    struct trace_stats *stats[] = {&t->total, &t->interval};
+    for (int i = 0; i < MP_ARRAY_SIZE(stats); i++) {
+        struct step_stats *s = &stats[i]->steps[step];
+        s->count += 1;
+        s->total_ns += d;
+        s->max_ns = MPMAX(s->max_ns, d);
+    }
+}
+
+// Append the non-zero counts as "name count", largest first.
+static void append_counts(char **s, const uint64_t *counts, int num)
+{
+    bool done[NUM_REASONS] = {0};
+    bool first = true;
+    while (1) {
+        int best = -1;
+        for (int n = 0; n < num; n++) {
+            if (!done[n] && counts[n] && (best < 0 || counts[n] > counts[best]))
+                best = n;
+        }
+        if (best < 0)
+            break;
+        done[best] = true;
+        *s = talloc_asprintf_append(*s, "%s%s %"PRIu64, first ? "" : ", ",
+                                    reason_names[best], counts[best]);
+        first = false;
+    }
+    if (first)
+        *s = talloc_strdup_append(*s, "-");
+}
+
+static void log_summary(struct playloop_trace *t, int64_t now)
+{
+    struct trace_stats *st = &t->interval;
+    double duration = MPMAX(now - t->interval_start_ns, 1) / 1e9;
+
+    MP_INFO(t, "%.1f s: %"PRIu64" iterations (%.1f/s), %.1f%% waiting\n",
+            duration, st->iterations, st->iterations / duration,
+            100.0 * st->wait_ns / 1e9 / duration);
+
+    char *s = talloc_strdup(NULL, "");
+    append_counts(&s, st->woken_by, NUM_REASONS);
+    MP_INFO(t, "woken by: %s\n", s);
+
+    s[0] = '\0';
+    append_counts(&s, st->wakeups, MP_WAKEUP_SOURCE_COUNT);
+    MP_INFO(t, "wakeups: %s\n", s);
+
+    // Steps with the most time spent, as average/maximum per call.
+    s[0] = '\0';
+    bool done[MP_STEP_COUNT] = {0};
+    for (int i = 0; i < LOG_STEPS; i++) {
+        int best = -1;
+        for (int n = 0; n < MP_STEP_COUNT; n++) {
+            struct step_stats *c = &st->steps[n];
+            if (!done[n] && c->total_ns &&
+                (best < 0 || c->total_ns > st->steps[best].total_ns))
+                best = n;
+        }
+        if (best < 0)
+            break;
+        done[best] = true;
+        struct step_stats *c = &st->steps[best];
+        s = talloc_asprintf_append(s, "%s%s %.3f/%.3f ms", i ? ", " : "",
+                                   step_names[best],
+                                   c->total_ns / 1e6 / c->count,
+                                   c->max_ns / 1e6);
+    }
+    MP_INFO(t, "steps (avg/max): %s\n", s[0] ? s : "-");
+    talloc_free(s);
+}
+
+void mp_playloop_trace_wait(struct MPContext *mpctx, int64_t start,
+                            double sleeptime)
+{
+    struct playloop_trace *t = mpctx->playloop_trace;
+    if (!t || !start)
+        return;
+
+    int64_t now = mp_playloop_trace_time();
+    uint64_t reasons = atomic_exchange(&mpctx->wakeup_pending, 0);
+    if (!reasons) {
+        int r = REASON_DISPATCH;
+        if (sleeptime <= 0) {
+            r = REASON_NO_SLEEP;
+        } else if (now - start >= sleeptime * 1e9) {
+            r = REASON_TIMEOUT;
+        }
+        reasons = 1ULL << r;
+    }
+
+    uint64_t wakeups[MP_WAKEUP_SOURCE_COUNT];
+    for (int n = 0; n < MP_WAKEUP_SOURCE_COUNT; n++) {
+        uint64_t count = atomic_load(&mpctx->wakeup_counts[n]);
+        wakeups[n] = count - t->wakeup_base[n];
+        t->wakeup_base[n] = count;
+    }
+
+    struct trace_stats *stats[] = {&t->total, &t->interval};
+    for (int i = 0; i < MP_ARRAY_SIZE(stats); i++) {
+        struct trace_stats *s = stats[i];
+        s->iterations += 1;
+        s->wait_ns += now - start;
+        for (int n = 0; n < NUM_REASONS; n++)
+            s->woken_by[n] += !!(reasons & (1ULL << n));
+        for (int n = 0; n < MP_WAKEUP_SOURCE_COUNT; n++)
+            s->wakeups[n] += wakeups[n];
+    }
+
+    double interval = mpctx->opts->playloop_trace_interval;
+    if (interval > 0 && now - t->interval_start_ns >= interval * 1e9) {
+        log_summary(t, now);
+        t->interval = (struct trace_stats){0};
+        t->interval_start_ns = now;
+    }
+}
+
+static void add_counts(struct mpv_node *dst, const char *key,
+                       const uint64_t *counts, int num)
+{
+    struct mpv_node *map = node_map_add(dst, key, MPV_FORMAT_NODE_MAP);
+    for (int n = 0; n < num; n++)
+        node_map_add_int64(map, reason_names[n], counts[n]);
+}
+
+void mp_playloop_trace_get_node(struct MPContext *mpctx, struct mpv_node *out)
+{
+    struct playloop_trace *t = mpctx->playloop_trace;
+    struct trace_stats *st = &t->total;
+
+    node_init(out, MPV_FORMAT_NODE_MAP, NULL);
+    node_map_add_double(out, "duration",
+                        (mp_playloop_trace_time() - t->start_ns) / 1e9);
+    node_map_add_int64(out, "iterations", st->iterations);
+    node_map_add_double(out, "wait-time", st->wait_ns / 1e9);
+    add_counts(out, "woken-by", st->woken_by, NUM_REASONS);
+    add_counts(out, "wakeups", st->wakeups, MP_WAKEUP_SOURCE_COUNT);
+
+    struct mpv_node *steps = node_map_add(out, "steps", MPV_FORMAT_NODE_MAP);
+    for (int n = 0; n < MP_STEP_COUNT; n++) {
+        struct step_stats *s = &st->steps[n];
+        struct mpv_node *e = node_map_add(steps, step_names[n],
+                                          MPV_FORMAT_NODE_MAP);
+        node_map_add_int64(e, "count", s->count);
+        node_map_add_double(e, "total", s->total_ns / 1e9);
+        node_map_add_double(e, "max", s->max_ns / 1e9);
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPLAYER_PLAYLOOP_TRACE_H
+#define MPLAYER_PLAYLOOP_TRACE_H
+
+#include <stdint.h>
+
+struct MPContext;
+struct mpv_node;
+
+// Parts of run_playloop()/mp_idle() whose run time is measured.
+enum mp_playloop_step {
+    MP_STEP_DEMUXER_PROPERTIES,
+    MP_STEP_CURSOR_AUTOHIDE,
+    MP_STEP_VO_EVENTS,
+    MP_STEP_COMMAND_UPDATES,
+    MP_STEP_AUDIO,
+    MP_STEP_VIDEO,
+    MP_STEP_PLAYBACK_RESTART,
+    MP_STEP_PLAYBACK_TIME,
+    MP_STEP_DUMMY_TICKS,
+    MP_STEP_OSD_MSG,
+    MP_STEP_SUBTITLES,
+    MP_STEP_SCREENSHOT,
+    MP_STEP_EOF,
+    MP_STEP_LOOP_FILE,
+    MP_STEP_KEEP_OPEN,
+    MP_STEP_SSTEP,
+    MP_STEP_CORE_IDLE,
+    MP_STEP_SEEK,
+    MP_STEP_OSD_REDRAW,
+    MP_STEP_FILTERS,
+    MP_STEP_PROPERTY_CHANGES,
+    MP_STEP_UPDATE_CACHE,
+    MP_STEP_INPUT,
+    MP_STEP_CHAPTER_CHANGE,
+    MP_STEP_FORCE_WINDOW,
+    MP_STEP_COUNT
+};
+
+// Create or remove the tracer according to --playloop-trace.
+void mp_playloop_trace_update_opts(struct MPContext *mpctx);
+void mp_playloop_trace_uninit(struct MPContext *mpctx);
+
+// Monotonic time in nanoseconds.
+int64_t mp_playloop_trace_time(void);
+
+// Account the time since start (from MP_TRACE_NOW()) to the step.
+void mp_playloop_trace_step(struct MPContext *mpctx, enum mp_playloop_step step,
+                            int64_t start);
+
+// Account a mp_dispatch_queue_process() call that started at start and was
+// given the timeout sleeptime, and attribute the wakeup that ended it. Also
+// logs the periodic summary.
+void mp_playloop_trace_wait(struct MPContext *mpctx, int64_t start,
+                            double sleeptime);
+
+// Statistics since tracing was enabled, for the playloop-trace property.
+void mp_playloop_trace_get_node(struct MPContext *mpctx, struct mpv_node *out);
+
+// Trace timestamp, or 0 if tracing is disabled.
+#define MP_TRACE_NOW(mpctx) \
+    ((mpctx)->playloop_trace ? mp_playloop_trace_time() : 0)
+
+// Run code, and account its run time to step if tracing is enabled.
+#define MP_TRACE_STEP(mpctx, step, code) do {                       \
+        int64_t trace_start_ = MP_TRACE_NOW(mpctx);                 \
+        code;                                                       \
+        if (trace_start_)                                           \
+            mp_playloop_trace_step(mpctx, step, trace_start_);      \
+    } while (0)
+
+#endif
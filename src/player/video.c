@@ -92,6 +92,7 @@ static void vo_chain_reset_state(struct vo_chain *vo_c)
     vo_seek_reset(vo_c->vo);
     vo_c->underrun = false;
     vo_c->underrun_signaled = false;
+    vo_c->drop_acc = 0;
 }
 
 void reset_video_state(struct MPContext *mpctx)
@@ -125,6 +126,7 @@ void reset_video_state(struct MPContext *mpctx)
 void uninit_video_out(struct MPContext *mpctx)
 {
     uninit_video_chain(mpctx);
+    uninit_kept_video_chain(mpctx);
     if (mpctx->video_out) {
         vo_destroy(mpctx->video_out);
         mp_notify(mpctx, MPV_EVENT_VIDEO_RECONFIG, NULL);
@@ -152,6 +154,137 @@ static void vo_chain_uninit(struct vo_chain *vo_c)
     // this does not free the VO
 }
 
+// Decoder for the next playlist entry's video, created while the current file
+// is still playing (--gapless-video).
+struct video_primer {
+    struct demuxer *demuxer;
+    struct sh_stream *stream;
+    struct mp_decoder_wrapper *dec; // NULL if creating it failed
+};
+
+// Frames decoded ahead by the primer. The first is shown right away when the
+// next file starts; the second avoids an underrun right after it.
+#define GAPLESS_PRIME_FRAMES 2
+
+static void free_primer(struct vo_chain *vo_c)
+{
+    if (vo_c && vo_c->primer) {
+        if (vo_c->primer->dec)
+            talloc_free(vo_c->primer->dec->f);
+        TA_FREEP(&vo_c->primer);
+    }
+}
+
+// Drop the primer if it reads from the given demuxer (NULL: any), which is
+// about to be destroyed.
+void drop_video_primer(struct MPContext *mpctx, struct demuxer *demuxer)
+{
+    struct vo_chain *chains[] = {mpctx->vo_chain, mpctx->kept_vo_chain};
+    for (int n = 0; n < MP_ARRAY_SIZE(chains); n++) {
+        struct vo_chain *vo_c = chains[n];
+        if (vo_c && vo_c->primer &&
+            (!demuxer || vo_c->primer->demuxer == demuxer))
+            free_primer(vo_c);
+    }
+}
+
+// Called with the (opened, reading ahead) demuxer of the next playlist entry.
+// Creates a decoder for its default video stream in the current video chain,
+// so it gets the same hwdec/DR setup as the current decoder, and lets it
+// decode the first frames. The decoder is taken over by init_video_decoder().
+void prime_next_video(struct MPContext *mpctx, struct demuxer *demuxer)
+{
+    struct MPOpts *opts = mpctx->opts;
+    struct vo_chain *vo_c = mpctx->vo_chain;
+
+    if (!opts->gapless_video || !vo_c || !vo_c->track || vo_c->filter_src ||
+        vo_c->is_coverart || mpctx->encode_lavc_ctx)
+        return;
+
+    if (vo_c->primer) {
+        if (vo_c->primer->demuxer == demuxer)
+            return;
+        free_primer(vo_c);
+    }
+
+    struct sh_stream *sh = NULL;
+    for (int n = 0; n < demux_get_num_stream(demuxer); n++) {
+        struct sh_stream *s = demux_get_stream(demuxer, n);
+        if (s->type != STREAM_VIDEO || s->attached_picture ||
+            s->still_image || !demux_stream_is_selected(s))
+            continue;
+        if (!sh || (s->default_track && !sh->default_track))
+            sh = s;
+    }
+    if (!sh)
+        return;
+
+    vo_c->primer = talloc_zero(vo_c, struct video_primer);
+    vo_c->primer->demuxer = demuxer;
+    vo_c->primer->stream = sh;
+
+    // Same as what the player does when the file is loaded; the primed frames
+    // must have the final timestamps.
+    if (opts->rebase_start_time)
+        demux_set_ts_offset(demuxer, -demuxer->start_time);
+
+    struct mp_decoder_wrapper *dec =
+        mp_decoder_wrapper_create_primed(vo_c->filter->f, sh,
+                                         GAPLESS_PRIME_FRAMES);
+    if (!dec || !mp_decoder_wrapper_reinit(dec)) {
+        MP_WARN(mpctx, "Could not prime video decoder for next file.\n");
+        if (dec)
+            talloc_free(dec->f);
+        return;
+    }
+    mp_decoder_wrapper_prime(dec);
+    vo_c->primer->dec = dec;
+
+    MP_VERBOSE(mpctx, "Priming video decoder for next file.\n");
+}
+
+// At the end of a file, keep the video chain (minus the decoder) and the VO as
+// they are, so the next file can take them over (--gapless-video). Returns
+// false if the chain should be destroyed normally.
+bool keep_video_chain(struct MPContext *mpctx)
+{
+    struct vo_chain *vo_c = mpctx->vo_chain;
+
+    if (!mpctx->opts->gapless_video || !vo_c || !vo_c->track ||
+        vo_c->filter_src || vo_c->is_coverart || mpctx->encode_lavc_ctx ||
+        (mpctx->stop_play != AT_END_OF_FILE &&
+         mpctx->stop_play != PT_NEXT_ENTRY))
+        return false;
+
+    assert(!mpctx->kept_vo_chain);
+
+    reset_video_state(mpctx);
+
+    struct track *track = vo_c->track;
+    assert(track->vo_c == vo_c);
+    track->vo_c = NULL;
+    talloc_free(track->dec->f);
+    track->dec = NULL;
+    vo_c->track = NULL;
+    vo_c->dec_src = NULL;
+
+    mpctx->kept_vo_chain = vo_c;
+    mpctx->vo_chain = NULL;
+    mpctx->video_status = STATUS_EOF;
+
+    mp_notify(mpctx, MPV_EVENT_VIDEO_RECONFIG, NULL);
+    return true;
+}
+
+// Destroy the chain kept by keep_video_chain(), if the file didn't use it.
+void uninit_kept_video_chain(struct MPContext *mpctx)
+{
+    if (mpctx->kept_vo_chain) {
+        vo_chain_uninit(mpctx->kept_vo_chain);
+        mpctx->kept_vo_chain = NULL;
+    }
+}
+
 void uninit_video_chain(struct MPContext *mpctx)
 {
     if (mpctx->vo_chain) {
@@ -181,6 +314,18 @@ int init_video_decoder(struct MPContext *mpctx, struct track *track)
     if (track->vo_c)
         parent = track->vo_c->filter->f;
 
+    struct video_primer *primer = track->vo_c ? track->vo_c->primer : NULL;
+    if (primer && primer->dec && primer->stream == track->stream) {
+        MP_VERBOSE(mpctx, "Using primed video decoder.\n");
+        track->dec = primer->dec;
+        primer->dec = NULL;
+        mp_decoder_wrapper_end_priming(track->dec);
+    }
+    if (track->vo_c)
+        free_primer(track->vo_c);
+    if (track->dec)
+        return 1;
+
     track->dec = mp_decoder_wrapper_create(parent, track->stream);
     if (!track->dec)
         goto err_out;
@@ -221,12 +366,20 @@ void reinit_video_chain_src(struct MPContext *mpctx, struct track *track)
 {
     assert(!mpctx->vo_chain);
 
+    struct vo_chain *vo_c = NULL;
+    if (track && mpctx->kept_vo_chain) {
+        MP_VERBOSE(mpctx, "Reusing video chain of previous file.\n");
+        vo_c = mpctx->kept_vo_chain;
+        mpctx->kept_vo_chain = NULL;
+    }
+    uninit_kept_video_chain(mpctx);
+
     if (!mpctx->video_out) {
         struct vo_extra ex = {
             .input_ctx = mpctx->input,
             .osd = mpctx->osd,
             .encode_lavc_ctx = mpctx->encode_lavc_ctx,
-            .wakeup_cb = mp_wakeup_core_cb,
+            .wakeup_cb = mp_wakeup_core_vo_cb,
             .wakeup_ctx = mpctx,
         };
         mpctx->video_out = init_best_video_out(mpctx->global, &ex);
@@ -241,15 +394,17 @@ void reinit_video_chain_src(struct MPContext *mpctx, struct track *track)
 
     update_window_title(mpctx, true);
 
-    struct vo_chain *vo_c = talloc_zero(NULL, struct vo_chain);
+    if (!vo_c) {
+        vo_c = talloc_zero(NULL, struct vo_chain);
+        vo_c->log = mpctx->log;
+        vo_c->vo = mpctx->video_out;
+        vo_c->filter =
+            mp_output_chain_create(mpctx->filter_root, MP_OUTPUT_CHAIN_VIDEO);
+        mp_output_chain_set_vo(vo_c->filter, vo_c->vo);
+        vo_c->filter->update_subtitles = filter_update_subtitles;
+        vo_c->filter->update_subtitles_ctx = mpctx;
+    }
     mpctx->vo_chain = vo_c;
-    vo_c->log = mpctx->log;
-    vo_c->vo = mpctx->video_out;
-    vo_c->filter =
-        mp_output_chain_create(mpctx->filter_root, MP_OUTPUT_CHAIN_VIDEO);
-    mp_output_chain_set_vo(vo_c->filter, vo_c->vo);
-    vo_c->filter->update_subtitles = filter_update_subtitles;
-    vo_c->filter->update_subtitles_ctx = mpctx;
 
     if (track) {
         vo_c->track = track;
@@ -266,6 +421,8 @@ void reinit_video_chain_src(struct MPContext *mpctx, struct track *track)
         if (vo_c->is_coverart)
             mp_decoder_wrapper_set_coverart_flag(track->dec, true);
 
+        update_video_keyframes_only(mpctx);
+
         track->vo_c = vo_c;
         vo_c->track = track;
 
@@ -335,6 +492,80 @@ static void check_framedrop(struct MPContext *mpctx, struct vo_chain *vo_c)
     }
 }
 
+// Enable or disable keyframes-only decoding according to the options and the
+// playback speed.
+void update_video_keyframes_only(struct MPContext *mpctx)
+{
+    struct MPOpts *opts = mpctx->opts;
+    struct vo_chain *vo_c = mpctx->vo_chain;
+
+    if (!vo_c || !vo_c->track || !vo_c->track->dec || vo_c->is_coverart)
+        return;
+
+    bool enable = opts->video_keyframes_only == 1 ||
+        (opts->video_keyframes_only == 2 &&
+         opts->playback_speed >= opts->video_keyframes_only_speed);
+    mp_decoder_wrapper_set_keyframes_only(vo_c->track->dec, enable);
+}
+
+// Share of decoding/rendering time per frame interval above which frames are
+// dropped. The rest is headroom for jitter and other work.
+#define ADAPTIVE_DROP_LOAD 0.9
+
+// Predictive decoder framedropping (--framedrop=decoder-adaptive): estimate the
+// load from the measured decoding and rendering cost per frame, and drop the
+// share of frames which can't be handled, spread evenly over time. This
+// reacts before A/V sync starts lagging, and avoids dropping in bursts.
+static void check_framedrop_adaptive(struct MPContext *mpctx,
+                                     struct vo_chain *vo_c)
+{
+    struct mp_decoder_wrapper *dec = vo_c->track->dec;
+
+    float fps = vo_c->filter->container_fps;
+    if (fps <= 0 || fps >= 500 || mpctx->video_speed <= 0)
+        return;
+    double frame_time = 1.0 / fps / mpctx->video_speed;
+
+    // Decoding has to keep up with every frame, but the VO renders at most one
+    // frame per display refresh (it drops the others), so its budget is the
+    // vsync interval if that is longer.
+    double vsync = vo_get_vsync_interval(vo_c->vo) / 1e6;
+    double render_interval = vsync > 0 ? MPMAX(frame_time, vsync) : frame_time;
+
+    // Decoding and rendering run on separate threads; the slower one limits
+    // the frame rate.
+    double decode_time = mp_decoder_wrapper_get_decode_time(dec);
+    double render_time = vo_get_render_time(vo_c->vo);
+    if (decode_time <= 0 && render_time <= 0)
+        return;
+
+    double load = MPMAX(decode_time / frame_time, render_time / render_interval);
+    double ratio = load > ADAPTIVE_DROP_LOAD ? 1 - ADAPTIVE_DROP_LOAD / load : 0;
+    if (ratio <= 0) {
+        if (vo_c->drop_acc > 0)
+            mp_decoder_wrapper_set_frame_drops(dec, 0);
+        vo_c->drop_acc = 0;
+        return;
+    }
+
+    int drops = 0;
+    vo_c->drop_acc += ratio;
+    if (vo_c->drop_acc >= 1) {
+        drops = vo_c->drop_acc;
+        vo_c->drop_acc -= drops;
+    }
+
+    // If A/V sync still lags (estimate off, or sudden load), catch up.
+    if (mpctx->audio_status == STATUS_PLAYING && !ao_untimed(mpctx->ao)) {
+        drops = MPMAX(drops,
+            MPCLAMP((mpctx->last_av_difference - 0.010) / frame_time, 0, 100));
+    }
+
+    MP_STATS(mpctx, "value %f framedrop-load", load);
+    if (drops)
+        mp_decoder_wrapper_set_frame_drops(dec, drops);
+}
+
 /* Modify video timing to match the audio timeline. There are two main
  * reasons this is needed. First, video and audio can start from different
  * positions at beginning of file or after a seek (MPlayer starts both
@@ -505,6 +736,7 @@ static int video_output_image(struct MPContext *mpctx, bool *logical_eof)
             r = VD_EOF;
         } else if (frame.type == MP_FRAME_VIDEO) {
             img = frame.data;
+            img->filter_time = mp_time_us();
         } else {
             MP_ERR(mpctx, "unexpected frame type %s\n",
                    mp_frame_type_str(frame.type));
@@ -1222,6 +1454,10 @@ void write_video(struct MPContext *mpctx)
 
     check_framedrop(mpctx, vo_c);
 
+    if ((opts->frame_dropping & 4) && mpctx->video_status == STATUS_PLAYING &&
+        !mpctx->paused && vo_c->track && vo_c->track->dec)
+        check_framedrop_adaptive(mpctx, vo_c);
+
     // The frames were shifted down; "initialize" the new first entry.
     if (mpctx->num_next_frames >= 1)
         handle_new_frame(mpctx);
@@ -0,0 +1,193 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Producer/consumer stress test for the lock-free FIFO in f_async_queue.c.
+// The queue internals are used directly (instead of going through filter
+// graphs), so the producer and consumer threads hit push_frame()/pop_frame()
+// as often as possible. Run with "make test".
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "filters/f_async_queue.c"
+#include "osdep/timer.h"
+
+#define NUM_PAIRS 2         // independent queues, sharing a byte budget
+#define NUM_ROUNDS 40
+#define ROUND_FRAMES 20000  // frames passed through each queue per round
+
+#define CHECK(x) do {                                                       \
+        if (!(x)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #x);                                                    \
+            abort();                                                        \
+        }                                                                   \
+    } while (0)
+
+struct pair {
+    struct mp_async_queue *queue;
+    pthread_t producer, consumer;
+    int64_t max_frames; // max_samples of the current round
+};
+
+static mp_atomic_int64 shared_bytes;
+
+// Yield now and then, so that both ends see the queue in all states (empty,
+// full, crossing chunk boundaries) instead of running in lockstep.
+static void maybe_yield(uint32_t *rnd)
+{
+    *rnd = *rnd * 1103515245 + 12345;
+    if ((*rnd >> 16) % 64 == 0)
+        sched_yield();
+}
+
+static void *producer(void *arg)
+{
+    struct pair *p = arg;
+    struct async_queue *q = p->queue->q;
+    uint32_t rnd = (uintptr_t)p;
+
+    for (int n = 0; n < ROUND_FRAMES;) {
+        pthread_mutex_lock(&q->in_lock);
+        bool full = is_full(q);
+        if (!full) {
+            struct mp_aframe *aframe = mp_aframe_create();
+            CHECK(aframe);
+            mp_aframe_set_pts(aframe, n++);
+            push_frame(q, MAKE_FRAME(MP_FRAME_AUDIO, aframe));
+        }
+        // The consumer can only make the queue smaller.
+        int frames = get_frames(q);
+        CHECK(frames >= 0 && frames <= p->max_frames);
+        pthread_mutex_unlock(&q->in_lock);
+        if (full) {
+            sched_yield();
+        } else {
+            maybe_yield(&rnd);
+        }
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    struct pair *p = arg;
+    struct async_queue *q = p->queue->q;
+    uint32_t rnd = (uintptr_t)p ^ 0xffff;
+
+    for (int n = 0; n < ROUND_FRAMES;) {
+        struct mp_frame frame;
+        pthread_mutex_lock(&q->out_lock);
+        bool got = pop_frame(q, &frame);
+        pthread_mutex_unlock(&q->out_lock);
+        if (!got) {
+            sched_yield();
+            continue;
+        }
+        CHECK(frame.type == MP_FRAME_AUDIO);
+        CHECK(mp_frame_get_pts(frame) == n);
+        mp_frame_unref(&frame);
+        n++;
+        maybe_yield(&rnd);
+    }
+    return NULL;
+}
+
+static struct mp_async_queue_config make_config(struct pair *p, bool shared)
+{
+    return (struct mp_async_queue_config){
+        .max_bytes = INT64_MAX,
+        .max_samples = p->max_frames,
+        .shared_bytes = shared ? &shared_bytes : NULL,
+        .max_shared_bytes = 4096, // a few empty frames
+    };
+}
+
+static void check_empty(struct async_queue *q)
+{
+    CHECK(get_frames(q) == 0);
+    CHECK(atomic_load(&q->samples_size) == 0);
+    CHECK(atomic_load(&q->byte_size) == 0);
+    CHECK(atomic_load(&q->eof_count) == 0);
+}
+
+int main(void)
+{
+    mp_time_init();
+
+    struct pair pairs[NUM_PAIRS] = {0};
+    for (int i = 0; i < NUM_PAIRS; i++)
+        pairs[i].queue = mp_async_queue_create();
+
+    uint32_t rnd = 1;
+    int64_t start = mp_time_us();
+    for (int round = 0; round < NUM_ROUNDS; round++) {
+        for (int i = 0; i < NUM_PAIRS; i++) {
+            struct pair *p = &pairs[i];
+            rnd = rnd * 1103515245 + 12345;
+            // From a single frame up to several chunks.
+            p->max_frames = 1 + (rnd >> 16) % (CHUNK_FRAMES * 4);
+            mp_async_queue_set_config(p->queue, make_config(p, round % 2));
+            CHECK(pthread_create(&p->producer, NULL, producer, p) == 0);
+            CHECK(pthread_create(&p->consumer, NULL, consumer, p) == 0);
+        }
+
+        // Move the queues between the shared counter and none while they're
+        // in use; the counter must still add up in the end.
+        for (int n = 0; n < 20; n++) {
+            for (int i = 0; i < NUM_PAIRS; i++) {
+                mp_async_queue_set_config(pairs[i].queue,
+                                          make_config(&pairs[i], n % 2));
+            }
+            mp_sleep_us(500);
+        }
+
+        for (int i = 0; i < NUM_PAIRS; i++) {
+            CHECK(pthread_join(pairs[i].producer, NULL) == 0);
+            CHECK(pthread_join(pairs[i].consumer, NULL) == 0);
+            check_empty(pairs[i].queue->q);
+        }
+        CHECK(atomic_load(&shared_bytes) == 0);
+
+        // Reset with frames still queued, as on seeks.
+        for (int i = 0; i < NUM_PAIRS; i++) {
+            struct async_queue *q = pairs[i].queue->q;
+            mp_async_queue_set_config(pairs[i].queue,
+                                      make_config(&pairs[i], true));
+            pthread_mutex_lock(&q->in_lock);
+            for (int n = 0; n < round % (CHUNK_FRAMES + 2); n++) {
+                struct mp_aframe *aframe = mp_aframe_create();
+                CHECK(aframe);
+                push_frame(q, MAKE_FRAME(MP_FRAME_AUDIO, aframe));
+            }
+            push_frame(q, MP_EOF_FRAME);
+            pthread_mutex_unlock(&q->in_lock);
+            mp_async_queue_reset(pairs[i].queue);
+            check_empty(q);
+        }
+        CHECK(atomic_load(&shared_bytes) == 0);
+    }
+
+    for (int i = 0; i < NUM_PAIRS; i++)
+        talloc_free(pairs[i].queue);
+
+    double secs = (mp_time_us() - start) / 1e6;
+    printf("async_queue: %d frames through %d queues in %.2f s: ok\n",
+           NUM_ROUNDS * ROUND_FRAMES * NUM_PAIRS, NUM_PAIRS, secs);
+    return 0;
+}
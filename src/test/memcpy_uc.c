@@ -0,0 +1,149 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmark memcpy_pic_uc() against a plain memcpy() loop, copying a 1080p
+// NV12 frame out of a padded surface. Run with "make bench", or as
+//
+//      test/memcpy_uc [/dev/dri/cardN]
+//
+// With a DRM device, the source is a dumb buffer mapped from it, which many
+// drivers map write-combined, like the surfaces memcpy_uc() is meant for.
+// Otherwise, normal (cached) memory is used, where both should be similar.
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if HAVE_DRM
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+#include <drm_mode.h>
+#endif
+
+#include "video/memcpy_uc.h"
+
+#define WIDTH 1920
+#define HEIGHT (1080 * 3 / 2) // luma plus interleaved chroma
+#define SRC_STRIDE 2048
+#define ITERATIONS 50
+
+static int64_t time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
+}
+
+static uint8_t *map_dumb_buffer(const char *path, int *stride)
+{
+#if HAVE_DRM
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct drm_mode_create_dumb create = {
+        .width = SRC_STRIDE,
+        .height = HEIGHT,
+        .bpp = 8,
+    };
+    if (ioctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0) {
+        perror("DRM_IOCTL_MODE_CREATE_DUMB");
+        return NULL;
+    }
+    struct drm_mode_map_dumb map = { .handle = create.handle };
+    if (ioctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map) < 0) {
+        perror("DRM_IOCTL_MODE_MAP_DUMB");
+        return NULL;
+    }
+    void *ptr = mmap(NULL, create.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, map.offset);
+    if (ptr == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    // The buffer stays mapped until the process exits.
+    *stride = create.pitch;
+    return ptr;
+#else
+    fprintf(stderr, "Built without DRM support.\n");
+    return NULL;
+#endif
+}
+
+static void copy_memcpy(uint8_t *dst, const uint8_t *src, int src_stride)
+{
+    for (int y = 0; y < HEIGHT; y++)
+        memcpy(dst + y * WIDTH, src + y * src_stride, WIDTH);
+}
+
+static void copy_uc(uint8_t *dst, const uint8_t *src, int src_stride)
+{
+    memcpy_pic_uc(dst, src, WIDTH, HEIGHT, WIDTH, src_stride);
+}
+
+// Returns the throughput in MB/s, or -1 if the copy was wrong.
+static double run(void (*copy)(uint8_t *, const uint8_t *, int), uint8_t *dst,
+                  const uint8_t *src, int src_stride, const uint8_t *ref)
+{
+    copy(dst, src, src_stride); // warm up
+    int64_t start = time_ns();
+    for (int n = 0; n < ITERATIONS; n++)
+        copy(dst, src, src_stride);
+    double secs = (time_ns() - start) / 1e9;
+    if (memcmp(dst, ref, WIDTH * HEIGHT))
+        return -1;
+    return (double)WIDTH * HEIGHT * ITERATIONS / 1e6 / secs;
+}
+
+int main(int argc, char *argv[])
+{
+    int src_stride = SRC_STRIDE;
+    uint8_t *src = argc > 1 ? map_dumb_buffer(argv[1], &src_stride)
+                            : aligned_alloc(64, SRC_STRIDE * HEIGHT);
+    uint8_t *dst = malloc(WIDTH * HEIGHT);
+    uint8_t *ref = malloc(WIDTH * HEIGHT);
+    if (!src || !dst || !ref)
+        return 1;
+
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++)
+            ref[y * WIDTH + x] = x * 7 + y * 13;
+        memcpy(src + y * src_stride, ref + y * WIDTH, WIDTH);
+    }
+
+    printf("%dx%d bytes, %s source, stride %d, %d iterations\n", WIDTH,
+           HEIGHT, argc > 1 ? argv[1] : "malloc'ed", src_stride, ITERATIONS);
+
+    double base = run(copy_memcpy, dst, src, src_stride, ref);
+    memset(dst, 0, WIDTH * HEIGHT);
+    double uc = run(copy_uc, dst, src, src_stride, ref);
+    if (base < 0 || uc < 0) {
+        fprintf(stderr, "Copied data is wrong.\n");
+        return 1;
+    }
+
+    printf("memcpy:        %8.1f MB/s\n", base);
+    printf("memcpy_pic_uc: %8.1f MB/s (%.2fx)\n", uc, uc / base);
+    return 0;
+}
@@ -36,11 +36,13 @@
 #include "options/m_config.h"
 #include "options/options.h"
 #include "misc/bstr.h"
+#include "osdep/timer.h"
 #include "common/av_common.h"
 #include "common/codecs.h"
 
 #include "video/fmt-conversion.h"
 
+#include "filters/f_decoder_pool.h"
 #include "filters/f_decoder_wrapper.h"
 #include "filters/filter_internal.h"
 #include "video/hwdec.h"
@@ -188,6 +190,9 @@ typedef struct lavc_ctx {
     bool intra_only;
     int framedrop_flags;
 
+    int64_t decode_busy;        // time spent in libavcodec since the last frame
+    double avg_decode_time;     // per decoded frame, in seconds; <0 if unknown
+
     bool hw_probing;
     struct demux_packet **sent_packets;
     int num_sent_packets;
@@ -210,9 +215,15 @@ typedef struct lavc_ctx {
     int hwdec_fail_count;
 
     struct mp_image_pool *hwdec_swpool;
+    bool hwdec_map; // try mapping instead of copying with -copy hwdecs
 
     AVBufferRef *cached_hw_frames_ctx;
 
+    // Decoder pool key of the current context, and a context taken from the
+    // pool by select_and_set_hwdec() for use by init_avctx().
+    bstr pool_key;
+    AVCodecContext *pooled_avctx;
+
     // --- The following fields are protected by dr_lock.
     pthread_mutex_t dr_lock;
     bool dr_failed;
@@ -462,6 +473,48 @@ static AVBufferRef *hwdec_create_dev(struct mp_filter *vd,
     return NULL;
 }
 
+// Key for mp_decoder_pool, covering everything init_avctx() depends on.
+//  hwdec: NULL for software decoding
+static bstr get_pool_key(struct mp_filter *vd, void *ta_parent,
+                         struct hwdec_info *hwdec)
+{
+    vd_ffmpeg_ctx *ctx = vd->priv;
+    struct vd_lavc_params *o = ctx->opts;
+
+    bool dr = !hwdec && ctx->vo && o->dr;
+    bool vo_film_grain = ctx->vo && (ctx->vo->driver->caps & VO_CAP_FILM_GRAIN);
+    bstr key = mp_decoder_pool_key(ta_parent,
+                                   hwdec ? hwdec->codec->name : ctx->decoder,
+                                   ctx->codec);
+    bstr_xappend_asprintf(ta_parent, &key, "%s;%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d;",
+                          hwdec ? hwdec->name : "", dr, o->threads, o->fast,
+                          o->bitexact, o->show_all, o->skip_loop_filter,
+                          o->skip_idct, o->skip_frame, o->film_grain,
+                          vo_film_grain, o->check_hw_profile, o->old_x264);
+    for (int n = 0; o->avopts && o->avopts[n]; n++)
+        bstr_xappend_asprintf(ta_parent, &key, "%s;", o->avopts[n]);
+    return key;
+}
+
+// Set the pool key for the given hwdec (NULL: software decoding), and try to
+// take an idle context (and its device) for it from the decoder pool.
+static bool take_pooled_avctx(struct mp_filter *vd, struct hwdec_info *hwdec)
+{
+    vd_ffmpeg_ctx *ctx = vd->priv;
+
+    talloc_free(ctx->pool_key.start);
+    ctx->pool_key = get_pool_key(vd, ctx, hwdec);
+
+    assert(!ctx->pooled_avctx);
+    AVBufferRef *dev = NULL;
+    if (!mp_decoder_pool_get(vd->global, ctx->pool_key, &ctx->pooled_avctx,
+                             &dev))
+        return false;
+    av_buffer_unref(&ctx->hwdec_dev);
+    ctx->hwdec_dev = dev;
+    return true;
+}
+
 // Select if and which hwdec to use. Also makes sure to get the decode device.
 static void select_and_set_hwdec(struct mp_filter *vd)
 {
@@ -541,7 +594,9 @@ static void select_and_set_hwdec(struct mp_filter *vd)
                     continue;
                 }
 
-                if (hwdec->lavc_device) {
+                if (hwdec->copying && take_pooled_avctx(vd, hwdec)) {
+                    // Context and device were reused; nothing to create.
+                } else if (hwdec->lavc_device) {
                     ctx->hwdec_dev = hwdec_create_dev(vd, hwdec, hwdec_auto);
                     if (!ctx->hwdec_dev) {
                         MP_VERBOSE(vd, "Could not create device.\n");
@@ -694,6 +749,30 @@ static void init_avctx(struct mp_filter *vd)
 
     ctx->hwdec_failed = false;
     ctx->hwdec_request_reinit = false;
+
+    if (!ctx->use_hwdec)
+        take_pooled_avctx(vd, NULL);
+
+    if (ctx->pooled_avctx) {
+        // Already opened with the same parameters and options; it only needs
+        // to be attached to this decoder.
+        ctx->avctx = ctx->pooled_avctx;
+        ctx->pooled_avctx = NULL;
+        ctx->avctx->opaque = vd;
+        ctx->avctx->pkt_timebase = ctx->codec_timebase;
+        ctx->pic = av_frame_alloc();
+        ctx->avpkt = av_packet_alloc();
+        if (!ctx->pic || !ctx->avpkt)
+            goto error;
+        if (ctx->use_hwdec) {
+            if (ctx->hwdec.copying)
+                ctx->max_delay_queue = HWDEC_DELAY_QUEUE_COUNT;
+            ctx->hw_probing = true;
+        }
+        ctx->skip_frame = ctx->avctx->skip_frame;
+        goto opened;
+    }
+
     ctx->avctx = avcodec_alloc_context3(lavc_codec);
     AVCodecContext *avctx = ctx->avctx;
     if (!ctx->avctx)
@@ -817,14 +896,15 @@ static void init_avctx(struct mp_filter *vd)
     if (avcodec_open2(avctx, lavc_codec, NULL) < 0)
         goto error;
 
+opened:
     // Sometimes, the first packet contains information required for correct
     // decoding of the rest of the stream. The only currently known case is the
     // x264 build number (encoded in a SEI element), needed to enable a
     // workaround for broken 4:4:4 streams produced by older x264 versions.
     if (lavc_codec->id == AV_CODEC_ID_H264 && c->first_packet) {
         mp_set_av_packet(ctx->avpkt, c->first_packet, &ctx->codec_timebase);
-        avcodec_send_packet(avctx, ctx->avpkt);
-        avcodec_receive_frame(avctx, ctx->pic);
+        avcodec_send_packet(ctx->avctx, ctx->avpkt);
+        avcodec_receive_frame(ctx->avctx, ctx->pic);
         av_frame_unref(ctx->pic);
         avcodec_flush_buffers(ctx->avctx);
     }
@@ -875,6 +955,7 @@ static void uninit_avctx(struct mp_filter *vd)
     av_buffer_unref(&ctx->cached_hw_frames_ctx);
 
     avcodec_free_context(&ctx->avctx);
+    avcodec_free_context(&ctx->pooled_avctx);
 
     av_buffer_unref(&ctx->hwdec_dev);
 
@@ -1141,7 +1222,9 @@ static int send_packet(struct mp_filter *vd, struct demux_packet *pkt)
 
     mp_set_av_packet(ctx->avpkt, pkt, &ctx->codec_timebase);
 
+    int64_t start = mp_time_us();
     int ret = avcodec_send_packet(avctx, pkt ? ctx->avpkt : NULL);
+    ctx->decode_busy += mp_time_us() - start;
     if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
         return ret;
 
@@ -1184,7 +1267,9 @@ static int decode_frame(struct mp_filter *vd)
     if (ctx->num_requeue_packets)
         send_queued_packet(vd);
 
+    int64_t start = mp_time_us();
     int ret = avcodec_receive_frame(avctx, ctx->pic);
+    ctx->decode_busy += mp_time_us() - start;
     if (ret < 0) {
         if (ret == AVERROR_EOF) {
             // If flushing was initialized earlier and has ended now, make it
@@ -1222,6 +1307,12 @@ static int decode_frame(struct mp_filter *vd)
 
     ctx->hwdec_fail_count = 0;
 
+    // Includes the cost of packets skipped by framedropping, which is small.
+    double t = ctx->decode_busy / 1e6;
+    ctx->avg_decode_time = ctx->avg_decode_time < 0 ? t
+                         : ctx->avg_decode_time * 0.9 + t * 0.1;
+    ctx->decode_busy = 0;
+
     mpi->pts = mp_pts_from_av(ctx->pic->pts, &ctx->codec_timebase);
     mpi->dts = mp_pts_from_av(ctx->pic->pkt_dts, &ctx->codec_timebase);
 
@@ -1288,7 +1379,9 @@ static int receive_frame(struct mp_filter *vd, struct mp_frame *out_frame)
         return AVERROR_UNKNOWN;
 
     if (ctx->use_hwdec && ctx->hwdec.copying && res->hwctx) {
-        struct mp_image *sw = mp_image_hw_download(res, ctx->hwdec_swpool);
+        struct mp_image *sw = ctx->hwdec_map ? mp_image_hw_map_dmabuf(res) : NULL;
+        if (!sw)
+            sw = mp_image_hw_download(res, ctx->hwdec_swpool);
         mp_image_unrefp(&res);
         res = sw;
         if (!res) {
@@ -1344,6 +1437,11 @@ static int control(struct mp_filter *vd, enum dec_ctrl cmd, void *arg)
         *(char **)arg = ctx->use_hwdec ? ctx->hwdec.method_name : NULL;
         return CONTROL_TRUE;
     }
+    case VDCTRL_GET_DECODE_TIME:
+        if (ctx->avg_decode_time < 0)
+            break;
+        *(double *)arg = ctx->avg_decode_time;
+        return CONTROL_TRUE;
     case VDCTRL_FORCE_HWDEC_FALLBACK:
         if (ctx->use_hwdec) {
             force_fallback(vd);
@@ -1372,12 +1470,24 @@ static void vd_lavc_reset(struct mp_filter *vd)
 
     ctx->state = (struct lavc_state){0};
     ctx->framedrop_flags = 0;
+    ctx->decode_busy = 0;
 }
 
 static void vd_lavc_destroy(struct mp_filter *vd)
 {
     vd_ffmpeg_ctx *ctx = vd->priv;
 
+    // Keep the context for a later decoder with the same parameters. Contexts
+    // using a device owned by the VO can't outlive it, so only software and
+    // copying hwdecs are kept.
+    if (ctx->avctx && avcodec_is_open(ctx->avctx) && !ctx->hwdec_failed &&
+        (!ctx->use_hwdec || ctx->hwdec.copying))
+    {
+        flush_all(vd);
+        mp_decoder_pool_put(vd->global, ctx->pool_key, &ctx->avctx,
+                            &ctx->hwdec_dev);
+    }
+
     uninit_avctx(vd);
 
     pthread_mutex_destroy(&ctx->dr_lock);
@@ -1410,8 +1520,17 @@ static struct mp_decoder *create(struct mp_filter *parent,
     ctx->opts = ctx->opts_cache->opts;
     ctx->codec = codec;
     ctx->decoder = talloc_strdup(ctx, decoder);
+    ctx->avg_decode_time = -1;
     ctx->hwdec_swpool = mp_image_pool_new(ctx);
     ctx->dr_pool = mp_image_pool_new(ctx);
+    mp_image_pool_enable_stats(ctx->hwdec_swpool, vd->global,
+                               "image-pool/hwdec-copy");
+    mp_image_pool_enable_stats(ctx->dr_pool, vd->global, "image-pool/dr");
+
+    struct filter_opts *filter_opts =
+        mp_get_config_group(NULL, vd->global, &filter_conf);
+    ctx->hwdec_map = filter_opts->hwdownload_map;
+    talloc_free(filter_opts);
 
     ctx->public.f = vd;
     ctx->public.control = control;
@@ -428,7 +428,8 @@ static bool init(struct mp_filter *vd)
         goto fail;
     }
 
-    ctx->numFrameBuffers += ctx->vo->opts->swapchain_depth + 25;
+    ctx->numFrameBuffers += ctx->vo->opts->swapchain_depth +
+                            ctx->vo->opts->render_ahead + 25;
 
     ctx->codecParams->maxWidth = ctx->frameWidth;
     ctx->codecParams->maxHeight = ctx->frameHeight;
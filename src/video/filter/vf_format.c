@@ -244,4 +244,5 @@ const struct mp_user_filter_entry vf_format = {
         .options = vf_opts_fields,
     },
     .create = vf_format_create,
+    .async_safe = true,
 };
@@ -161,4 +161,5 @@ const struct mp_user_filter_entry vf_sub = {
         .options = vf_opts_fields,
     },
     .create = vf_sub_create,
+    .async_safe = true,
 };
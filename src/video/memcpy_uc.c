@@ -0,0 +1,142 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_UC_SSE4 1
+#include <smmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_UC_NEON 1
+#include <arm_neon.h>
+#endif
+
+#include "memcpy_uc.h"
+
+// Uncached reads are most efficient if a whole cache line worth of data is
+// requested at once, so the kernels below always load 64 bytes per iteration.
+#define CHUNK 64
+
+#if HAVE_UC_SSE4
+
+// MOVNTDQA fetches a full line into a streaming load buffer on WC memory, so
+// the 4 loads of a chunk result in a single memory transaction.
+__attribute__((target("sse4.1")))
+static void copy_chunks_sse4(uint8_t *dst, const uint8_t *src, size_t num)
+{
+    _mm_mfence();
+    for (size_t n = 0; n < num; n++) {
+        __m128i x0 = _mm_stream_load_si128((__m128i *)(src + 0));
+        __m128i x1 = _mm_stream_load_si128((__m128i *)(src + 16));
+        __m128i x2 = _mm_stream_load_si128((__m128i *)(src + 32));
+        __m128i x3 = _mm_stream_load_si128((__m128i *)(src + 48));
+        _mm_storeu_si128((__m128i *)(dst + 0), x0);
+        _mm_storeu_si128((__m128i *)(dst + 16), x1);
+        _mm_storeu_si128((__m128i *)(dst + 32), x2);
+        _mm_storeu_si128((__m128i *)(dst + 48), x3);
+        src += CHUNK;
+        dst += CHUNK;
+    }
+}
+
+static bool have_sse4(void)
+{
+    static int cached = -1;
+    if (cached < 0) {
+        __builtin_cpu_init();
+        cached = !!__builtin_cpu_supports("sse4.1");
+    }
+    return cached;
+}
+
+#endif
+
+#if HAVE_UC_NEON
+
+// Issue all loads of a chunk before the stores, so they can be merged into
+// burst transfers.
+static void copy_chunks_neon(uint8_t *dst, const uint8_t *src, size_t num)
+{
+    for (size_t n = 0; n < num; n++) {
+        uint8x16_t x0 = vld1q_u8(src + 0);
+        uint8x16_t x1 = vld1q_u8(src + 16);
+        uint8x16_t x2 = vld1q_u8(src + 32);
+        uint8x16_t x3 = vld1q_u8(src + 48);
+        vst1q_u8(dst + 0, x0);
+        vst1q_u8(dst + 16, x1);
+        vst1q_u8(dst + 32, x2);
+        vst1q_u8(dst + 48, x3);
+        src += CHUNK;
+        dst += CHUNK;
+    }
+}
+
+#endif
+
+void memcpy_uc(void *dst, const void *src, size_t size)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+#if HAVE_UC_SSE4
+    if (size >= CHUNK && have_sse4()) {
+        // Streaming loads require 16 byte alignment.
+        size_t head = (16 - ((uintptr_t)s & 15)) & 15;
+        memcpy(d, s, head);
+        d += head;
+        s += head;
+        size -= head;
+        size_t num = size / CHUNK;
+        copy_chunks_sse4(d, s, num);
+        d += num * CHUNK;
+        s += num * CHUNK;
+        size -= num * CHUNK;
+    }
+#elif HAVE_UC_NEON
+    if (size >= CHUNK) {
+        size_t num = size / CHUNK;
+        copy_chunks_neon(d, s, num);
+        d += num * CHUNK;
+        s += num * CHUNK;
+        size -= num * CHUNK;
+    }
+#endif
+
+    memcpy(d, s, size);
+}
+
+void memcpy_pic_uc(void *dst, const void *src, int bytesPerLine, int height,
+                   int dstStride, int srcStride)
+{
+    if (bytesPerLine == dstStride && dstStride == srcStride && height) {
+        if (srcStride < 0) {
+            src = (uint8_t*)src + (height - 1) * srcStride;
+            dst = (uint8_t*)dst + (height - 1) * dstStride;
+            srcStride = -srcStride;
+        }
+
+        memcpy_uc(dst, src, srcStride * (height - 1) + bytesPerLine);
+    } else {
+        for (int i = 0; i < height; i++) {
+            memcpy_uc(dst, src, bytesPerLine);
+            src = (uint8_t*)src + srcStride;
+            dst = (uint8_t*)dst + dstStride;
+        }
+    }
+}
@@ -0,0 +1,30 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+// Like memcpy(), but optimized for reading from uncached or write-combined
+// memory, such as mapped hardware surfaces (where plain memcpy() is often an
+// order of magnitude slower). Uses SSE4.1 streaming loads on x86 (if supported
+// by the CPU) and wide NEON loads on ARM, and falls back to memcpy() otherwise.
+void memcpy_uc(void *dst, const void *src, size_t size);
+
+// Like memcpy_pic(), but with memcpy_uc().
+void memcpy_pic_uc(void *dst, const void *src, int bytesPerLine, int height,
+                   int dstStride, int srcStride);
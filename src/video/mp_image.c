@@ -38,6 +38,7 @@
 #include "common/av_common.h"
 #include "common/common.h"
 #include "hwdec.h"
+#include "memcpy_uc.h"
 #include "mp_image.h"
 #include "sws_utils.h"
 #include "fmt-conversion.h"
@@ -484,8 +485,14 @@ void mp_image_copy(struct mp_image *dst, struct mp_image *src)
     for (int n = 0; n < dst->num_planes; n++) {
         int line_bytes = (mp_image_plane_w(dst, n) * dst->fmt.bpp[n] + 7) / 8;
         int plane_h = mp_image_plane_h(dst, n);
-        memcpy_pic(dst->planes[n], src->planes[n], line_bytes, plane_h,
-                   dst->stride[n], src->stride[n]);
+        // Memory of mapped hw surfaces is typically uncached.
+        if (src->hw_surf) {
+            memcpy_pic_uc(dst->planes[n], src->planes[n], line_bytes, plane_h,
+                          dst->stride[n], src->stride[n]);
+        } else {
+            memcpy_pic(dst->planes[n], src->planes[n], line_bytes, plane_h,
+                       dst->stride[n], src->stride[n]);
+        }
     }
     if (dst->fmt.flags & MP_IMGFLAG_PAL)
         memcpy(dst->planes[1], src->planes[1], AVPALETTE_SIZE);
@@ -515,6 +522,8 @@ void mp_image_copy_attributes(struct mp_image *dst, struct mp_image *src)
     dst->pts = src->pts;
     dst->dts = src->dts;
     dst->pkt_duration = src->pkt_duration;
+    dst->decode_time = src->decode_time;
+    dst->filter_time = src->filter_time;
     dst->params.rotate = src->params.rotate;
     dst->params.stereo3d = src->params.stereo3d;
     dst->params.p_w = src->params.p_w;
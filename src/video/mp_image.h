@@ -91,6 +91,9 @@ typedef struct mp_image {
     double pts;
     /* only after decoder */
     double dts, pkt_duration;
+    /* mp_time_us() when the frame left the decoder/filter chain; 0 if unset
+       (only used for VO latency tracing) */
+    int64_t decode_time, filter_time;
     /* container reported FPS; can be incorrect, or 0 if unknown */
     double nominal_fps;
     /* for private use */
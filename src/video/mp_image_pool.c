@@ -19,7 +19,6 @@
 
 #include <stddef.h>
 #include <stdbool.h>
-#include <pthread.h>
 #include <assert.h>
 
 #include <libavutil/buffer.h>
@@ -27,44 +26,153 @@
 #include <libavutil/mem.h>
 #include <libavutil/pixdesc.h>
 
+#if HAVE_DRM
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/dma-buf.h>
+#include <drm_fourcc.h>
+#include <libavutil/hwcontext_drm.h>
+#endif
+
 #include "mpv_talloc.h"
 
 #include "common/common.h"
+#include "common/stats.h"
+#include "osdep/atomic.h"
 
 #include "fmt-conversion.h"
 #include "mp_image.h"
 #include "mp_image_pool.h"
 
-static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
-#define pool_lock() pthread_mutex_lock(&pool_mutex)
-#define pool_unlock() pthread_mutex_unlock(&pool_mutex)
+// Maximum number of distinct format/size combinations kept around.
+#define MAX_BUCKETS 4
 
 // Thread-safety: the pool itself is not thread-safe, but pool-allocated images
 // can be referenced and unreferenced from other threads. (As long as the image
-// destructors are thread-safe.)
+// destructors are thread-safe.) The only state shared with other threads is
+// image_flags.state, which is accessed atomically, so no lock is needed.
 
-struct mp_image_pool {
+// Images of a single format/size.
+struct pool_bucket {
+    int fmt, w, h;
     struct mp_image **images;
     int num_images;
+    int next;                   // index at which to start looking for a free image
+};
 
-    int fmt, w, h;
+struct mp_image_pool {
+    struct pool_bucket **buckets; // most recently used first
+    int num_buckets;
 
     mp_image_allocator allocator;
     void *allocator_ctx;
 
     bool use_lru;
     unsigned int lru_counter;
+
+    struct mp_image_pool_stats st;
+    struct stats_ctx *stats;
+};
+
+enum {
+    IMG_REFERENCED  = 1 << 0,   // outside mp_image reference exists
+    IMG_POOL_ALIVE  = 1 << 1,   // the mp_image_pool references this
 };
 
 // Used to gracefully handle the case when the pool is freed while image
 // references allocated from the image pool are still held by someone.
 struct image_flags {
-    // If both of these are false, the image must be freed.
-    bool referenced;            // outside mp_image reference exists
-    bool pool_alive;            // the mp_image_pool references this
+    // IMG_* bits. If neither is set, the image must be freed; whoever clears
+    // the last bit does it.
+    atomic_int state;
     unsigned int order;         // for LRU allocation (basically a timestamp)
 };
 
+static int64_t image_bytes(struct mp_image *img)
+{
+    int64_t bytes = 0;
+    for (int p = 0; p < MP_MAX_PLANES; p++) {
+        if (img->bufs[p])
+            bytes += img->bufs[p]->size;
+    }
+    return bytes;
+}
+
+static void update_stats(struct mp_image_pool *pool)
+{
+    if (!pool->stats)
+        return;
+    stats_value(pool->stats, "images", pool->st.num_images);
+    stats_size_value(pool->stats, "bytes", pool->st.bytes);
+}
+
+// Drop the pool's reference to the image. It's freed once it's unreferenced.
+static void release_image(struct mp_image_pool *pool, struct mp_image *img)
+{
+    struct image_flags *it = img->priv;
+    pool->st.num_images -= 1;
+    pool->st.bytes -= image_bytes(img);
+    int state = atomic_fetch_and(&it->state, ~IMG_POOL_ALIVE);
+    assert(state & IMG_POOL_ALIVE);
+    if (!(state & IMG_REFERENCED))
+        talloc_free(img);
+}
+
+static void remove_bucket(struct mp_image_pool *pool, int index)
+{
+    struct pool_bucket *b = pool->buckets[index];
+    for (int n = 0; n < b->num_images; n++)
+        release_image(pool, b->images[n]);
+    talloc_free(b);
+    MP_TARRAY_REMOVE_AT(pool->buckets, pool->num_buckets, index);
+}
+
+// Free the unused images of all buckets other than keep, and forget about
+// buckets which end up empty or exceed MAX_BUCKETS. Images which are still in
+// use stay in their bucket, in case the format/size is requested again, and are
+// freed by the first call after they were returned.
+static void trim_buckets(struct mp_image_pool *pool, struct pool_bucket *keep)
+{
+    for (int i = pool->num_buckets - 1; i >= 0; i--) {
+        struct pool_bucket *b = pool->buckets[i];
+        if (b == keep)
+            continue;
+        for (int n = b->num_images - 1; n >= 0; n--) {
+            struct mp_image *img = b->images[n];
+            struct image_flags *it = img->priv;
+            if (!(atomic_load(&it->state) & IMG_REFERENCED)) {
+                MP_TARRAY_REMOVE_AT(b->images, b->num_images, n);
+                release_image(pool, img);
+            }
+        }
+        b->next = 0;
+        if (!b->num_images || i >= MAX_BUCKETS)
+            remove_bucket(pool, i);
+    }
+    update_stats(pool);
+}
+
+static struct pool_bucket *find_bucket(struct mp_image_pool *pool, int fmt,
+                                       int w, int h, bool create)
+{
+    for (int n = 0; n < pool->num_buckets; n++) {
+        struct pool_bucket *b = pool->buckets[n];
+        if (b->fmt == fmt && b->w == w && b->h == h) {
+            // Move to front, so the stale ones are trimmed first.
+            MP_TARRAY_REMOVE_AT(pool->buckets, pool->num_buckets, n);
+            MP_TARRAY_INSERT_AT(pool, pool->buckets, pool->num_buckets, 0, b);
+            return b;
+        }
+    }
+    if (!create)
+        return NULL;
+    struct pool_bucket *b = talloc_ptrtype(pool, b);
+    *b = (struct pool_bucket){ .fmt = fmt, .w = w, .h = h };
+    MP_TARRAY_INSERT_AT(pool, pool->buckets, pool->num_buckets, 0, b);
+    return b;
+}
+
 static void image_pool_destructor(void *ptr)
 {
     struct mp_image_pool *pool = ptr;
@@ -82,19 +190,9 @@ struct mp_image_pool *mp_image_pool_new(void *tparent)
 
 void mp_image_pool_clear(struct mp_image_pool *pool)
 {
-    for (int n = 0; n < pool->num_images; n++) {
-        struct mp_image *img = pool->images[n];
-        struct image_flags *it = img->priv;
-        bool referenced;
-        pool_lock();
-        assert(it->pool_alive);
-        it->pool_alive = false;
-        referenced = it->referenced;
-        pool_unlock();
-        if (!referenced)
-            talloc_free(img);
-    }
-    pool->num_images = 0;
+    while (pool->num_buckets)
+        remove_bucket(pool, pool->num_buckets - 1);
+    update_stats(pool);
 }
 
 // This is the only function that is allowed to run in a different thread.
@@ -103,41 +201,36 @@ static void unref_image(void *opaque, uint8_t *data)
 {
     struct mp_image *img = opaque;
     struct image_flags *it = img->priv;
-    bool alive;
-    pool_lock();
-    assert(it->referenced);
-    it->referenced = false;
-    alive = it->pool_alive;
-    pool_unlock();
-    if (!alive)
+    int state = atomic_fetch_and(&it->state, ~IMG_REFERENCED);
+    assert(state & IMG_REFERENCED);
+    if (!(state & IMG_POOL_ALIVE))
         talloc_free(img);
 }
 
-// Return a new image of given format/size. Unlike mp_image_pool_get(), this
-// returns NULL if there is no free image of this format/size.
-struct mp_image *mp_image_pool_get_no_alloc(struct mp_image_pool *pool, int fmt,
-                                            int w, int h)
+static struct mp_image *get_free_image(struct mp_image_pool *pool, int fmt,
+                                       int w, int h)
 {
+    struct pool_bucket *b = find_bucket(pool, fmt, w, h, false);
+    if (!b)
+        return NULL;
+
     struct mp_image *new = NULL;
-    pool_lock();
-    for (int n = 0; n < pool->num_images; n++) {
-        struct mp_image *img = pool->images[n];
+    for (int i = 0; i < b->num_images; i++) {
+        int n = (b->next + i) % b->num_images;
+        struct mp_image *img = b->images[n];
         struct image_flags *img_it = img->priv;
-        assert(img_it->pool_alive);
-        if (!img_it->referenced) {
-            if (img->imgfmt == fmt && img->w == w && img->h == h) {
-                if (pool->use_lru) {
-                    struct image_flags *new_it = new ? new->priv : NULL;
-                    if (!new_it || new_it->order > img_it->order)
-                        new = img;
-                } else {
+        if (!(atomic_load(&img_it->state) & IMG_REFERENCED)) {
+            if (pool->use_lru) {
+                struct image_flags *new_it = new ? new->priv : NULL;
+                if (!new_it || new_it->order > img_it->order)
                     new = img;
-                    break;
-                }
+            } else {
+                new = img;
+                b->next = n + 1;
+                break;
             }
         }
     }
-    pool_unlock();
     if (!new)
         return NULL;
 
@@ -161,18 +254,45 @@ struct mp_image *mp_image_pool_get_no_alloc(struct mp_image_pool *pool, int fmt,
     }
 
     struct image_flags *it = new->priv;
-    assert(!it->referenced && it->pool_alive);
-    it->referenced = true;
+    int state = atomic_fetch_or(&it->state, IMG_REFERENCED);
+    assert(state == IMG_POOL_ALIVE);
     it->order = ++pool->lru_counter;
     return ref;
 }
 
+// Return a new image of given format/size. Unlike mp_image_pool_get(), this
+// returns NULL if there is no free image of this format/size.
+struct mp_image *mp_image_pool_get_no_alloc(struct mp_image_pool *pool, int fmt,
+                                            int w, int h)
+{
+    struct mp_image *new = get_free_image(pool, fmt, w, h);
+    // Images of other formats/sizes are returned at any time (possibly long
+    // after the last miss), so check for them while such buckets exist.
+    if (!new || pool->num_buckets > 1)
+        trim_buckets(pool, find_bucket(pool, fmt, w, h, false));
+    if (new) {
+        pool->st.hits += 1;
+        if (pool->stats)
+            stats_event(pool->stats, "hit");
+    } else {
+        pool->st.misses += 1;
+        if (pool->stats)
+            stats_event(pool->stats, "miss");
+    }
+    return new;
+}
+
 void mp_image_pool_add(struct mp_image_pool *pool, struct mp_image *new)
 {
     struct image_flags *it = talloc_ptrtype(new, it);
-    *it = (struct image_flags) { .pool_alive = true };
+    *it = (struct image_flags) {0};
+    atomic_init(&it->state, IMG_POOL_ALIVE);
     new->priv = it;
-    MP_TARRAY_APPEND(pool, pool->images, pool->num_images, new);
+    struct pool_bucket *b = find_bucket(pool, new->imgfmt, new->w, new->h, true);
+    MP_TARRAY_APPEND(b, b->images, b->num_images, new);
+    pool->st.num_images += 1;
+    pool->st.bytes += image_bytes(new);
+    update_stats(pool);
 }
 
 // Return a new image of given format/size. The only difference to
@@ -188,11 +308,6 @@ struct mp_image *mp_image_pool_get(struct mp_image_pool *pool, int fmt,
         return mp_image_alloc(fmt, w, h);
     struct mp_image *new = mp_image_pool_get_no_alloc(pool, fmt, w, h);
     if (!new) {
-        if (fmt != pool->fmt || w != pool->w || h != pool->h)
-            mp_image_pool_clear(pool);
-        pool->fmt = fmt;
-        pool->w = w;
-        pool->h = h;
         if (pool->allocator) {
             new = pool->allocator(pool->allocator_ctx, fmt, w, h);
         } else {
@@ -201,11 +316,27 @@ struct mp_image *mp_image_pool_get(struct mp_image_pool *pool, int fmt,
         if (!new)
             return NULL;
         mp_image_pool_add(pool, new);
-        new = mp_image_pool_get_no_alloc(pool, fmt, w, h);
+        new = get_free_image(pool, fmt, w, h);
     }
     return new;
 }
 
+// Return the pool's counters. Can be used to size memory limits.
+void mp_image_pool_get_stats(struct mp_image_pool *pool,
+                             struct mp_image_pool_stats *st)
+{
+    *st = pool->st;
+}
+
+// Also report the counters to the stats.c "perf-info" under the given prefix.
+void mp_image_pool_enable_stats(struct mp_image_pool *pool,
+                                struct mpv_global *global, const char *name)
+{
+    talloc_free(pool->stats);
+    pool->stats = stats_ctx_create(pool, global, name);
+    update_stats(pool);
+}
+
 // Like mp_image_new_copy(), but allocate the image out of the pool.
 // If pool==NULL, a plain copy is made (for convenience).
 // Returns NULL on OOM.
@@ -277,6 +408,44 @@ int mp_image_hw_download_get_sw_format(struct mp_image *src)
     return imgfmt;
 }
 
+// Copy src to dst by mapping the surface memory, and reading it with
+// memcpy_pic_uc() (via mp_image_copy()). Plain memcpy() as used by
+// av_hwframe_transfer_data() is very slow on the uncached memory of mapped
+// surfaces. Returns false if the surface can't be mapped to dst's format.
+static bool hw_download_mapped(struct mp_image *dst, struct mp_image *src)
+{
+    bool ok = false;
+    AVFrame *srcav = mp_image_to_av_frame(src);
+    AVFrame *map = av_frame_alloc();
+    if (!srcav || !map)
+        goto done;
+
+    map->format = imgfmt2pixfmt(dst->imgfmt);
+    if (av_hwframe_map(map, srcav, AV_HWFRAME_MAP_READ) < 0)
+        goto done;
+    if (pixfmt2imgfmt(map->format) != dst->imgfmt ||
+        map->width < src->w || map->height < src->h)
+        goto done;
+
+    struct mp_image tmp = {0};
+    mp_image_setfmt(&tmp, dst->imgfmt);
+    mp_image_set_size(&tmp, src->w, src->h);
+    for (int n = 0; n < tmp.num_planes; n++) {
+        tmp.planes[n] = map->data[n];
+        tmp.stride[n] = map->linesize[n];
+    }
+    tmp.hw_surf = true;
+
+    mp_image_set_size(dst, src->w, src->h);
+    mp_image_copy(dst, &tmp);
+    ok = true;
+
+done:
+    av_frame_free(&map);
+    av_frame_free(&srcav);
+    return ok;
+}
+
 // Copies the contents of the HW surface src to system memory and returns it.
 // If swpool is not NULL, it's used to allocate the target image.
 // src must be a hw surface with a AVHWFramesContext attached.
@@ -297,6 +466,11 @@ struct mp_image *mp_image_hw_download(struct mp_image *src,
     if (!dst)
         return NULL;
 
+    if (hw_download_mapped(dst, src)) {
+        mp_image_copy_attributes(dst, src);
+        return dst;
+    }
+
     // Target image must be writable, so unref it.
     AVFrame *dstav = mp_image_to_av_frame_and_unref(dst);
     if (!dstav)
@@ -321,6 +495,142 @@ struct mp_image *mp_image_hw_download(struct mp_image *src,
     return dst;
 }
 
+#if HAVE_DRM
+
+struct dmabuf_mapping {
+    AVFrame *drm_frame;     // owns the dma-buf FDs (or NULL)
+    struct mp_image *src;   // keeps the surface alive
+    int fds[AV_DRM_MAX_PLANES];
+    void *maps[AV_DRM_MAX_PLANES];
+    size_t sizes[AV_DRM_MAX_PLANES];
+    int num_maps;
+};
+
+static void dmabuf_sync(int fd, uint64_t flags)
+{
+    struct dma_buf_sync sync = { .flags = flags | DMA_BUF_SYNC_READ };
+    while (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) == -1 &&
+           (errno == EINTR || errno == EAGAIN));
+}
+
+static void dmabuf_unmap(void *arg)
+{
+    struct dmabuf_mapping *m = arg;
+    for (int n = 0; n < m->num_maps; n++) {
+        dmabuf_sync(m->fds[n], DMA_BUF_SYNC_END);
+        munmap(m->maps[n], m->sizes[n]);
+    }
+    av_frame_free(&m->drm_frame);
+    talloc_free(m->src);
+    talloc_free(m);
+}
+
+// Return a read-only software image, which references the memory of the
+// DRM-PRIME or VAAPI surface src directly (mmap() of the underlying dma-bufs).
+// This works only if the surface uses a linear layout, and the dma-bufs can be
+// mapped by the CPU. Returns NULL otherwise, in which case the caller should
+// use mp_image_hw_download().
+// Note that the surface is held as long as the returned image is referenced,
+// and that reading from it may be slow (uncached memory).
+struct mp_image *mp_image_hw_map_dmabuf(struct mp_image *src)
+{
+    int imgfmt = src->params.hw_subfmt;
+    struct mp_imgfmt_desc fmtdesc = mp_imgfmt_get_desc(imgfmt);
+    if (!imgfmt || !fmtdesc.num_planes)
+        return NULL;
+
+    struct dmabuf_mapping *m = talloc_zero(NULL, struct dmabuf_mapping);
+    const AVDRMFrameDescriptor *desc = NULL;
+
+    if (src->imgfmt == IMGFMT_DRMPRIME) {
+        desc = (void *)src->planes[0];
+    } else if (src->imgfmt == IMGFMT_VAAPI && src->hwctx) {
+        // Export the surface as DRM-PRIME (does not copy).
+        m->drm_frame = av_frame_alloc();
+        AVFrame *src_frame = mp_image_to_av_frame(src);
+        if (!m->drm_frame || !src_frame)
+            goto fail;
+        m->drm_frame->format = AV_PIX_FMT_DRM_PRIME;
+        int res = av_hwframe_map(m->drm_frame, src_frame, AV_HWFRAME_MAP_READ);
+        av_frame_free(&src_frame);
+        if (res < 0)
+            goto fail;
+        desc = (void *)m->drm_frame->data[0];
+    }
+    if (!desc || desc->nb_objects < 1 || desc->nb_objects > AV_DRM_MAX_PLANES)
+        goto fail;
+
+    // Tiled or compressed layouts would need detiling; let the copy path (i.e.
+    // the driver) deal with them.
+    for (int n = 0; n < desc->nb_objects; n++) {
+        uint64_t mod = desc->objects[n].format_modifier;
+        if (mod != DRM_FORMAT_MOD_LINEAR)
+            goto fail;
+    }
+
+    struct mp_image img = {0};
+    mp_image_setfmt(&img, imgfmt);
+    mp_image_set_size(&img, src->w, src->h);
+
+    for (int n = 0; n < desc->nb_objects; n++) {
+        const AVDRMObjectDescriptor *obj = &desc->objects[n];
+        void *ptr = mmap(NULL, obj->size, PROT_READ, MAP_SHARED, obj->fd, 0);
+        if (ptr == MAP_FAILED)
+            goto fail;
+        m->fds[n] = obj->fd;
+        m->maps[n] = ptr;
+        m->sizes[n] = obj->size;
+        m->num_maps++;
+        dmabuf_sync(obj->fd, DMA_BUF_SYNC_START);
+    }
+
+    // Planes may be spread over multiple layers (e.g. VAAPI exports R8/GR88
+    // layers for NV12).
+    int plane = 0;
+    for (int l = 0; l < desc->nb_layers; l++) {
+        const AVDRMLayerDescriptor *layer = &desc->layers[l];
+        for (int n = 0; n < layer->nb_planes; n++) {
+            const AVDRMPlaneDescriptor *pd = &layer->planes[n];
+            if (plane >= img.num_planes || pd->object_index >= m->num_maps)
+                goto fail;
+            int h = mp_image_plane_h(&img, plane);
+            if (pd->pitch < mp_image_plane_bytes(&img, plane, 0, img.w) ||
+                pd->offset + (size_t)pd->pitch * h > m->sizes[pd->object_index])
+                goto fail;
+            img.planes[plane] = (uint8_t *)m->maps[pd->object_index] + pd->offset;
+            img.stride[plane] = pd->pitch;
+            plane++;
+        }
+    }
+    if (plane != img.num_planes)
+        goto fail;
+
+    mp_image_copy_attributes(&img, src);
+    img.params.hw_subfmt = 0;
+
+    m->src = mp_image_new_ref(src);
+    if (!m->src)
+        goto fail;
+    // The new reference is marked read-only.
+    struct mp_image *dst = mp_image_new_custom_ref(&img, m, dmabuf_unmap);
+    if (!dst)
+        dmabuf_unmap(m);
+    return dst;
+
+fail:
+    dmabuf_unmap(m);
+    return NULL;
+}
+
+#else
+
+struct mp_image *mp_image_hw_map_dmabuf(struct mp_image *src)
+{
+    return NULL;
+}
+
+#endif
+
 bool mp_image_hw_upload(struct mp_image *hw_img, struct mp_image *src)
 {
     if (hw_img->w != src->w || hw_img->h != src->h)
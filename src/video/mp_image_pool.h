@@ -2,8 +2,17 @@
 #define MPV_MP_IMAGE_POOL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 struct mp_image_pool;
+struct mpv_global;
+
+struct mp_image_pool_stats {
+    uint64_t hits;      // requests served with a recycled image
+    uint64_t misses;    // requests which found no free image of that format/size
+    int num_images;     // images owned by the pool (free or in use)
+    int64_t bytes;      // memory held by these images
+};
 
 struct mp_image_pool *mp_image_pool_new(void *tparent);
 struct mp_image *mp_image_pool_get(struct mp_image_pool *pool, int fmt,
@@ -17,6 +26,11 @@ void mp_image_pool_set_lru(struct mp_image_pool *pool);
 struct mp_image *mp_image_pool_get_no_alloc(struct mp_image_pool *pool, int fmt,
                                             int w, int h);
 
+void mp_image_pool_get_stats(struct mp_image_pool *pool,
+                             struct mp_image_pool_stats *st);
+void mp_image_pool_enable_stats(struct mp_image_pool *pool,
+                                struct mpv_global *global, const char *name);
+
 typedef struct mp_image *(*mp_image_allocator)(void *data, int fmt, int w, int h);
 void mp_image_pool_set_allocator(struct mp_image_pool *pool,
                                  mp_image_allocator cb, void  *cb_data);
@@ -31,6 +45,8 @@ struct mp_image *mp_image_hw_download(struct mp_image *img,
 
 int mp_image_hw_download_get_sw_format(struct mp_image *img);
 
+struct mp_image *mp_image_hw_map_dmabuf(struct mp_image *src);
+
 bool mp_image_hw_upload(struct mp_image *hw_img, struct mp_image *src);
 
 struct AVBufferRef;
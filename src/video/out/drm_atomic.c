@@ -181,7 +181,8 @@ struct drm_atomic_context *drm_atomic_create_context(struct mp_log *log, int fd,
     int layercount = -1;
     int primary_id = 0;
     int overlay_id = 0;
-    int osd_id = 0;
+    uint32_t overlay_ids[16];
+    int num_overlay_ids = 0;
 
     uint64_t value;
 
@@ -260,8 +261,9 @@ struct drm_atomic_context *drm_atomic_create_context(struct mp_log *log, int fd,
                 if ((!overlay_id) && (value == DRM_PLANE_TYPE_OVERLAY))
                     overlay_id = plane_id;
 
-                else if ((!osd_id) && (value == DRM_PLANE_TYPE_OVERLAY))
-                    osd_id = plane_id;
+                if (value == DRM_PLANE_TYPE_OVERLAY &&
+                    num_overlay_ids < MP_ARRAY_SIZE(overlay_ids))
+                    overlay_ids[num_overlay_ids++] = plane_id;
 
                 if (layercount == draw_plane_idx) {
                     ctx->draw_plane = plane;
@@ -309,11 +311,20 @@ struct drm_atomic_context *drm_atomic_create_context(struct mp_log *log, int fd,
         mp_verbose(log, "Found drmprime plane with ID %d\n", ctx->drmprime_video_plane->id);
     }
 
-    // osd plane
-    if (!ctx->osd_plane) {
-        ctx->osd_plane = drm_object_create(log, ctx->fd, osd_id, DRM_MODE_OBJECT_PLANE);
-        mp_verbose(log, "Found osd plane with ID %d\n", ctx->osd_plane->id);
+    // osd plane: the first overlay plane not used for anything else
+    for (int i = 0; i < num_overlay_ids; i++) {
+        const uint32_t id = overlay_ids[i];
+        if (id == ctx->draw_plane->id ||
+            (ctx->drmprime_video_plane && id == ctx->drmprime_video_plane->id))
+            continue;
+        ctx->osd_plane = drm_object_create(log, ctx->fd, id, DRM_MODE_OBJECT_PLANE);
+        if (ctx->osd_plane) {
+            mp_verbose(log, "Using overlay plane %d as OSD plane\n", id);
+            break;
+        }
     }
+    if (!ctx->osd_plane)
+        mp_verbose(log, "No free overlay plane for the OSD\n");
 
     drmModeFreePlaneResources(plane_res);
     drmModeFreeResources(res);
@@ -336,6 +347,7 @@ void drm_atomic_destroy_context(struct drm_atomic_context *ctx)
     drm_object_free(ctx->connector);
     drm_object_free(ctx->draw_plane);
     drm_object_free(ctx->drmprime_video_plane);
+    drm_object_free(ctx->osd_plane);
     talloc_free(ctx);
 }
 
@@ -434,6 +446,8 @@ bool drm_atomic_save_old_state(struct drm_atomic_context *ctx)
         ret = false;
     if (!drm_atomic_save_plane_state(ctx->drmprime_video_plane, &ctx->old_state.drmprime_video_plane))
         ret = false;
+    if (!drm_atomic_save_plane_state(ctx->osd_plane, &ctx->old_state.osd_plane))
+        ret = false;
 
     ctx->old_state.saved = true;
 
@@ -464,6 +478,8 @@ bool drm_atomic_restore_old_state(drmModeAtomicReqPtr request, struct drm_atomic
         ret = false;
     if (!drm_atomic_restore_plane_state(request, ctx->drmprime_video_plane, &ctx->old_state.drmprime_video_plane))
         ret = false;
+    if (!drm_atomic_restore_plane_state(request, ctx->osd_plane, &ctx->old_state.osd_plane))
+        ret = false;
 
     ctx->old_state.saved = false;
 
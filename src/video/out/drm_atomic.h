@@ -58,6 +58,7 @@ struct drm_atomic_state {
     } crtc;
     struct drm_atomic_plane_state draw_plane;
     struct drm_atomic_plane_state drmprime_video_plane;
+    struct drm_atomic_plane_state osd_plane;
 };
 
 struct drm_object {
@@ -75,7 +76,7 @@ struct drm_atomic_context {
     struct drm_object *connector;
     struct drm_object *draw_plane;
     struct drm_object *drmprime_video_plane;
-    struct drm_object *osd_plane;
+    struct drm_object *osd_plane;     // free overlay plane, or NULL
 
     drmModeAtomicReq *request;
 
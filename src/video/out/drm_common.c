@@ -16,6 +16,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <signal.h>
 #include <sys/ioctl.h>
@@ -184,17 +185,12 @@ static void vt_switcher_destroy(struct vt_switcher *s)
     close(vt_switcher_pipe[1]);
 }
 
-static void vt_switcher_poll(struct vt_switcher *s, int timeout_ms)
+// Handle an event from the signal handlers; call when vt_switcher_pipe[0] is
+// readable.
+static void vt_switcher_dispatch(struct vt_switcher *s)
 {
-    struct pollfd fds[1] = {
-        { .events = POLLIN, .fd = vt_switcher_pipe[0] },
-    };
-    poll(fds, 1, timeout_ms);
-    if (!fds[0].revents)
-        return;
-
     unsigned char event;
-    if (read(fds[0].fd, &event, sizeof(event)) != sizeof(event))
+    if (read(vt_switcher_pipe[0], &event, sizeof(event)) != sizeof(event))
         return;
 
     switch (event) {
@@ -215,6 +211,16 @@ static void vt_switcher_poll(struct vt_switcher *s, int timeout_ms)
     }
 }
 
+static void vt_switcher_poll(struct vt_switcher *s, int timeout_ms)
+{
+    struct pollfd fds[1] = {
+        { .events = POLLIN, .fd = vt_switcher_pipe[0] },
+    };
+    poll(fds, 1, timeout_ms);
+    if (fds[0].revents)
+        vt_switcher_dispatch(s);
+}
+
 bool vo_drm_acquire_crtc(struct vo_drm_state *drm)
 {
     if (drm->active)
@@ -907,6 +913,7 @@ bool vo_drm_init(struct vo *vo)
         .mode = {{0}},
         .crtc_id = -1,
         .card_no = -1,
+        .wakeup_pipe = {-1, -1},
     };
 
     drm->opts = mp_get_config_group(drm, drm->vo->global, &drm_conf);
@@ -1006,6 +1013,11 @@ void vo_drm_uninit(struct vo *vo)
         drm_atomic_destroy_context(drm->atomic_context);
     }
 
+    for (int n = 0; n < 2; n++) {
+        if (drm->wakeup_pipe[n] >= 0)
+            close(drm->wakeup_pipe[n]);
+    }
+
     close(drm->fd);
     talloc_free(drm);
     vo->drm = NULL;
@@ -1193,10 +1205,62 @@ void vo_drm_set_monitor_par(struct vo *vo)
     MP_VERBOSE(drm, "Monitor pixel aspect: %g\n", vo->monitor_par);
 }
 
+// Dispatch pending DRM events, waiting at most timeout_ms for one to arrive.
+// If vt_events is set, VT switcher events are waited for and handled as well.
+static void handle_drm_events(struct vo_drm_state *drm, int timeout_ms,
+                              bool vt_events)
+{
+    struct pollfd fds[3] = {
+        { .events = POLLIN, .fd = drm->fd },
+        { .events = POLLIN, .fd = drm->wakeup_pipe[0] },
+        { .events = POLLIN, .fd = vt_switcher_pipe[0] },
+    };
+    // (Entries with a negative fd are ignored by poll().)
+    if (!vt_events || !drm->vt_switcher_active)
+        fds[2].fd = -1;
+    poll(fds, 3, timeout_ms);
+    if (fds[1].revents & POLLIN)
+        mp_flush_wakeup_pipe(drm->wakeup_pipe[0]);
+    if (fds[0].revents & POLLIN) {
+        const int ret = drmHandleEvent(drm->fd, &drm->ev);
+        if (ret != 0)
+            MP_ERR(drm, "drmHandleEvent failed: %i\n", ret);
+    }
+    // (After the flip event, so that a completed flip is not lost on release.)
+    if (fds[2].revents & POLLIN)
+        vt_switcher_dispatch(&drm->vt_switcher);
+}
+
+// Retire the frame that was on screen before a completed flip, and flip to
+// the next rendered frame if there is one. Never blocks.
+static void advance_swapchain(struct vo *vo)
+{
+    struct vo_drm_state *drm = vo->drm;
+    const struct vo_drm_swapchain_fns *fns = drm->swapchain;
+
+    if (drm->waiting_for_flip)
+        return;
+    if (drm->flip_queued) {
+        drm->flip_queued = false;
+        fns->dequeue(vo, 0);
+    }
+    if (fns->queue_len(vo) > 1)
+        drm->flip_queued = fns->queue_flip(vo);
+}
+
 void vo_drm_wait_events(struct vo *vo, int64_t until_time_us)
 {
     struct vo_drm_state *drm = vo->drm;
-    if (drm->vt_switcher_active) {
+    if (drm->swapchain && drm->waiting_for_flip) {
+        // Wait for the flip too, so that frames which were rendered ahead can
+        // be queued as soon as the previous one is on screen. VT switches are
+        // handled in the same wait.
+        int64_t wait_us = until_time_us - mp_time_us();
+        int timeout_ms = MPCLAMP((wait_us + 500) / 1000, 0, 10000);
+        handle_drm_events(drm, timeout_ms, true);
+        if (!drm->waiting_for_flip)
+            advance_swapchain(vo);
+    } else if (drm->vt_switcher_active) {
         int64_t wait_us = until_time_us - mp_time_us();
         int timeout_ms = MPCLAMP((wait_us + 500) / 1000, 0, 10000);
         vt_switcher_poll(&drm->vt_switcher, timeout_ms);
@@ -1222,9 +1286,63 @@ void vo_drm_wait_on_flip(struct vo_drm_state *drm)
     }
 }
 
+// Handle a page flip event if one is available, but never block.
+void vo_drm_poll_flip(struct vo_drm_state *drm)
+{
+    if (drm->waiting_for_flip)
+        handle_drm_events(drm, 0, false);
+}
+
+// Make flip_page() return without waiting for the page flip (by calling
+// vo_drm_flip_page_async()). Completion is then picked up by the next
+// flip_page(), or by vo_drm_wait_events() if the VO thread is idle.
+bool vo_drm_enable_async_flip(struct vo_drm_state *drm,
+                              const struct vo_drm_swapchain_fns *swapchain)
+{
+    if (drm->wakeup_pipe[0] < 0 && mp_make_wakeup_pipe(drm->wakeup_pipe) < 0) {
+        MP_ERR(drm, "Failed to create wakeup pipe: %s\n", mp_strerror(errno));
+        return false;
+    }
+    // Wakeups are only consumed while waiting for a flip; never block on them.
+    for (int n = 0; n < 2; n++) {
+        int flags = fcntl(drm->wakeup_pipe[n], F_GETFL);
+        fcntl(drm->wakeup_pipe[n], F_SETFL, flags | O_NONBLOCK);
+    }
+    drm->swapchain = swapchain;
+    return true;
+}
+
+// Only block once more than render_ahead frames are queued behind the one on
+// screen while a flip is pending. If no flip is pending (because queuing it
+// failed), drop the oldest frames that were not shown instead, so that the
+// queue stays bounded.
+void vo_drm_flip_page_async(struct vo *vo, unsigned int render_ahead)
+{
+    struct vo_drm_state *drm = vo->drm;
+    const struct vo_drm_swapchain_fns *fns = drm->swapchain;
+    const bool drain = drm->paused || drm->still;
+    // The frame on screen, plus the ones rendered ahead of it.
+    const unsigned int max_queued = drain ? 1 : 1 + render_ahead;
+
+    vo_drm_poll_flip(drm);
+    advance_swapchain(vo);
+
+    while (fns->queue_len(vo) > max_queued) {
+        if (drm->waiting_for_flip) {
+            vo_drm_wait_on_flip(drm);
+        } else {
+            MP_VERBOSE(drm, "Dropping a frame that could not be flipped to.\n");
+            fns->dequeue(vo, 1);
+        }
+        advance_swapchain(vo);
+    }
+}
+
 void vo_drm_wakeup(struct vo *vo)
 {
     struct vo_drm_state *drm = vo->drm;
     if (drm->vt_switcher_active)
         vt_switcher_interrupt_poll(&drm->vt_switcher);
+    if (drm->wakeup_pipe[1] >= 0)
+        (void)write(drm->wakeup_pipe[1], &(char){0}, 1);
 }
@@ -80,6 +80,16 @@ struct vt_switcher {
     void *handler_data[2];
 };
 
+// A VO's queue of rendered frames, for vo_drm_enable_async_flip(). Frame 0 is
+// the one on screen, the following ones were rendered ahead of it.
+struct vo_drm_swapchain_fns {
+    unsigned int (*queue_len)(struct vo *vo);
+    // Queue the page flip to frame 1. Returns false on failure.
+    bool (*queue_flip)(struct vo *vo);
+    // Remove the given frame from the queue and release its buffer.
+    void (*dequeue)(struct vo *vo, unsigned int index);
+};
+
 struct vo_drm_state {
     drmModeConnector *connector;
     drmModeEncoder *encoder;
@@ -95,6 +105,12 @@ struct vo_drm_state {
     struct vo *vo;
     struct vt_switcher vt_switcher;
 
+    // Set with vo_drm_enable_async_flip(). vo_drm_wait_events() advances it
+    // when a page flip completed while the VO thread was idle.
+    const struct vo_drm_swapchain_fns *swapchain;
+    bool flip_queued;   // swapchain frame 1 is being flipped to
+    int wakeup_pipe[2];
+
     bool active;
     bool paused;
     bool still;
@@ -118,6 +134,10 @@ void vo_drm_set_monitor_par(struct vo *vo);
 void vo_drm_uninit(struct vo *vo);
 void vo_drm_wait_events(struct vo *vo, int64_t until_time_us);
 void vo_drm_wait_on_flip(struct vo_drm_state *drm);
+void vo_drm_poll_flip(struct vo_drm_state *drm);
+bool vo_drm_enable_async_flip(struct vo_drm_state *drm,
+                              const struct vo_drm_swapchain_fns *swapchain);
+void vo_drm_flip_page_async(struct vo *vo, unsigned int render_ahead);
 void vo_drm_wakeup(struct vo *vo);
 
 bool vo_drm_acquire_crtc(struct vo_drm_state *drm);
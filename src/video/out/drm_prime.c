@@ -15,7 +15,9 @@
  * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -24,6 +26,7 @@
 
 #include "common/common.h"
 #include "common/msg.h"
+#include "common/stats.h"
 #include "drm_common.h"
 #include "drm_prime.h"
 
@@ -165,3 +168,215 @@ uint32_t drm_prime_get_handle_ref_count(struct drm_prime_handle_refs *handle_ref
     }
     return 0;
 }
+
+// Number of unused framebuffers kept. Decoders typically cycle through a pool
+// of 16-24 surfaces.
+#define FB_CACHE_SIZE 32
+
+struct fb_cache_entry {
+    struct drm_prime_framebuffer fb;
+    // key
+    uint32_t format;
+    int width, height;
+    uint32_t handles[AV_DRM_MAX_PLANES];
+    uint32_t pitches[AV_DRM_MAX_PLANES];
+    uint32_t offsets[AV_DRM_MAX_PLANES];
+    uint64_t modifier;
+
+    int refs;               // number of users (on screen or queued)
+    uint64_t last_use;
+    bool stale;             // flushed while in use; destroy on last release
+};
+
+struct drm_prime_fb_cache {
+    struct mp_log *log;
+    struct stats_ctx *stats;
+    int fd;
+    struct drm_prime_handle_refs *handle_refs;
+
+    struct fb_cache_entry *entries;
+    int num_entries;
+    uint64_t use_counter;
+
+    uint64_t hits, misses;
+};
+
+struct drm_prime_fb_cache *drm_prime_fb_cache_create(void *talloc_parent, struct mp_log *log,
+                                                     struct mpv_global *global, int fd,
+                                                     struct drm_prime_handle_refs *handle_refs)
+{
+    struct drm_prime_fb_cache *cache = talloc_zero(talloc_parent, struct drm_prime_fb_cache);
+    cache->log = log;
+    cache->stats = stats_ctx_create(cache, global, "drm-fb-cache");
+    cache->fd = fd;
+    cache->handle_refs = handle_refs;
+    return cache;
+}
+
+// Don't leak handles that were just imported and nobody references.
+static void fb_cache_close_unused(struct drm_prime_fb_cache *cache,
+                                  uint32_t handles[AV_DRM_MAX_PLANES])
+{
+    for (int n = 0; n < AV_DRM_MAX_PLANES; n++) {
+        if (handles[n] && !drm_prime_get_handle_ref_count(cache->handle_refs, handles[n])) {
+            drmIoctl(cache->fd, DRM_IOCTL_GEM_CLOSE, &handles[n]);
+            for (int i = n + 1; i < AV_DRM_MAX_PLANES; i++) {
+                if (handles[i] == handles[n])
+                    handles[i] = 0;
+            }
+        }
+    }
+}
+
+// Fill the key fields of e from the descriptor. GEM handles are looked up
+// (which returns the existing handle for an already imported dma-buf), but not
+// referenced.
+static bool fb_cache_make_key(struct drm_prime_fb_cache *cache,
+                              AVDRMFrameDescriptor *descriptor, int width,
+                              int height, struct fb_cache_entry *e)
+{
+    uint32_t gem_handles[AV_DRM_MAX_PLANES] = {0};
+
+    for (int object = 0; object < descriptor->nb_objects; object++) {
+        if (drmPrimeFDToHandle(cache->fd, descriptor->objects[object].fd,
+                               &gem_handles[object]) < 0)
+            goto fail;
+    }
+
+    AVDRMLayerDescriptor *layer = &descriptor->layers[0];
+    *e = (struct fb_cache_entry){
+        .format = layer->format,
+        .width = width,
+        .height = height,
+        .modifier = descriptor->objects[0].format_modifier,
+    };
+    for (int plane = 0; plane < layer->nb_planes; plane++) {
+        e->handles[plane] = gem_handles[layer->planes[plane].object_index];
+        e->pitches[plane] = layer->planes[plane].pitch;
+        e->offsets[plane] = layer->planes[plane].offset;
+    }
+    return true;
+
+fail:
+    fb_cache_close_unused(cache, gem_handles);
+    return false;
+}
+
+static bool fb_cache_key_equal(struct fb_cache_entry *a, struct fb_cache_entry *b)
+{
+    return a->format == b->format && a->width == b->width &&
+           a->height == b->height && a->modifier == b->modifier &&
+           !memcmp(a->handles, b->handles, sizeof(a->handles)) &&
+           !memcmp(a->pitches, b->pitches, sizeof(a->pitches)) &&
+           !memcmp(a->offsets, b->offsets, sizeof(a->offsets));
+}
+
+static void fb_cache_remove(struct drm_prime_fb_cache *cache, int index)
+{
+    drm_prime_destroy_framebuffer(cache->log, cache->fd,
+                                  &cache->entries[index].fb, cache->handle_refs);
+    MP_TARRAY_REMOVE_AT(cache->entries, cache->num_entries, index);
+}
+
+// Evict least recently used framebuffers nobody uses until there is room.
+static void fb_cache_evict(struct drm_prime_fb_cache *cache)
+{
+    while (cache->num_entries >= FB_CACHE_SIZE) {
+        int lru = -1;
+        for (int n = 0; n < cache->num_entries; n++) {
+            struct fb_cache_entry *e = &cache->entries[n];
+            if (!e->refs && (lru < 0 || e->last_use < cache->entries[lru].last_use))
+                lru = n;
+        }
+        if (lru < 0)
+            break;
+        fb_cache_remove(cache, lru);
+    }
+}
+
+// Like drm_prime_create_framebuffer(), but reuse a framebuffer created earlier
+// for the same buffer if possible. Must be paired with
+// drm_prime_fb_cache_release().
+int drm_prime_fb_cache_acquire(struct drm_prime_fb_cache *cache, AVDRMFrameDescriptor *descriptor,
+                               int width, int height, struct drm_prime_framebuffer *framebuffer)
+{
+    *framebuffer = (struct drm_prime_framebuffer){0};
+    if (!descriptor || !descriptor->nb_layers)
+        return 0;
+
+    struct fb_cache_entry key;
+    if (!fb_cache_make_key(cache, descriptor, width, height, &key)) {
+        mp_err(cache->log, "Failed to retrieve the Prime Handles.\n");
+        return -1;
+    }
+
+    for (int n = 0; n < cache->num_entries; n++) {
+        struct fb_cache_entry *e = &cache->entries[n];
+        if (!e->stale && fb_cache_key_equal(e, &key)) {
+            e->refs++;
+            e->last_use = ++cache->use_counter;
+            *framebuffer = e->fb;
+            cache->hits++;
+            stats_event(cache->stats, "hit");
+            return 0;
+        }
+    }
+
+    cache->misses++;
+    stats_event(cache->stats, "miss");
+    fb_cache_evict(cache);
+
+    if (drm_prime_create_framebuffer(cache->log, cache->fd, descriptor, width,
+                                     height, &key.fb, cache->handle_refs))
+    {
+        fb_cache_close_unused(cache, key.handles);
+        return -1;
+    }
+
+    key.refs = 1;
+    key.last_use = ++cache->use_counter;
+    MP_TARRAY_APPEND(cache, cache->entries, cache->num_entries, key);
+    stats_value(cache->stats, "entries", cache->num_entries);
+    *framebuffer = key.fb;
+    return 0;
+}
+
+void drm_prime_fb_cache_release(struct drm_prime_fb_cache *cache,
+                                struct drm_prime_framebuffer *framebuffer)
+{
+    if (!framebuffer->fb_id)
+        return;
+
+    for (int n = 0; n < cache->num_entries; n++) {
+        struct fb_cache_entry *e = &cache->entries[n];
+        if (e->fb.fb_id == framebuffer->fb_id) {
+            assert(e->refs > 0);
+            e->refs--;
+            if (!e->refs && e->stale) {
+                fb_cache_remove(cache, n);
+                stats_value(cache->stats, "entries", cache->num_entries);
+            }
+            break;
+        }
+    }
+    memset(framebuffer, 0, sizeof(*framebuffer));
+}
+
+// Destroy all framebuffers which are not in use, e.g. when the decoder (and
+// with it the dma-bufs) goes away. Framebuffers still in use are not reused,
+// and destroyed once released.
+void drm_prime_fb_cache_flush(struct drm_prime_fb_cache *cache)
+{
+    if (cache->hits || cache->misses) {
+        mp_verbose(cache->log, "Framebuffer cache: %"PRIu64" hits, %"PRIu64" misses.\n",
+                   cache->hits, cache->misses);
+    }
+    for (int n = cache->num_entries - 1; n >= 0; n--) {
+        if (cache->entries[n].refs) {
+            cache->entries[n].stale = true;
+        } else {
+            fb_cache_remove(cache, n);
+        }
+    }
+    stats_value(cache->stats, "entries", cache->num_entries);
+}
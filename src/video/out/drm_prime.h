@@ -33,6 +33,9 @@ struct drm_prime_handle_refs {
     void *ctx;
 };
 
+struct drm_prime_fb_cache;
+struct mpv_global;
+
 int drm_prime_create_framebuffer(struct mp_log *log, int fd, AVDRMFrameDescriptor *descriptor, int width, int height,
                                  struct  drm_prime_framebuffer *framebuffers,
                                  struct drm_prime_handle_refs *handle_refs);
@@ -42,4 +45,16 @@ void drm_prime_init_handle_ref_count(void *talloc_parent, struct drm_prime_handl
 void drm_prime_add_handle_ref(struct drm_prime_handle_refs *handle_refs, uint32_t handle);
 void drm_prime_remove_handle_ref(struct drm_prime_handle_refs *handle_refs, uint32_t handle);
 uint32_t drm_prime_get_handle_ref_count(struct drm_prime_handle_refs *handle_refs, uint32_t handle);
+
+// Framebuffers imported from dma-bufs, kept around after use so that recurring
+// decoder surfaces can reuse them. Entries are keyed by GEM handle and layout.
+// Users should flush it when the decoder switches to new surfaces.
+struct drm_prime_fb_cache *drm_prime_fb_cache_create(void *talloc_parent, struct mp_log *log,
+                                                     struct mpv_global *global, int fd,
+                                                     struct drm_prime_handle_refs *handle_refs);
+int drm_prime_fb_cache_acquire(struct drm_prime_fb_cache *cache, AVDRMFrameDescriptor *descriptor,
+                               int width, int height, struct drm_prime_framebuffer *framebuffer);
+void drm_prime_fb_cache_release(struct drm_prime_fb_cache *cache,
+                                struct drm_prime_framebuffer *framebuffer);
+void drm_prime_fb_cache_flush(struct drm_prime_fb_cache *cache);
 #endif // DRM_PRIME_H
@@ -0,0 +1,319 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "misc/node.h"
+#include "mpv_talloc.h"
+
+#include "frame_trace.h"
+
+struct trace_entry {
+    uint64_t frame_id;
+    double pts;
+    bool dropped;
+    int64_t t[MP_FRAME_TRACE_NUM_STAGES];
+};
+
+struct mp_frame_trace {
+    struct trace_entry *entries;
+    int size;       // allocated number of entries
+    int num;        // valid entries
+    int pos;        // index of the next entry to write
+};
+
+static const char *const stage_names[MP_FRAME_TRACE_NUM_STAGES] = {
+    [MP_FRAME_TRACE_DECODE]     = "decode",
+    [MP_FRAME_TRACE_FILTER]     = "filter",
+    [MP_FRAME_TRACE_QUEUE]      = "queue",
+    [MP_FRAME_TRACE_RENDER]     = "render",
+    [MP_FRAME_TRACE_FLIP]       = "flip",
+    [MP_FRAME_TRACE_PRESENT]    = "present",
+};
+
+struct mp_frame_trace *mp_frame_trace_create(void *ta_parent, int size)
+{
+    struct mp_frame_trace *t = talloc_zero(ta_parent, struct mp_frame_trace);
+    mp_frame_trace_reset(t, size);
+    return t;
+}
+
+void mp_frame_trace_reset(struct mp_frame_trace *t, int size)
+{
+    size = MPMAX(size, 0);
+    if (size != t->size) {
+        talloc_free(t->entries);
+        t->entries = size ? talloc_zero_array(t, struct trace_entry, size) : NULL;
+        t->size = size;
+    }
+    t->num = 0;
+    t->pos = 0;
+}
+
+bool mp_frame_trace_enabled(struct mp_frame_trace *t)
+{
+    return t && t->size > 0;
+}
+
+struct mp_frame_trace *mp_frame_trace_dup(void *ta_parent,
+                                          struct mp_frame_trace *t)
+{
+    struct mp_frame_trace *new = talloc_zero(ta_parent, struct mp_frame_trace);
+    *new = *t;
+    new->entries = talloc_memdup(new, t->entries,
+                                 t->size * sizeof(t->entries[0]));
+    return new;
+}
+
+// Return the n-th entry, oldest first.
+static struct trace_entry *get_entry(struct mp_frame_trace *t, int n)
+{
+    assert(n >= 0 && n < t->num);
+    return &t->entries[(t->pos - t->num + n + t->size) % t->size];
+}
+
+static struct trace_entry *find_entry(struct mp_frame_trace *t,
+                                      uint64_t frame_id)
+{
+    // Lookups are almost always for the newest frames, so search backwards.
+    for (int n = t->num - 1; n >= 0; n--) {
+        struct trace_entry *e = get_entry(t, n);
+        if (e->frame_id == frame_id)
+            return e;
+        if (e->frame_id < frame_id)
+            break;
+    }
+    return NULL;
+}
+
+void mp_frame_trace_add(struct mp_frame_trace *t, uint64_t frame_id, double pts,
+                        int64_t decode_time, int64_t filter_time,
+                        int64_t queue_time)
+{
+    if (!mp_frame_trace_enabled(t))
+        return;
+
+    struct trace_entry *e = &t->entries[t->pos];
+    *e = (struct trace_entry){
+        .frame_id = frame_id,
+        .pts = pts,
+    };
+    e->t[MP_FRAME_TRACE_DECODE] = decode_time;
+    e->t[MP_FRAME_TRACE_FILTER] = filter_time;
+    e->t[MP_FRAME_TRACE_QUEUE] = queue_time;
+
+    t->pos = (t->pos + 1) % t->size;
+    t->num = MPMIN(t->num + 1, t->size);
+}
+
+void mp_frame_trace_stamp(struct mp_frame_trace *t, uint64_t frame_id,
+                          enum mp_frame_trace_stage stage, int64_t time)
+{
+    if (!mp_frame_trace_enabled(t) || time <= 0)
+        return;
+
+    struct trace_entry *e = find_entry(t, frame_id);
+    if (e && !e->t[stage])
+        e->t[stage] = time;
+}
+
+void mp_frame_trace_drop(struct mp_frame_trace *t, uint64_t frame_id)
+{
+    if (!mp_frame_trace_enabled(t))
+        return;
+
+    struct trace_entry *e = find_entry(t, frame_id);
+    if (e && !e->t[MP_FRAME_TRACE_RENDER])
+        e->dropped = true;
+}
+
+// Latency of stage relative to the closest earlier stage that was stamped.
+// Returns -1 if unknown.
+static int64_t stage_latency(struct trace_entry *e, int stage)
+{
+    if (!e->t[stage])
+        return -1;
+    for (int n = stage - 1; n >= 0; n--) {
+        if (e->t[n])
+            return e->t[stage] - e->t[n];
+    }
+    return -1;
+}
+
+// Time from the first to the last stamped stage, or -1.
+static int64_t total_latency(struct trace_entry *e)
+{
+    int first = -1, last = -1;
+    for (int n = 0; n < MP_FRAME_TRACE_NUM_STAGES; n++) {
+        if (e->t[n]) {
+            if (first < 0)
+                first = n;
+            last = n;
+        }
+    }
+    return first >= 0 && last > first ? e->t[last] - e->t[first] : -1;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t va = *(const int64_t *)a, vb = *(const int64_t *)b;
+    return va < vb ? -1 : (va > vb);
+}
+
+struct latency_summary {
+    int count;
+    int64_t min, p50, p90, p99, max;
+    double avg;
+};
+
+// stage < 0 means total latency.
+static struct latency_summary summarize(struct mp_frame_trace *t, int stage)
+{
+    struct latency_summary s = {0};
+    int64_t *vals = talloc_array(NULL, int64_t, MPMAX(t->num, 1));
+    double sum = 0;
+    for (int n = 0; n < t->num; n++) {
+        struct trace_entry *e = get_entry(t, n);
+        int64_t v = stage < 0 ? total_latency(e) : stage_latency(e, stage);
+        if (v >= 0) {
+            vals[s.count++] = v;
+            sum += v;
+        }
+    }
+    if (s.count) {
+        qsort(vals, s.count, sizeof(vals[0]), cmp_int64);
+        s.min = vals[0];
+        s.p50 = vals[(s.count - 1) * 50 / 100];
+        s.p90 = vals[(s.count - 1) * 90 / 100];
+        s.p99 = vals[(s.count - 1) * 99 / 100];
+        s.max = vals[s.count - 1];
+        s.avg = sum / s.count;
+    }
+    talloc_free(vals);
+    return s;
+}
+
+static void add_summary(struct mpv_node *dst, const char *name,
+                        struct latency_summary s)
+{
+    struct mpv_node *m = node_map_add(dst, name, MPV_FORMAT_NODE_MAP);
+    node_map_add_int64(m, "count", s.count);
+    node_map_add_int64(m, "min", s.min);
+    node_map_add_double(m, "avg", s.avg);
+    node_map_add_int64(m, "p50", s.p50);
+    node_map_add_int64(m, "p90", s.p90);
+    node_map_add_int64(m, "p99", s.p99);
+    node_map_add_int64(m, "max", s.max);
+}
+
+void mp_frame_trace_get_node(struct mp_frame_trace *t, struct mpv_node *dst)
+{
+    node_init(dst, MPV_FORMAT_NODE_MAP, NULL);
+
+    struct mpv_node *frames = node_map_add(dst, "frames", MPV_FORMAT_NODE_ARRAY);
+    for (int n = 0; n < t->num; n++) {
+        struct trace_entry *e = get_entry(t, n);
+        struct mpv_node *f = node_array_add(frames, MPV_FORMAT_NODE_MAP);
+        node_map_add_int64(f, "id", e->frame_id);
+        node_map_add_double(f, "pts", e->pts);
+        node_map_add_flag(f, "dropped", e->dropped);
+        for (int i = 1; i < MP_FRAME_TRACE_NUM_STAGES; i++) {
+            int64_t v = stage_latency(e, i);
+            if (v >= 0)
+                node_map_add_int64(f, stage_names[i], v);
+        }
+        int64_t total = total_latency(e);
+        if (total >= 0)
+            node_map_add_int64(f, "total", total);
+    }
+
+    struct mpv_node *sum = node_map_add(dst, "summary", MPV_FORMAT_NODE_MAP);
+    for (int i = 1; i < MP_FRAME_TRACE_NUM_STAGES; i++)
+        add_summary(sum, stage_names[i], summarize(t, i));
+    add_summary(sum, "total", summarize(t, -1));
+}
+
+static void dump_summary(struct mp_log *log, FILE *f, const char *name,
+                         struct latency_summary s)
+{
+    char buf[160];
+    snprintf(buf, sizeof(buf), "%-8s n=%-5d min=%-7"PRId64" avg=%-9.1f "
+             "p50=%-7"PRId64" p90=%-7"PRId64" p99=%-7"PRId64" max=%"PRId64,
+             name, s.count, s.min, s.avg, s.p50, s.p90, s.p99, s.max);
+    if (f) {
+        fprintf(f, "# %s\n", buf);
+    } else {
+        mp_info(log, "%s\n", buf);
+    }
+}
+
+bool mp_frame_trace_dump(struct mp_frame_trace *t, struct mp_log *log,
+                         const char *path)
+{
+    FILE *f = NULL;
+    if (path) {
+        f = fopen(path, "w");
+        if (!f) {
+            mp_err(log, "Could not open '%s' for writing.\n", path);
+            return false;
+        }
+    }
+
+    if (f) {
+        fprintf(f, "# id\tpts\tdropped");
+        for (int i = 0; i < MP_FRAME_TRACE_NUM_STAGES; i++)
+            fprintf(f, "\t%s", stage_names[i]);
+        fprintf(f, "\n");
+    } else {
+        mp_info(log, "Frame trace (%d frames, latencies in us):\n", t->num);
+    }
+
+    for (int n = 0; n < t->num; n++) {
+        struct trace_entry *e = get_entry(t, n);
+        if (f) {
+            fprintf(f, "%"PRIu64"\t%f\t%d", e->frame_id, e->pts, e->dropped);
+            for (int i = 0; i < MP_FRAME_TRACE_NUM_STAGES; i++)
+                fprintf(f, "\t%"PRId64, e->t[i]);
+            fprintf(f, "\n");
+        } else {
+            char *line = talloc_asprintf(NULL, "%"PRIu64" pts=%.3f%s",
+                                         e->frame_id, e->pts,
+                                         e->dropped ? " dropped" : "");
+            for (int i = 1; i < MP_FRAME_TRACE_NUM_STAGES; i++) {
+                int64_t v = stage_latency(e, i);
+                if (v >= 0)
+                    ta_xasprintf_append(&line, " %s=%"PRId64, stage_names[i], v);
+            }
+            mp_verbose(log, "%s\n", line);
+            talloc_free(line);
+        }
+    }
+
+    for (int i = 1; i < MP_FRAME_TRACE_NUM_STAGES; i++)
+        dump_summary(log, f, stage_names[i], summarize(t, i));
+    dump_summary(log, f, "total", summarize(t, -1));
+
+    if (f && fclose(f)) {
+        mp_err(log, "Error writing '%s'.\n", path);
+        return false;
+    }
+    return true;
+}
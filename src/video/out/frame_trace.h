@@ -0,0 +1,80 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Per-frame latency tracer for the VO pipeline. Every frame passed to
+// vo_queue_frame() gets an entry in a ring buffer, which is then stamped as
+// the frame moves through the remaining stages. All timestamps are in
+// mp_time_us() units; 0 means the stage was not reached (or is unknown).
+// Not thread-safe; the VO serializes access with its own lock.
+
+enum mp_frame_trace_stage {
+    MP_FRAME_TRACE_DECODE,      // decoder returned the frame
+    MP_FRAME_TRACE_FILTER,      // player read the frame from the filter chain
+    MP_FRAME_TRACE_QUEUE,       // vo_queue_frame()
+    MP_FRAME_TRACE_RENDER,      // VO thread started drawing the frame
+    MP_FRAME_TRACE_FLIP,        // flip_page() returned
+    MP_FRAME_TRACE_PRESENT,     // presentation time reported by get_vsync()
+                                // (only with --swapchain-depth=1 and no
+                                // --vo-render-ahead, see render_frame())
+    MP_FRAME_TRACE_NUM_STAGES,
+};
+
+struct mp_frame_trace;
+struct mpv_node;
+struct mp_log;
+
+// size is the number of frames kept; 0 creates a disabled tracer.
+struct mp_frame_trace *mp_frame_trace_create(void *ta_parent, int size);
+
+// Drop all entries, and resize the ring buffer to the given number of frames.
+void mp_frame_trace_reset(struct mp_frame_trace *t, int size);
+
+bool mp_frame_trace_enabled(struct mp_frame_trace *t);
+
+// Return a snapshot of the current state, which can be inspected without
+// holding the owner's lock.
+struct mp_frame_trace *mp_frame_trace_dup(void *ta_parent,
+                                          struct mp_frame_trace *t);
+
+// Start a new entry for the given frame, evicting the oldest one if the ring
+// is full. decode_time/filter_time come from the mp_image (may be 0).
+void mp_frame_trace_add(struct mp_frame_trace *t, uint64_t frame_id, double pts,
+                        int64_t decode_time, int64_t filter_time,
+                        int64_t queue_time);
+
+// Set the time for a stage of a frame still in the ring. Stages that were
+// already stamped are left alone (repeated frames keep their first render).
+void mp_frame_trace_stamp(struct mp_frame_trace *t, uint64_t frame_id,
+                          enum mp_frame_trace_stage stage, int64_t time);
+
+// Mark the frame as dropped by the VO.
+void mp_frame_trace_drop(struct mp_frame_trace *t, uint64_t frame_id);
+
+// Fill dst with a map containing "frames" (per-frame stage latencies) and
+// "summary" (percentiles per stage transition). Latencies are in microseconds,
+// each relative to the previous stamped stage.
+void mp_frame_trace_get_node(struct mp_frame_trace *t, struct mpv_node *dst);
+
+// Write a human readable dump of the ring buffer and the summary to the log,
+// or as tab-separated values to the given file if path is non-NULL.
+bool mp_frame_trace_dump(struct mp_frame_trace *t, struct mp_log *log,
+                         const char *path);
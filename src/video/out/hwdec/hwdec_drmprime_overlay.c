@@ -57,8 +57,32 @@ struct priv {
     int display_w, display_h;
 
     struct drm_prime_handle_refs handle_refs;
+    struct drm_prime_fb_cache *fb_cache;
+    // Frames the cached framebuffers were created for. The frames context is
+    // only compared, not referenced.
+    void *fb_cache_frames_ctx;
+    struct mp_image_params fb_cache_params;
 };
 
+// Flush the framebuffer cache if the decoder switched to a new set of surfaces
+// (reinit, resolution or format change). The framebuffers of the old surfaces
+// would never be hit again, and keep their buffers allocated.
+static void check_fb_cache(struct ra_hwdec *hw, struct mp_image *hw_image)
+{
+    struct priv *p = hw->priv;
+    void *frames_ctx = hw_image->hwctx ? hw_image->hwctx->data : NULL;
+    struct mp_image_params *par = &hw_image->params;
+    struct mp_image_params *old = &p->fb_cache_params;
+
+    if (frames_ctx != p->fb_cache_frames_ctx || par->imgfmt != old->imgfmt ||
+        par->hw_subfmt != old->hw_subfmt || par->w != old->w || par->h != old->h)
+    {
+        drm_prime_fb_cache_flush(p->fb_cache);
+        p->fb_cache_frames_ctx = frames_ctx;
+        p->fb_cache_params = *par;
+    }
+}
+
 static void set_current_frame(struct ra_hwdec *hw, struct drm_frame *frame)
 {
     struct priv *p = hw->priv;
@@ -69,9 +93,8 @@ static void set_current_frame(struct ra_hwdec *hw, struct drm_frame *frame)
     // We used old frame as triple buffering to make sure that the drm framebuffer
     // is not being displayed when we release it.
 
-    if (p->ctx) {
-        drm_prime_destroy_framebuffer(p->log, p->ctx->fd, &p->old_frame.fb, &p->handle_refs);
-    }
+    if (p->fb_cache)
+        drm_prime_fb_cache_release(p->fb_cache, &p->old_frame.fb);
 
     mp_image_setrefp(&p->old_frame.image, p->last_frame.image);
     p->old_frame.fb = p->last_frame.fb;
@@ -182,12 +205,14 @@ static int overlay_frame(struct ra_hwdec *hw, struct mp_image *hw_image,
         desc = (AVDRMFrameDescriptor *)hw_image->planes[0];
 
         if (desc) {
+            check_fb_cache(hw, hw_image);
+
             int srcw = p->src.x1 - p->src.x0;
             int srch = p->src.y1 - p->src.y0;
             int dstw = MP_ALIGN_UP(p->dst.x1 - p->dst.x0, 2);
             int dsth = MP_ALIGN_UP(p->dst.y1 - p->dst.y0, 2);
 
-            if (drm_prime_create_framebuffer(p->log, p->ctx->fd, desc, srcw, srch, &next_frame.fb, &p->handle_refs)) {
+            if (drm_prime_fb_cache_acquire(p->fb_cache, desc, srcw, srch, &next_frame.fb)) {
                 ret = -1;
                 goto fail;
             }
@@ -220,13 +245,18 @@ static int overlay_frame(struct ra_hwdec *hw, struct mp_image *hw_image,
 
         while (p->old_frame.fb.fb_id)
           set_current_frame(hw, NULL);
+
+        // Playback ended; the decoder's dma-bufs are going away.
+        drm_prime_fb_cache_flush(p->fb_cache);
+        p->fb_cache_frames_ctx = NULL;
+        p->fb_cache_params = (struct mp_image_params){0};
     }
 
     set_current_frame(hw, &next_frame);
     return 0;
 
  fail:
-    drm_prime_destroy_framebuffer(p->log, p->ctx->fd, &next_frame.fb, &p->handle_refs);
+    drm_prime_fb_cache_release(p->fb_cache, &next_frame.fb);
     return ret;
 }
 
@@ -235,7 +265,12 @@ static void uninit(struct ra_hwdec *hw)
     struct priv *p = hw->priv;
 
     disable_video_plane(hw);
-    set_current_frame(hw, NULL);
+    for (int n = 0; n < 3; n++)
+        set_current_frame(hw, NULL);
+    if (p->fb_cache) {
+        drm_prime_fb_cache_flush(p->fb_cache);
+        TA_FREEP(&p->fb_cache);
+    }
 
     hwdec_devices_remove(hw->devs, &p->hwctx);
     av_buffer_unref(&p->hwctx.av_device_ref);
@@ -296,6 +331,9 @@ static int init(struct ra_hwdec *hw)
         drm_prime_init_handle_ref_count(p, &p->handle_refs);
     }
 
+    p->fb_cache = drm_prime_fb_cache_create(p, p->log, hw->global, p->ctx->fd,
+                                            &p->handle_refs);
+
     disable_video_plane(hw);
 
     p->hwctx = (struct mp_hwdec_ctx) {
@@ -36,6 +36,7 @@
 #include "vo.h"
 #include "aspect.h"
 #include "dr_helper.h"
+#include "frame_trace.h"
 #include "input/input.h"
 #include "options/m_config.h"
 #include "common/msg.h"
@@ -133,6 +134,7 @@ struct vo_internal {
     int64_t wakeup_pts;             // time at which to pull frame from decoder
 
     bool rendering;                 // true if an image is being rendered
+    double avg_render_time;         // draw_frame() time in seconds, or -1
     struct vo_frame *frame_queued;  // should be drawn next
     int req_frames;                 // VO's requested value of num_frames
     uint64_t current_frame_id;
@@ -141,6 +143,9 @@ struct vo_internal {
     double reported_display_fps;
 
     struct stats_ctx *stats;
+
+    struct mp_frame_trace *trace;   // per-frame latency ring buffer
+    int trace_size;
 };
 
 extern const struct m_sub_options gl_video_conf;
@@ -196,6 +201,10 @@ static void read_opts(struct vo *vo)
 
     pthread_mutex_lock(&in->lock);
     in->timing_offset = (uint64_t)(vo->opts->timing_offset * 1e6);
+    if (in->trace_size != vo->opts->frame_trace_size) {
+        in->trace_size = vo->opts->frame_trace_size;
+        mp_frame_trace_reset(in->trace, in->trace_size);
+    }
     pthread_mutex_unlock(&in->lock);
 }
 
@@ -272,7 +281,9 @@ static struct vo *vo_create(bool probing, struct mpv_global *global,
         .dispatch = mp_dispatch_create(vo),
         .req_frames = 1,
         .estimated_vsync_jitter = -1,
+        .avg_render_time = -1,
         .stats = stats_ctx_create(vo, global, "vo"),
+        .trace = mp_frame_trace_create(vo, 0),
     };
     mp_dispatch_set_wakeup_fn(vo->in->dispatch, dispatch_wakeup_cb, vo);
     pthread_mutex_init(&vo->in->lock, NULL);
@@ -806,6 +817,11 @@ void vo_queue_frame(struct vo *vo, struct vo_frame *frame)
            (!in->current_frame || in->current_frame->num_vsyncs < 1));
     in->hasframe = true;
     frame->frame_id = ++(in->current_frame_id);
+    if (mp_frame_trace_enabled(in->trace) && frame->current) {
+        mp_frame_trace_add(in->trace, frame->frame_id, frame->current->pts,
+                           frame->current->decode_time,
+                           frame->current->filter_time, mp_time_us());
+    }
     in->frame_queued = frame;
     in->wakeup_pts = frame->display_synced
                    ? 0 : frame->pts + MPMAX(frame->duration, 0);
@@ -911,6 +927,7 @@ static bool render_frame(struct vo *vo)
 
     if (in->dropped_frame) {
         in->drop_count += 1;
+        mp_frame_trace_drop(in->trace, frame->frame_id);
         wakeup_core(vo);
     } else {
         in->rendering = true;
@@ -925,6 +942,8 @@ static bool render_frame(struct vo *vo)
         if (can_queue)
             wakeup_core(vo);
 
+        int64_t render_time = mp_time_us();
+
         stats_time_start(in->stats, "video-draw");
 
         if (vo->driver->draw_frame) {
@@ -935,12 +954,16 @@ static bool render_frame(struct vo *vo)
 
         stats_time_end(in->stats, "video-draw");
 
+        double draw_time = (mp_time_us() - render_time) / 1e6;
+
         wait_until(vo, target);
 
         stats_time_start(in->stats, "video-flip");
 
         vo->driver->flip_page(vo);
 
+        int64_t flip_time = mp_time_us();
+
         struct vo_vsync_info vsync = {
             .last_queue_display_time = -1,
             .skipped_vsyncs = -1,
@@ -948,6 +971,14 @@ static bool render_frame(struct vo *vo)
         if (vo->driver->get_vsync)
             vo->driver->get_vsync(vo, &vsync);
 
+        // Only real presentation feedback is useful for the tracer. It lags
+        // behind by the frames queued ahead in the swapchain, so it's only
+        // known to be for this frame if nothing is queued ahead. Otherwise,
+        // leave the stage empty rather than stamp an earlier frame's time.
+        int64_t present_time = -1;
+        if (vo->opts->swapchain_depth <= 1 && !vo->opts->render_ahead)
+            present_time = vsync.last_queue_display_time;
+
         // Make up some crap if presentation feedback is missing.
         if (vsync.last_queue_display_time < 0)
             vsync.last_queue_display_time = mp_time_us();
@@ -957,6 +988,15 @@ static bool render_frame(struct vo *vo)
         pthread_mutex_lock(&in->lock);
         in->dropped_frame = prev_drop_count < vo->in->drop_count;
         in->rendering = false;
+        in->avg_render_time = in->avg_render_time < 0 ? draw_time
+                            : in->avg_render_time * 0.9 + draw_time * 0.1;
+
+        mp_frame_trace_stamp(in->trace, frame->frame_id,
+                             MP_FRAME_TRACE_RENDER, render_time);
+        mp_frame_trace_stamp(in->trace, frame->frame_id,
+                             MP_FRAME_TRACE_FLIP, flip_time);
+        mp_frame_trace_stamp(in->trace, frame->frame_id,
+                             MP_FRAME_TRACE_PRESENT, present_time);
 
         update_vsync_timing_after_swap(vo, &vsync);
     }
@@ -1257,6 +1297,17 @@ int64_t vo_get_vsync_interval(struct vo *vo)
     return res;
 }
 
+// Returns the average time the VO needs to render a frame (not including the
+// flip) in seconds, or -1 if unknown.
+double vo_get_render_time(struct vo *vo)
+{
+    struct vo_internal *in = vo->in;
+    pthread_mutex_lock(&in->lock);
+    double res = in->avg_render_time;
+    pthread_mutex_unlock(&in->lock);
+    return res;
+}
+
 // Returns duration of a display refresh in seconds.
 double vo_get_estimated_vsync_interval(struct vo *vo)
 {
@@ -1372,6 +1423,19 @@ struct vo_frame *vo_get_current_vo_frame(struct vo *vo)
     return r;
 }
 
+// Return a snapshot of the per-frame latency tracer, or NULL if it's disabled
+// (--vo-frame-trace=0). Free with talloc_free().
+struct mp_frame_trace *vo_get_frame_trace(struct vo *vo, void *ta_parent)
+{
+    struct vo_internal *in = vo->in;
+    pthread_mutex_lock(&in->lock);
+    struct mp_frame_trace *r = NULL;
+    if (mp_frame_trace_enabled(in->trace))
+        r = mp_frame_trace_dup(ta_parent, in->trace);
+    pthread_mutex_unlock(&in->lock);
+    return r;
+}
+
 struct mp_image *vo_get_image(struct vo *vo, int imgfmt, int w, int h,
                               int stride_align, int flags)
 {
@@ -204,6 +204,7 @@ struct vo;
 struct osd_state;
 struct mp_image;
 struct mp_image_params;
+struct mp_frame_trace;
 
 struct vo_extra {
     struct input_ctx *input_ctx;
@@ -532,11 +533,13 @@ void vo_set_queue_params(struct vo *vo, int64_t offset_us, int num_req_frames);
 int vo_get_num_req_frames(struct vo *vo);
 int64_t vo_get_vsync_interval(struct vo *vo);
 double vo_get_estimated_vsync_interval(struct vo *vo);
+double vo_get_render_time(struct vo *vo);
 double vo_get_estimated_vsync_jitter(struct vo *vo);
 double vo_get_display_fps(struct vo *vo);
 double vo_get_delay(struct vo *vo);
 void vo_discard_timing_info(struct vo *vo);
 struct vo_frame *vo_get_current_vo_frame(struct vo *vo);
+struct mp_frame_trace *vo_get_frame_trace(struct vo *vo, void *ta_parent);
 struct mp_image *vo_get_image(struct vo *vo, int imgfmt, int w, int h,
                               int stride_align, int flags);
 
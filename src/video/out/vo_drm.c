@@ -69,6 +69,8 @@ struct priv {
     struct framebuffer **bufs;
     int front_buf;
     int buf_count;
+
+    int render_ahead;   // --vo-render-ahead, fixed at init
 };
 
 static void destroy_framebuffer(int fd, struct framebuffer *fb)
@@ -280,12 +282,12 @@ static void enqueue_frame(struct vo *vo, struct framebuffer *fb)
     MP_TARRAY_APPEND(p, p->fb_queue, p->fb_queue_len, new_frame);
 }
 
-static void dequeue_frame(struct vo *vo)
+static void dequeue_frame(struct vo *vo, unsigned int index)
 {
     struct priv *p = vo->priv;
 
-    talloc_free(p->fb_queue[0]);
-    MP_TARRAY_REMOVE_AT(p->fb_queue, p->fb_queue_len, 0);
+    talloc_free(p->fb_queue[index]);
+    MP_TARRAY_REMOVE_AT(p->fb_queue, p->fb_queue_len, index);
 }
 
 static void swapchain_step(struct vo *vo)
@@ -293,7 +295,7 @@ static void swapchain_step(struct vo *vo)
     struct priv *p = vo->priv;
 
     if (p->fb_queue_len > 0) {
-        dequeue_frame(vo);
+        dequeue_frame(vo, 0);
     }
 }
 
@@ -318,7 +320,7 @@ static void draw_frame(struct vo *vo, struct vo_frame *frame)
     enqueue_frame(vo, fb);
 }
 
-static void queue_flip(struct vo *vo, struct drm_frame *frame)
+static bool queue_flip(struct vo *vo, struct drm_frame *frame)
 {
     struct vo_drm_state *drm = vo->drm;
 
@@ -329,8 +331,27 @@ static void queue_flip(struct vo *vo, struct drm_frame *frame)
     if (ret)
         MP_WARN(vo, "Failed to queue page flip: %s\n", mp_strerror(errno));
     drm->waiting_for_flip = !ret;
+    return !ret;
+}
+
+static unsigned int swapchain_len(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+    return p->fb_queue_len;
 }
 
+static bool swapchain_flip(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+    return queue_flip(vo, p->fb_queue[1]);
+}
+
+static const struct vo_drm_swapchain_fns swapchain_fns = {
+    .queue_len = swapchain_len,
+    .queue_flip = swapchain_flip,
+    .dequeue = dequeue_frame,
+};
+
 static void flip_page(struct vo *vo)
 {
     struct priv *p = vo->priv;
@@ -340,6 +361,11 @@ static void flip_page(struct vo *vo)
     if (!drm->active)
         return;
 
+    if (p->render_ahead) {
+        vo_drm_flip_page_async(vo, p->render_ahead);
+        return;
+    }
+
     while (drain || p->fb_queue_len > vo->opts->swapchain_depth) {
         if (drm->waiting_for_flip) {
             vo_drm_wait_on_flip(vo->drm);
@@ -385,7 +411,13 @@ static int preinit(struct vo *vo)
         goto err;
 
     struct vo_drm_state *drm = vo->drm;
-    p->buf_count = vo->opts->swapchain_depth + 1;
+    p->render_ahead = vo->opts->render_ahead;
+    if (p->render_ahead && !vo_drm_enable_async_flip(drm, &swapchain_fns))
+        p->render_ahead = 0;
+
+    // Enough buffers that the next one drawn is never queued for scanout.
+    p->buf_count = p->render_ahead ? p->render_ahead + 2
+                                   : vo->opts->swapchain_depth + 1;
     p->bufs = talloc_zero_array(p, struct framebuffer *, p->buf_count);
 
     p->front_buf = 0;
@@ -40,6 +40,9 @@
 #define BYTES_PER_PIXEL 4
 #define BITS_PER_PIXEL 32
 
+// Use legacy page flips after this many atomic commits failed in a row.
+#define MAX_ATOMIC_FLIP_FAILURES 8
+
 struct drm_frame {
     struct framebuffer *fb;
 };
@@ -62,10 +65,24 @@ struct priv {
 
     struct framebuffer **bufs;
     struct framebuffer *primary_buf;
-    struct framebuffer *osd_buf;
     int front_buf;
     int buf_count;
-    bool osd_changed;
+
+    // OSD/subtitles on their own overlay plane, double buffered so that the
+    // buffer being scanned out is never drawn to. osd_bufs[osd_front] is on
+    // screen. An OSD update is drawn into the other buffer only while that one
+    // isn't waiting to be shown, i.e. after the page flip that showed the
+    // previous update completed.
+    struct framebuffer *osd_bufs[2];
+    int osd_front;
+    int osd_next;           // buffer to show with the next flip, or -1
+    bool osd_next_queued;   // osd_next is shown by the pending page flip
+    int64_t osd_change_id;
+    struct mp_rect osd_prev_rc[64]; // modified in the front buffer only
+    int num_osd_prev_rc;
+    int atomic_flip_failures;   // consecutive failed atomic commits
+
+    int render_ahead;   // --vo-render-ahead, fixed at init
 };
 
 static void destroy_framebuffer(struct framebuffer *fb)
@@ -242,7 +259,9 @@ static int reconfig(struct vo *vo, struct mp_image_params *params)
     if (!vo->hwdec) {
         if (mp_sws_reinit(p->sws) < 0)
             return -1;
-        p->buf_count = vo->opts->swapchain_depth + 1;
+        // Enough buffers that the next one drawn is never queued for scanout.
+        p->buf_count = p->render_ahead ? p->render_ahead + 2
+                                       : vo->opts->swapchain_depth + 1;
         if (!p->bufs)
             p->bufs = talloc_zero_array(p, struct framebuffer *, p->buf_count);
 
@@ -256,7 +275,6 @@ static int reconfig(struct vo *vo, struct mp_image_params *params)
     }
 
     vo->want_redraw = true;
-    p->osd_changed = false;
 
     return 0;
 }
@@ -273,10 +291,10 @@ static void enqueue_frame(struct vo *vo, struct framebuffer *fb)
     MP_TARRAY_APPEND(p, p->fb_queue, p->fb_queue_len, new_frame);
 }
 
-static void dequeue_frame(struct vo *vo)
+static void dequeue_frame(struct vo *vo, unsigned int index)
 {
     struct priv *p = vo->priv;
-    struct drm_frame *frame = p->fb_queue[0];
+    struct drm_frame *frame = p->fb_queue[index];
 
     if (vo->hwdec) {
         if (--frame->fb->ref_count == 0) {
@@ -284,7 +302,7 @@ static void dequeue_frame(struct vo *vo)
         }
     }
     talloc_free(frame);
-    MP_TARRAY_REMOVE_AT(p->fb_queue, p->fb_queue_len, 0);
+    MP_TARRAY_REMOVE_AT(p->fb_queue, p->fb_queue_len, index);
 }
 
 static void swapchain_step(struct vo *vo)
@@ -292,17 +310,97 @@ static void swapchain_step(struct vo *vo)
     struct priv *p = vo->priv;
 
     if (p->fb_queue_len > 0) {
-        dequeue_frame(vo);
+        dequeue_frame(vo, 0);
+    }
+}
+
+static void copy_osd_rects(struct framebuffer *dst_fb, struct mp_image *osd_sub,
+                           struct mp_rect *rcs, int num_rcs)
+{
+    for (int n = 0; n < num_rcs; n++) {
+        struct mp_rect rc = rcs[n];
+
+        int rw = mp_rect_w(rc);
+        int rh = mp_rect_h(rc);
+
+        void *src = mp_image_pixel_ptr(osd_sub, 0, rc.x0, rc.y0);
+        void *dst = dst_fb->map + rc.x0 * 4 + rc.y0 * dst_fb->stride;
+
+        // Avoid overflowing if we have this special case.
+        if (n == num_rcs - 1)
+            --rh;
+
+        memcpy_pic(dst, src, rw * 4, rh, dst_fb->stride, osd_sub->stride[0]);
     }
 }
 
+// Once the page flip that showed osd_next completed, it's the front buffer.
+static void check_osd_flip(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+
+    if (p->osd_next >= 0 && p->osd_next_queued && !vo->drm->waiting_for_flip) {
+        p->osd_front = p->osd_next;
+        p->osd_next = -1;
+        p->osd_next_queued = false;
+    }
+}
+
+// Render OSD and subtitles into the back OSD buffer, and schedule it for
+// display with the next flip. Nothing is copied if the content is unchanged.
+static void update_osd(struct vo *vo, double pts)
+{
+    struct priv *p = vo->priv;
+    struct mp_rect act_rc[1], mod_rc[64];
+    int num_act_rc = 0, num_mod_rc = 0;
+
+    // The back buffer is still queued for display (possibly with a frame that
+    // was rendered ahead). Retry with the next frame.
+    check_osd_flip(vo);
+    if (p->osd_next >= 0)
+        return;
+
+    if (!p->osd_cache)
+        p->osd_cache = mp_draw_sub_alloc(p, vo->global);
+
+    struct sub_bitmap_list *sbs = osd_render(vo->osd, p->osd, pts, 0, mp_draw_sub_formats);
+    if (!sbs) {
+        MP_ERR(vo, "Cannot get sub bitmap list!\n");
+        return;
+    }
+    if (sbs->change_id == p->osd_change_id) {
+        talloc_free(sbs);
+        return;
+    }
+    p->osd_change_id = sbs->change_id;
+
+    struct mp_image *osd_sub = mp_draw_sub_overlay(p->osd_cache, sbs,
+                                                   act_rc, MP_ARRAY_SIZE(act_rc), &num_act_rc,
+                                                   mod_rc, MP_ARRAY_SIZE(mod_rc), &num_mod_rc);
+    talloc_free(sbs);
+    if (!osd_sub) {
+        MP_ERR(vo, "Cannot get OSD image!\n");
+        return;
+    }
+    if (!num_mod_rc)
+        return;
+
+    // The back buffer is missing the previous update as well as this one.
+    struct framebuffer *back = p->osd_bufs[!p->osd_front];
+    copy_osd_rects(back, osd_sub, p->osd_prev_rc, p->num_osd_prev_rc);
+    copy_osd_rects(back, osd_sub, mod_rc, num_mod_rc);
+
+    memcpy(p->osd_prev_rc, mod_rc, num_mod_rc * sizeof(mod_rc[0]));
+    p->num_osd_prev_rc = num_mod_rc;
+    p->osd_next = !p->osd_front;
+}
+
 static void draw_frame(struct vo *vo, struct vo_frame *frame)
 {
     struct vo_drm_state *drm = vo->drm;
     struct priv *p = vo->priv;
+    struct drm_atomic_context *atomic_ctx = drm->atomic_context;
     struct framebuffer *fb;
-    struct mp_rect act_rc[1], mod_rc[64];
-    int num_act_rc = 0, num_mod_rc = 0;
 
     if (!drm->active)
         return;
@@ -352,43 +450,71 @@ static void draw_frame(struct vo *vo, struct vo_frame *frame)
         }
     }
 
-    if (!p->osd_cache)
-        p->osd_cache = mp_draw_sub_alloc(p, vo->global);
+    if (atomic_ctx->osd_plane)
+        update_osd(vo, frame->current ? frame->current->pts : MP_NOPTS_VALUE);
 
-    struct sub_bitmap_list *sbs = osd_render(vo->osd, p->osd, frame->current->pts, 0, mp_draw_sub_formats);
-    if (!sbs) {
-        MP_ERR(vo, "Cannot get sub bitmap list!\n");
-    } else {
-        struct mp_image *osd_sub = mp_draw_sub_overlay(p->osd_cache, sbs,
-                                                       act_rc, MP_ARRAY_SIZE(act_rc), &num_act_rc,
-                                                       mod_rc, MP_ARRAY_SIZE(mod_rc), &num_mod_rc);
-        talloc_free(sbs);
-        if (!osd_sub) {
-            MP_ERR(vo, "Cannot get OSD image!\n");
-        } else {
-            for (int n = 0; n < num_mod_rc; n++) {
-                 p->osd_changed = true;
-                 struct mp_rect rc = mod_rc[n];
-
-                 int rw = mp_rect_w(rc);
-                 int rh = mp_rect_h(rc);
+    enqueue_frame(vo, fb);
+}
 
-                 void *src = mp_image_pixel_ptr(osd_sub, 0, rc.x0, rc.y0);
-                 void *dst = p->osd_buf->map + rc.x0 * 4 + rc.y0 * p->osd_buf->stride;
+static void set_plane(drmModeAtomicReq *request, struct drm_object *plane,
+                      int *err, char *name, uint64_t value)
+{
+    if (drm_object_set_property(request, plane, name, value) < 0)
+        *err = -1;
+}
 
-                 // Avoid overflowing if we have this special case.
-                 if (n == num_mod_rc - 1)
-                    --rh;
+// Update the video plane, and the OSD plane if its content changed, in a
+// single non-blocking atomic commit. Completion is signalled with a page flip
+// event like drmModePageFlip(). Returns false if the driver refused it.
+static bool commit_planes(struct vo *vo, struct framebuffer *fb, struct mp_rect dst)
+{
+    struct vo_drm_state *drm = vo->drm;
+    struct priv *p = vo->priv;
+    struct drm_atomic_context *atomic_ctx = drm->atomic_context;
+    struct drm_object *video = atomic_ctx->drmprime_video_plane;
+    int err = 0;
 
-                 memcpy_pic(dst, src, rw * 4, rh, p->osd_buf->stride, osd_sub->stride[0]);
-            }
-        }
+    drmModeAtomicReqPtr request = drmModeAtomicAlloc();
+    if (!request)
+        return false;
+
+    set_plane(request, video, &err, "FB_ID", fb->id);
+    set_plane(request, video, &err, "CRTC_ID", drm->crtc_id);
+    set_plane(request, video, &err, "SRC_X", p->src.x0 << 16);
+    set_plane(request, video, &err, "SRC_Y", p->src.y0 << 16);
+    set_plane(request, video, &err, "SRC_W", mp_rect_w(p->src) << 16);
+    set_plane(request, video, &err, "SRC_H", mp_rect_h(p->src) << 16);
+    set_plane(request, video, &err, "CRTC_X", dst.x0);
+    set_plane(request, video, &err, "CRTC_Y", dst.y0);
+    set_plane(request, video, &err, "CRTC_W", mp_rect_w(dst));
+    set_plane(request, video, &err, "CRTC_H", mp_rect_h(dst));
+
+    if (p->osd_next >= 0 && !p->osd_next_queued) {
+        struct drm_object *osd = atomic_ctx->osd_plane;
+        set_plane(request, osd, &err, "FB_ID", p->osd_bufs[p->osd_next]->id);
+        set_plane(request, osd, &err, "CRTC_ID", drm->crtc_id);
+        set_plane(request, osd, &err, "SRC_X", 0);
+        set_plane(request, osd, &err, "SRC_Y", 0);
+        set_plane(request, osd, &err, "SRC_W", p->osd.w << 16);
+        set_plane(request, osd, &err, "SRC_H", p->osd.h << 16);
+        set_plane(request, osd, &err, "CRTC_X", 0);
+        set_plane(request, osd, &err, "CRTC_Y", 0);
+        set_plane(request, osd, &err, "CRTC_W", drm->fb->width);
+        set_plane(request, osd, &err, "CRTC_H", drm->fb->height);
+    }
+
+    if (!err) {
+        err = drmModeAtomicCommit(drm->fd, request,
+                                  DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT,
+                                  drm);
+        if (err)
+            MP_VERBOSE(vo, "Atomic commit failed: %s\n", mp_strerror(errno));
     }
-
-    enqueue_frame(vo, fb);
+    drmModeAtomicFree(request);
+    return !err;
 }
 
-static void queue_flip(struct vo *vo, struct drm_frame *frame)
+static bool queue_flip(struct vo *vo, struct drm_frame *frame)
 {
     struct vo_drm_state *drm = vo->drm;
     struct priv *p = vo->priv;
@@ -427,18 +553,41 @@ static void queue_flip(struct vo *vo, struct drm_frame *frame)
         }
     }
 
+    struct mp_rect dst = {
+        .x0 = MP_ALIGN_DOWN(dst_x, 2),
+        .y0 = MP_ALIGN_DOWN(dst_y, 2),
+    };
+    dst.x1 = dst.x0 + MP_ALIGN_DOWN(dst_w, 2);
+    dst.y1 = dst.y0 + MP_ALIGN_DOWN(dst_h, 2);
+
+    check_osd_flip(vo);
+
+    // A failed atomic commit is retried with the next frame. Only give up on
+    // it if it keeps failing.
+    if (p->atomic_flip_failures < MAX_ATOMIC_FLIP_FAILURES) {
+        if (commit_planes(vo, frame->fb, dst)) {
+            drm->waiting_for_flip = true;
+            p->osd_next_queued = p->osd_next >= 0;
+            p->atomic_flip_failures = 0;
+            return true;
+        }
+        if (++p->atomic_flip_failures == MAX_ATOMIC_FLIP_FAILURES)
+            MP_WARN(vo, "Atomic plane update failed, using legacy page flips.\n");
+    }
+
     drmModeSetPlane(drm->fd, atomic_ctx->drmprime_video_plane->id, drm->crtc_id, frame->fb->id, 0,
-                    MP_ALIGN_DOWN(dst_x, 2),
-                    MP_ALIGN_DOWN(dst_y, 2),
-                    MP_ALIGN_DOWN(dst_w ,2),
-                    MP_ALIGN_DOWN(dst_h, 2),
+                    dst.x0,
+                    dst.y0,
+                    mp_rect_w(dst),
+                    mp_rect_h(dst),
                     p->src.x0 << 16,
                     p->src.y0 << 16,
                     src_w << 16,
                     src_h << 16);
 
-    if (p->osd_changed) {
-        drmModeSetPlane(drm->fd, atomic_ctx->osd_plane->id, drm->crtc_id, p->osd_buf->id, 0,
+    if (p->osd_next >= 0 && !p->osd_next_queued) {
+        drmModeSetPlane(drm->fd, atomic_ctx->osd_plane->id, drm->crtc_id,
+                        p->osd_bufs[p->osd_next]->id, 0,
                         0,
                         0,
                         drm->fb->width,
@@ -447,7 +596,8 @@ static void queue_flip(struct vo *vo, struct drm_frame *frame)
                         0,
                         p->osd.w << 16,
                         p->osd.h << 16);
-        p->osd_changed = false;
+        // (Also considered on screen once the following flip completed.)
+        p->osd_next_queued = true;
     }
 
     int ret = drmModePageFlip(drm->fd, drm->crtc_id,
@@ -455,8 +605,27 @@ static void queue_flip(struct vo *vo, struct drm_frame *frame)
     if (ret)
         MP_WARN(vo, "Failed to queue page flip: %s\n", mp_strerror(errno));
     drm->waiting_for_flip = !ret;
+    return !ret;
+}
+
+static unsigned int swapchain_len(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+    return p->fb_queue_len;
+}
+
+static bool swapchain_flip(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+    return queue_flip(vo, p->fb_queue[1]);
 }
 
+static const struct vo_drm_swapchain_fns swapchain_fns = {
+    .queue_len = swapchain_len,
+    .queue_flip = swapchain_flip,
+    .dequeue = dequeue_frame,
+};
+
 static void flip_page(struct vo *vo)
 {
     struct priv *p = vo->priv;
@@ -466,6 +635,11 @@ static void flip_page(struct vo *vo)
     if (!drm->active)
         return;
 
+    if (p->render_ahead) {
+        vo_drm_flip_page_async(vo, p->render_ahead);
+        return;
+    }
+
     while (drain || p->fb_queue_len > vo->opts->swapchain_depth) {
         if (drm->waiting_for_flip) {
             vo_drm_wait_on_flip(vo->drm);
@@ -504,8 +678,9 @@ static void uninit(struct vo *vo)
 {
     struct priv *p = vo->priv;
 
-    if (p->osd_buf) {
-        destroy_framebuffer(p->osd_buf);
+    for (int n = 0; n < 2; n++) {
+        if (p->osd_bufs[n])
+            destroy_framebuffer(p->osd_bufs[n]);
     }
 
     if (!vo->hwdec && p->bufs) {
@@ -542,6 +717,11 @@ static int preinit(struct vo *vo)
 
     struct vo_drm_state *drm = vo->drm;
 
+    p->osd_next = -1;
+    p->render_ahead = vo->opts->render_ahead;
+    if (p->render_ahead && !vo_drm_enable_async_flip(drm, &swapchain_fns))
+        p->render_ahead = 0;
+
     p->primary_buf = setup_framebuffer(vo, drm->mode.mode.hdisplay, drm->mode.mode.vdisplay, IMGFMT_ARGB);
     if (!p->primary_buf)
         goto err;
@@ -561,17 +741,20 @@ static int preinit(struct vo *vo)
         goto err;
     }
 
-    if (!p->osd_buf) {
-        p->osd_buf = setup_framebuffer(vo, drm->mode.mode.hdisplay / 2, drm->mode.mode.vdisplay / 2, IMGFMT_ARGB);
-        if (!p->osd_buf) {
+    struct drm_atomic_context *atomic_ctx = drm->atomic_context;
+
+    if (!atomic_ctx->osd_plane)
+        MP_WARN(vo, "No overlay plane left for the OSD, OSD and subtitles disabled.\n");
+
+    for (int n = 0; atomic_ctx->osd_plane && n < 2; n++) {
+        p->osd_bufs[n] = setup_framebuffer(vo, drm->mode.mode.hdisplay / 2, drm->mode.mode.vdisplay / 2, IMGFMT_ARGB);
+        if (!p->osd_bufs[n]) {
             MP_ERR(vo, "Failed to allocate OSD buffer\n");
             goto err;
         }
-        p->osd_buf->locked = false;
+        p->osd_bufs[n]->locked = false;
     }
 
-    struct drm_atomic_context *atomic_ctx = drm->atomic_context;
-
     drmModeAtomicReqPtr request = drmModeAtomicAlloc();
     if (!request) {
         MP_ERR(drm, "Failed to allocate DRM atomic request\n");
@@ -590,7 +773,8 @@ static int preinit(struct vo *vo)
         drmModeAtomicFree(request);
         goto err;
     }
-    ret = drm_object_set_property(request, atomic_ctx->osd_plane, "zorder", 1);
+    ret = atomic_ctx->osd_plane ?
+          drm_object_set_property(request, atomic_ctx->osd_plane, "zorder", 1) : 0;
     if (ret < 0) {
         MP_ERR(drm, "Could not set ZPOS on OSD plane: %s\n", mp_strerror(ret));
         drmModeAtomicFree(request);
@@ -633,6 +817,7 @@ static int control(struct vo *vo, uint32_t request, void *arg)
         while (p->fb_queue_len > 0) {
             swapchain_step(vo);
         }
+        vo->drm->flip_queued = false;
         return VO_TRUE;
     case VOCTRL_CHECK_EVENTS:
         break;